@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file async_io.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/07/22 16:11:01
+ * @brief
+ *
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <vector>
+#include "eagleengine/async_io.h"
+
+namespace eagleengine {
+
+// user_data of the nop request which wakes up the completion thread for exiting
+static const uint64_t kWakeupUserData = ~0ul;
+
+static int IOUringSetup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int IOUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int64_t ExecuteRequest(const IORequest& request) {
+    int64_t res = 0;
+    errno = 0;
+    switch (request.opcode) {
+    case kIORead:
+        res = preadv(request.fd, request.iov, request.iovcnt, request.offset);
+        break;
+    case kIOWrite:
+        res = pwritev(request.fd, request.iov, request.iovcnt, request.offset);
+        break;
+    case kIOFsync:
+        res = fsync(request.fd);
+        break;
+    case kIOFdatasync:
+        res = fdatasync(request.fd);
+        break;
+    default:
+        errno = EINVAL;
+        res = -1;
+    }
+    return res < 0 ? -errno : res;
+}
+
+// executes requests in the caller thread
+class SyncIO : public AsyncIO {
+public:
+    virtual Status Submit(const IORequest* requests, int num, int* submitted) {
+        *submitted = num;
+        for (int i = 0; i < num; ++i) {
+            int64_t res = ExecuteRequest(requests[i]);
+            if (requests[i].callback != NULL) {
+                requests[i].callback(requests[i].arg, res);
+            }
+        }
+        return Status();
+    }
+
+    virtual bool IsAsync() {
+        return false;
+    }
+};
+
+class UringIO : public AsyncIO {
+public:
+    UringIO();
+    virtual ~UringIO();
+    Status Init(int queue_depth);
+
+    virtual Status Submit(const IORequest* requests, int num, int* submitted);
+
+    virtual bool IsAsync() {
+        return true;
+    }
+
+private:
+    struct Context {
+        IOCallback callback;
+        void* arg;
+        int next_free;
+    };
+
+    static void* CompletionThread(void* arg);
+    void ReapCompletions();
+    // caller should hold lock_
+    void PrepareRequest(const IORequest& request);
+
+    DISALLOW_COPY_AND_ASSIGN(UringIO);
+    int ring_fd_;
+    unsigned sq_entries_;
+
+    void* sq_ptr_;
+    size_t sq_size_;
+    void* cq_ptr_;
+    size_t cq_size_;
+    struct io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    // protect submission queue & contexts
+    MutexLock lock_;
+    CondVar cond_;
+    std::vector<Context> contexts_;
+    int free_context_;
+    unsigned inflight_;
+    // requests in submission queue but not consumed by kernel yet
+    unsigned unsubmitted_;
+
+    pthread_t completion_thread_;
+    bool thread_started_;
+    volatile bool stopping_;
+};
+
+UringIO::UringIO() : cond_(&lock_) {
+    ring_fd_ = -1;
+    sq_entries_ = 0;
+    sq_ptr_ = MAP_FAILED;
+    sq_size_ = 0;
+    cq_ptr_ = MAP_FAILED;
+    cq_size_ = 0;
+    sqes_ = (struct io_uring_sqe*)MAP_FAILED;
+    sqes_size_ = 0;
+    free_context_ = -1;
+    inflight_ = 0;
+    unsubmitted_ = 0;
+    thread_started_ = false;
+    stopping_ = false;
+}
+
+UringIO::~UringIO() {
+    if (thread_started_) {
+        // wake up the completion thread with a nop request
+        stopping_ = true;
+        {
+            ScopedLocker<MutexLock> lock(lock_);
+            unsigned tail = *sq_tail_;
+            unsigned index = tail & *sq_mask_;
+            struct io_uring_sqe* sqe = &sqes_[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = kWakeupUserData;
+            sq_array_[index] = index;
+            __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+            unsubmitted_++;
+            while (unsubmitted_ > 0) {
+                int ret = IOUringEnter(ring_fd_, unsubmitted_, 0, 0);
+                if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    break;
+                }
+                if (ret > 0) {
+                    unsubmitted_ -= ret;
+                }
+            }
+        }
+        pthread_join(completion_thread_, NULL);
+    }
+
+    if (sqes_ != MAP_FAILED) {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED) {
+        munmap(sq_ptr_, sq_size_);
+    }
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);
+    }
+}
+
+Status UringIO::Init(int queue_depth) {
+    Status status;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    errno = 0;
+    ring_fd_ = IOUringSetup(queue_depth, &params);
+    if (ring_fd_ < 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to setup io_uring with %d entries, %m", queue_depth);
+        return status;
+    }
+    sq_entries_ = params.sq_entries;
+
+    // map submission & completion queue
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && cq_size_ > sq_size_) {
+        sq_size_ = cq_size_;
+    }
+    errno = 0;
+    sq_ptr_ = mmap(NULL, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        status.set_code(kIOError);
+        status.set_msg("failed to mmap io_uring submission queue, %m");
+        return status;
+    }
+    if (single_mmap) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(NULL, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            status.set_code(kIOError);
+            status.set_msg("failed to mmap io_uring completion queue, %m");
+            return status;
+        }
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = (struct io_uring_sqe*)mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        status.set_code(kIOError);
+        status.set_msg("failed to mmap io_uring sqes, %m");
+        return status;
+    }
+
+    char* sq = (char*)sq_ptr_;
+    sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)cq_ptr_;
+    cq_head_ = (unsigned*)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // one context for each inflight request; one sqe is kept for the wakeup nop
+    contexts_.resize(sq_entries_ - 1);
+    for (int i = 0; i < (int)contexts_.size(); ++i) {
+        contexts_[i].next_free = free_context_;
+        free_context_ = i;
+    }
+
+    if (pthread_create(&completion_thread_, NULL, CompletionThread, this) != 0) {
+        status.set_code(kInternalError);
+        status.set_msg("failed to create io_uring completion thread");
+        return status;
+    }
+    thread_started_ = true;
+    return status;
+}
+
+void UringIO::PrepareRequest(const IORequest& request) {
+    int context_id = free_context_;
+    Context& context = contexts_[context_id];
+    free_context_ = context.next_free;
+    context.callback = request.callback;
+    context.arg = request.arg;
+    inflight_++;
+
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = request.fd;
+    sqe->user_data = context_id;
+    switch (request.opcode) {
+    case kIORead:
+    case kIOWrite:
+        sqe->opcode = request.opcode == kIORead ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = (uint64_t)(uintptr_t)request.iov;
+        sqe->len = request.iovcnt;
+        sqe->off = request.offset;
+        break;
+    case kIOFsync:
+        sqe->opcode = IORING_OP_FSYNC;
+        break;
+    case kIOFdatasync:
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        break;
+    }
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+}
+
+Status UringIO::Submit(const IORequest* requests, int num, int* submitted) {
+    Status status;
+    *submitted = 0;
+    if (stopping_) {
+        status.set_code(kInternalError);
+        status.set_msg("io_uring is stopping");
+        return status;
+    }
+
+    ScopedLocker<MutexLock> lock(lock_);
+    const unsigned max_inflight = contexts_.size();
+    while (*submitted < num) {
+        // wait for free slots
+        while (inflight_ >= max_inflight) {
+            cond_.Wait();
+        }
+        while (*submitted < num && inflight_ < max_inflight) {
+            PrepareRequest(requests[*submitted]);
+            (*submitted)++;
+            unsubmitted_++;
+        }
+
+        while (unsubmitted_ > 0) {
+            errno = 0;
+            int ret = IOUringEnter(ring_fd_, unsubmitted_, 0, 0);
+            if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                // prepared requests stay in the submission queue and are counted as
+                // submitted, they are completed only if a later enter succeeds
+                status.set_code(kIOError);
+                status.set_msg("failed to submit %u requests to io_uring, %m", unsubmitted_);
+                return status;
+            }
+            if (ret > 0) {
+                unsubmitted_ -= ret;
+            }
+        }
+    }
+    return status;
+}
+
+void* UringIO::CompletionThread(void* arg) {
+    UringIO* io = (UringIO*)arg;
+    io->ReapCompletions();
+    return NULL;
+}
+
+void UringIO::ReapCompletions() {
+    bool wakeup = false;
+    while (true) {
+        errno = 0;
+        int ret = IOUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // nothing can be done but retry
+            usleep(1000);
+        }
+
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+            if (cqe->user_data == kWakeupUserData) {
+                wakeup = true;
+                continue;
+            }
+
+            IOCallback callback = NULL;
+            void* callback_arg = NULL;
+            {
+                ScopedLocker<MutexLock> lock(lock_);
+                Context& context = contexts_[cqe->user_data];
+                callback = context.callback;
+                callback_arg = context.arg;
+                context.next_free = free_context_;
+                free_context_ = cqe->user_data;
+                inflight_--;
+                cond_.SignalAll();
+            }
+            if (callback != NULL) {
+                callback(callback_arg, cqe->res);
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        if (wakeup) {
+            ScopedLocker<MutexLock> lock(lock_);
+            if (inflight_ == 0) {
+                return;
+            }
+        }
+    }
+}
+
+Status AsyncIO::SubmitAndWait(IORequest* requests, int num, int64_t* results) {
+    IOFuture* futures = new IOFuture[num];
+    for (int i = 0; i < num; ++i) {
+        requests[i].callback = IOFuture::Done;
+        requests[i].arg = &futures[i];
+    }
+
+    int submitted = 0;
+    Status status = Submit(requests, num, &submitted);
+    if (status.code() != kOk) {
+        if (submitted == 0) {
+            delete[] futures;
+        }
+        // otherwise submitted requests maybe still referencing futures, leave them alone
+        return status;
+    }
+    for (int i = 0; i < num; ++i) {
+        results[i] = futures[i].Wait();
+    }
+    delete[] futures;
+    return status;
+}
+
+AsyncIO* AsyncIO::Default() {
+    static SyncIO sync_io;
+    return &sync_io;
+}
+
+AsyncIO* AsyncIO::Create(int queue_depth) {
+    if (queue_depth < 2) {
+        queue_depth = 2;
+    }
+    UringIO* io = new UringIO();
+    Status status = io->Init(queue_depth);
+    if (status.code() == kOk) {
+        return io;
+    }
+
+    delete io;
+    return new SyncIO();
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
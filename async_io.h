@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file async_io.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/07/22 16:12:10
+ * @brief asynchronous io backend built on raw io_uring syscalls, with a synchronous
+ *        fallback when io_uring is not available
+ *
+*/
+#ifndef _EAGLEFS_ASYNC_IO_H_
+#define _EAGLEFS_ASYNC_IO_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include "eagleengine/common.h"
+#include "eagleengine/status.h"
+#include "eagleengine/concurrent/cond_var.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// res is the number of bytes transferred, 0 for fsync, or -errno on failure
+typedef void (*IOCallback)(void* arg, int64_t res);
+
+enum IOOpcode {
+    kIORead = 0,
+    kIOWrite = 1,
+    kIOFsync = 2,
+    kIOFdatasync = 3
+};
+
+struct IORequest {
+    int opcode;
+    int fd;
+    // iov must stay valid until the request is completed
+    const struct iovec* iov;
+    int iovcnt;
+    int64_t offset;
+    IOCallback callback;
+    void* arg;
+
+    IORequest() : opcode(kIORead), fd(-1), iov(NULL), iovcnt(0), offset(0), callback(NULL),
+                  arg(NULL) {
+    }
+};
+
+// a future for one request; pass IOFuture::Done as callback and the future as arg
+class IOFuture {
+public:
+    IOFuture() : cond_(&lock_), done_(false), result_(0) {
+    }
+
+    static void Done(void* arg, int64_t res) {
+        IOFuture* future = (IOFuture*)arg;
+        ScopedLocker<MutexLock> lock(future->lock_);
+        future->result_ = res;
+        future->done_ = true;
+        future->cond_.SignalAll();
+    }
+
+    // block until the request is completed, return its result
+    int64_t Wait() {
+        ScopedLocker<MutexLock> lock(lock_);
+        while (!done_) {
+            cond_.Wait();
+        }
+        return result_;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IOFuture);
+    MutexLock lock_;
+    CondVar cond_;
+    bool done_;
+    int64_t result_;
+};
+
+// Note:
+// 1. AsyncIO is thread safe, it is usually shared by all blocks on one disk;
+// 2. callbacks are invoked from an internal completion thread, or from Submit() itself
+//    for the synchronous fallback; they should not block on other requests of the same
+//    AsyncIO
+//
+class AsyncIO {
+public:
+    virtual ~AsyncIO() {}
+
+    // submit all requests together; *submitted is set to the number of requests handed to
+    // the backend, callbacks of them are invoked even if an error is returned, while the
+    // others are never executed; an error with some requests submitted means the backend is
+    // broken
+    virtual Status Submit(const IORequest* requests, int num, int* submitted) = 0;
+
+    // whether requests are really executed asynchronously
+    virtual bool IsAsync() = 0;
+
+    // submit requests and wait for all of them; results[i] is the result of requests[i],
+    // callback & arg of requests are ignored; nothing is waited for if submission failed
+    Status SubmitAndWait(IORequest* requests, int num, int64_t* results);
+
+    // return io_uring backend if it is available, otherwise the synchronous fallback
+    static AsyncIO* Create(int queue_depth);
+    // the shared synchronous backend, it should not be deleted
+    static AsyncIO* Default();
+};
+
+}
+
+#endif  //_EAGLEFS_ASYNC_IO_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
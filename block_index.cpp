@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file block_index.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/12 16:20:05
+ * @brief
+ *
+*/
+#include "eagleengine/block_index.h"
+#include "eagleengine/dense_index.h"
+#include "eagleengine/hash_table.h"
+#include "eagleengine/swiss_table.h"
+
+namespace eagleengine {
+
+// forward block index methods to a table of IndexEntry
+template <typename Table>
+class TableIndex : public BlockIndex {
+public:
+    explicit TableIndex(int64_t expected_num) : table_(expected_num) {
+    }
+
+    virtual bool Insert(const IndexEntry& new_entry, IndexEntry* old_entry) {
+        return table_.Insert(new_entry, old_entry);
+    }
+    virtual int InsertBatch(const std::vector<IndexEntry>& new_entries,
+                            IndexEntry* old_entry) {
+        return table_.InsertBatch(new_entries, old_entry);
+    }
+    virtual int BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry) {
+        return table_.BulkInsert(entries, old_entry);
+    }
+    virtual bool Get(int64_t object_id, IndexEntry* entry) {
+        return table_.Get(object_id, entry);
+    }
+    virtual int GetBatch(const std::vector<int64_t>& object_ids,
+                         std::vector<IndexEntry>* entries, std::vector<bool>* found) {
+        return table_.GetBatch(object_ids, entries, found);
+    }
+    virtual void Delete(int64_t object_id) {
+        table_.Delete(object_id);
+    }
+    virtual void Dump(std::vector<IndexEntry>* entries) {
+        table_.Dump(entries);
+    }
+    virtual int64_t size() {
+        return table_.size();
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(TableIndex);
+    Table table_;
+};
+
+BlockIndex* BlockIndex::Create(IndexType type, int64_t expected_num) {
+    switch (type) {
+    case kDenseIndex:
+        return new DenseIndex();
+    case kSwissIndex:
+        return new TableIndex<SwissTable<IndexEntry> >(expected_num);
+    case kHashIndex:
+    default:
+        return new TableIndex<HashTable<IndexEntry> >((int)expected_num);
+    }
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
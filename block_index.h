@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file block_index.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/12 16:20:05
+ * @brief memory index of a block, mapping object id to its index entry
+ *
+*/
+#ifndef _EAGLEFS_BLOCK_INDEX_H_
+#define _EAGLEFS_BLOCK_INDEX_H_
+
+#include <stdint.h>
+#include <vector>
+#include "eagleengine/common.h"
+#include "eagleengine/options.h"
+
+namespace eagleengine {
+
+struct IndexEntry {
+    int64_t sequence_number;
+    int64_t object_id;
+    int64_t offset;
+    int size;
+
+    IndexEntry() : sequence_number(-1), object_id(-1), offset(0), size(0) {
+    }
+
+    int64_t key() const {
+        return object_id;
+    }
+};
+
+// Note:
+// 1. all methods are thread safe, see HashTable for their semantics;
+// 2. implementations are chosen by BlockOptions::index_type
+//
+class BlockIndex {
+public:
+    virtual ~BlockIndex() {}
+
+    virtual bool Insert(const IndexEntry& new_entry, IndexEntry* old_entry) = 0;
+    virtual int InsertBatch(const std::vector<IndexEntry>& new_entries,
+                            IndexEntry* old_entry) = 0;
+    virtual int BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry) = 0;
+    virtual bool Get(int64_t object_id, IndexEntry* entry) = 0;
+    virtual int GetBatch(const std::vector<int64_t>& object_ids,
+                         std::vector<IndexEntry>* entries, std::vector<bool>* found) = 0;
+    virtual void Delete(int64_t object_id) = 0;
+    virtual void Dump(std::vector<IndexEntry>* entries) = 0;
+    virtual int64_t size() = 0;
+
+    // expected_num is a hint of the number of objects
+    static BlockIndex* Create(IndexType type, int64_t expected_num);
+};
+
+}
+
+#endif  //_EAGLEFS_BLOCK_INDEX_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
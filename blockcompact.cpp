@@ -13,21 +13,45 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <assert.h>
-#include <map>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <algorithm>
 #include "eagleengine/crc32c.h"
 #include "eagleengine/blockcompact.h"
+#include "eagleengine/rate_limiter.h"
+#include "eagleengine/sealed_table.h"
 
 namespace eagleengine {
 
+static bool OffsetLess(const IndexEntry& left, const IndexEntry& right) {
+    return left.offset < right.offset;
+}
+
 BlockCompact::BlockCompact(EagleBlock* block, Log* log) {
     block_ = block;
     log_ = log;
     data_offset_ = 0;
     max_sequence_number_ = -1;
+    num_objects_ = 0;
+    has_pending_entry_ = false;
+    old_index_offset_ = 0;
+    new_index_entries_ = 0;
     internal_buf_ = (char*)malloc(kMaxObjectSize);
+    for (int i = 0; i < 2; ++i) {
+        pending_writes_[i] = NULL;
+        pending_sizes_[i] = 0;
+    }
+    num_chunks_ = 0;
+    copy_range_failed_ = false;
+    copied_bytes_ = 0;
+    dead_bytes_ = 0;
 }
 
 BlockCompact::~BlockCompact() {
+    for (int i = 0; i < 2; ++i) {
+        // buffers are in use until writes are completed
+        WaitForWrite(i);
+    }
     free(internal_buf_);
 }
 
@@ -68,12 +92,24 @@ Status BlockCompact::CreateNewFDs(const std::string& subdir, BlockFDs* fds) {
         return status;
     }
 
+    // remove stale checkpoint left by the block which used this sub dir before
+    std::string checkpoint_file = newblock_dir;
+    checkpoint_file.append("/");
+    checkpoint_file.append(kCheckpointFile);
+    errno = 0;
+    if (0 != unlink(checkpoint_file.c_str()) && errno != ENOENT) {
+        status.set_code(kIOError);
+        status.set_msg("failed to remove %s, %m", checkpoint_file.c_str());
+        return status;
+    }
+
     // 2. create data file
     std::string data_file = newblock_dir;
     data_file.append("/");
     data_file.append(kDataFile);
     errno = 0;
-    fds->data_fd = open(data_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_LARGEFILE, 0644);
+    // objects are written at data_offset_, copy_file_range doesn't support O_APPEND
+    fds->data_fd = open(data_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
     if (fds->data_fd < 0) {
         status.set_code(kIOError);
         status.set_msg("failed to open %s, %m", data_file.c_str());
@@ -85,7 +121,8 @@ Status BlockCompact::CreateNewFDs(const std::string& subdir, BlockFDs* fds) {
     index_file.append("/");
     index_file.append(kIndexFile);
     errno = 0;
-    fds->index_fd = open(index_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    // read by FindCopied & WriteSealedTable
+    fds->index_fd = open(index_file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
     if (fds->index_fd < 0) {
         status.set_code(kIOError);
         status.set_msg("failed to open %s, %m", index_file.c_str());
@@ -100,18 +137,11 @@ Status BlockCompact::CopyObject(const BlockFDs& new_block_fds, int data_fd, cons
     ObjectHeader header;
     const int header_size = sizeof(header);
     int64_t start_offset = entry.offset - header_size;
-    errno = 0;
-    // seek to the begin offset of object header
-    if (lseek(data_fd, start_offset, SEEK_SET) == -1) {
-        status.set_code(kIOError);
-        status.set_msg("failed to seek to %ld for data file,last sequence_number %ld, %m",
-                start_offset, entry.sequence_number);
-        return status;
-    }
 
     // read object header
+    Throttle(header_size);
     errno = 0;
-    int read_size = read(data_fd, &header, header_size);
+    int read_size = pread(data_fd, &header, header_size, start_offset);
     if (read_size != header_size) {
         status.set_code(kIOError);
         status.set_msg("only read %d bytes for object header but expect %d bytes, object"
@@ -134,8 +164,9 @@ Status BlockCompact::CopyObject(const BlockFDs& new_block_fds, int data_fd, cons
     new_entry.size = entry.size;
     if (entry.size > 0) {
         // read object data
+        Throttle(entry.size);
         errno = 0;
-        read_size = read(data_fd, internal_buf_, entry.size);
+        read_size = pread(data_fd, internal_buf_, entry.size, entry.offset);
         if (read_size != entry.size) {
             status.set_code(kIOError);
             status.set_msg("only read %d bytes for object but expect %d bytes, sequence_number "
@@ -144,115 +175,461 @@ Status BlockCompact::CopyObject(const BlockFDs& new_block_fds, int data_fd, cons
         }
 
         // check crc
-        if (header.crc != Adler32_Value(internal_buf_, entry.size)) {
+        // the header is copied as is, so is its checksum type
+        if (block_->options_.verify_compaction &&
+                header.crc != ObjectChecksum(header.checksum_type, internal_buf_, entry.size)) {
             status.set_code(kDataCorrupted);
             status.set_msg("failed to check crc for object %ld", entry.object_id);
             return status;
         }
 
-        // write object header
-        errno = 0;
-        written_size = write(new_block_fds.data_fd, &header, header_size);
-        if (written_size != header_size) {
-            status.set_code(kIOError);
-            status.set_msg("failed to write object header, only write %d bytes but expect "
-                    "%d bytes, %m", written_size, header_size);
-            return status;
-        }
-
-        // write data
+        // write object header & data
+        struct iovec iov[2];
+        iov[0].iov_base = &header;
+        iov[0].iov_len = header_size;
+        iov[1].iov_base = internal_buf_;
+        iov[1].iov_len = entry.size;
+        Throttle(header_size + entry.size);
         errno = 0;
-        written_size = write(new_block_fds.data_fd, internal_buf_, entry.size);
-        if (written_size != entry.size) {
+        written_size = pwritev(new_block_fds.data_fd, iov, 2, data_offset_);
+        if (written_size != header_size + entry.size) {
             status.set_code(kIOError);
             status.set_msg("failed to write object, only write %d bytes but expect %d bytes, "
-                    "%m", written_size, entry.size);
+                    "%m", written_size, header_size + entry.size);
             return status;
         }
 
         // add it to indexes
         new_entry.offset = data_offset_ + header_size;
-        indexes_.insert(std::pair<int64_t, IndexEntry>(new_entry.object_id, new_entry));
         data_offset_ += header_size;
         data_offset_ += entry.size;
+        num_objects_++;
     } else {
         // this object is marked as deleted
-        std::map<int64_t, IndexEntry>::iterator it = indexes_.find(entry.object_id);
-        if (it != indexes_.end()) {
-            new_entry.offset = (it->second).offset;
-        } else {
-            log_->Write(LL_FATAL, "no object %ld exist!this is should not happen", entry.object_id);
-            exit(1);
+        IndexEntry copied;
+        bool found = false;
+        status = FindCopied(entry.object_id, &copied, &found);
+        if (status.code() != kOk) {
+            return status;
+        }
+        if (!found) {
+            // the object is deleted by an earlier tombstone, which concurrent deletes of old
+            // versions could write; nothing is left to delete, the entry is dropped
+            log_->Write(LL_WARNING, "object %ld of tombstone with sequence_number %ld is not "
+                        "copied or already deleted, skip it", entry.object_id,
+                        entry.sequence_number);
+            return status;
         }
-        indexes_.erase(entry.object_id);
+        new_entry.offset = copied.offset;
+        dead_bytes_ += header_size + copied.size;
+        deleted_ids_.insert(entry.object_id);
     }
 
     // write index file
+    if (new_entry.sequence_number <= max_sequence_number_) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("sequence_number %ld is not after %ld in index file",
+                       new_entry.sequence_number, max_sequence_number_);
+        return status;
+    }
     max_sequence_number_ = new_entry.sequence_number;
+    Throttle(entry_size);
     written_size = write(new_block_fds.index_fd, &new_entry, entry_size);
     if (written_size != entry_size) {
         status.set_code(kIOError);
         status.set_msg("failed to write index, only write %d bytes but expect %d bytes, "
                        "%m", written_size, entry_size);
+        return status;
     }
+    new_index_entries_++;
 
     return status;
 }
 
-Status BlockCompact::CopySyncedObjects(int64_t end_sequence_number, const BlockFDs& new_block_fds,
-                                       const BlockFDs& old_block_fds, IndexEntry* last_entry) {
+Status BlockCompact::ReadIndexEntries(int64_t offset, std::vector<IndexEntry>* entries) {
     Status status;
-    const int entry_size = sizeof(*last_entry);
-    std::map<int64_t, IndexEntry> indexes;
-    while (last_entry->sequence_number < end_sequence_number) {
-        // read indexes for all synced objects
-        errno = 0;
-        int read_size = read(old_block_fds.index_fd, last_entry, entry_size);
-        if (read_size != entry_size) {
+    const int64_t entry_size = sizeof(IndexEntry);
+    Throttle(entries->size() * entry_size);
+    errno = 0;
+    int64_t read_size = pread(old_block_fds_.index_fd, &(*entries)[0],
+                              entries->size() * entry_size, offset);
+    if (read_size < 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to read index file at offset %ld, %m", offset);
+        return status;
+    }
+    // a partial entry at the end of index file is ignored
+    entries->resize(read_size / entry_size);
+    return status;
+}
+
+Status BlockCompact::CopySyncedObjects(int64_t end_sequence_number) {
+    Status status;
+    const int64_t entry_size = sizeof(IndexEntry);
+    const size_t batch_num = kCompactPlanEntries;
+    std::vector<IndexEntry> batch;
+
+    // 1. ids of objects deleted up to end_sequence_number, and where entries after it begin
+    std::vector<int64_t> deleted_ids;
+    int64_t end_offset = 0;
+    bool reach_end = end_sequence_number < 0;
+    while (status.code() == kOk && !reach_end) {
+        batch.resize(batch_num);
+        status = ReadIndexEntries(end_offset, &batch);
+        if (status.code() == kOk && batch.empty()) {
             status.set_code(kIOError);
-            status.set_msg("only read %d bytes from index file but expect %d bytes, last "
-                           "sequence_number %ld, %m", read_size, entry_size,
-                           last_entry->sequence_number);
+            status.set_msg("index file ends at offset %ld before sequence_number %ld",
+                           end_offset, end_sequence_number);
+        }
+        for (size_t i = 0; status.code() == kOk && i < batch.size(); ++i) {
+            if (batch[i].sequence_number > end_sequence_number) {
+                // copied with remaining objects
+                last_entry_ = batch[i];
+                has_pending_entry_ = true;
+                old_index_offset_ = end_offset + entry_size;
+                reach_end = true;
+                break;
+            }
+            if (batch[i].size <= 0) {
+                deleted_ids.push_back(batch[i].object_id);
+            }
+            last_entry_ = batch[i];
+            end_offset += entry_size;
+            if (batch[i].sequence_number == end_sequence_number) {
+                old_index_offset_ = end_offset;
+                reach_end = true;
+                break;
+            }
+        }
+    }
+    std::sort(deleted_ids.begin(), deleted_ids.end());
+
+    // 2. copy undeleted objects by batches; offsets are reserved in order of sequence numbers,
+    // thus objects in index file are in order of offsets as well
+    std::vector<IndexEntry> live;
+    int64_t offset = 0;
+    while (status.code() == kOk && offset < end_offset) {
+        batch.resize(std::min((int64_t)batch_num, (end_offset - offset) / entry_size));
+        status = ReadIndexEntries(offset, &batch);
+        for (size_t i = 0; status.code() == kOk && i < batch.size(); ++i) {
+            if (batch[i].size > 0 && !std::binary_search(deleted_ids.begin(), deleted_ids.end(),
+                                                         batch[i].object_id)) {
+                live.push_back(batch[i]);
+            }
+            if (live.size() >= batch_num) {
+                status = CopyLiveObjects(&live);
+                live.clear();
+            }
+        }
+        offset += batch.size() * entry_size;
+    }
+    if (status.code() == kOk && !live.empty()) {
+        status = CopyLiveObjects(&live);
+    }
+    return status;
+}
+
+Status BlockCompact::CopyLiveObjects(std::vector<IndexEntry>* live) {
+    Status status;
+    if (!std::is_sorted(live->begin(), live->end(), OffsetLess)) {
+        std::sort(live->begin(), live->end(), OffsetLess);
+    }
+    const std::vector<IndexEntry>& entries = *live;
+    const int64_t header_size = sizeof(ObjectHeader);
+    size_t begin = 0;
+    while (status.code() == kOk && begin < entries.size()) {
+        // a chunk of objects close to each other, with at most IOV_MAX runs of adjacent ones
+        int64_t chunk_start = entries[begin].offset - header_size;
+        int64_t chunk_end = entries[begin].offset + entries[begin].size;
+        int runs = 1;
+        size_t end = begin + 1;
+        for (; end < entries.size(); ++end) {
+            int64_t start = entries[end].offset - header_size;
+            int64_t stop = entries[end].offset + entries[end].size;
+            if (stop - chunk_start > kCompactIOSize || start - chunk_end > kCompactMaxGap ||
+                    (start != chunk_end && runs == IOV_MAX)) {
+                break;
+            }
+            if (start != chunk_end) {
+                runs++;
+            }
+            chunk_end = stop;
+        }
+
+        if (chunk_end - chunk_start > kCompactIOSize) {
+            // a large object is copied alone, with the whole internal buffer
+            status = WaitForWrite(0);
+            if (status.code() == kOk) {
+                status = WaitForWrite(1);
+            }
+            if (status.code() == kOk) {
+                status = CopyObject(new_block_fds_, old_block_fds_.data_fd, entries[begin]);
+            }
+        } else if (!block_->options_.verify_compaction && !copy_range_failed_) {
+            status = CopyChunkByRange(entries, begin, end);
+            if (status.code() == kOk && copy_range_failed_) {
+                // nothing is copied, fall back to buffers
+                status = CopyChunkByBuffer(entries, begin, end);
+            }
+        } else {
+            status = CopyChunkByBuffer(entries, begin, end);
+        }
+        begin = end;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        Status write_status = WaitForWrite(i);
+        if (status.code() == kOk) {
+            status = write_status;
+        }
+    }
+    return status;
+}
+
+static ssize_t CopyFileRange(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out,
+                             size_t len) {
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+Status BlockCompact::CopyChunkByRange(const std::vector<IndexEntry>& entries, size_t begin,
+                                      size_t end) {
+    Status status;
+    const int64_t header_size = sizeof(ObjectHeader);
+    loff_t out_offset = data_offset_;
+    size_t i = begin;
+    while (i < end) {
+        // a run of adjacent objects
+        loff_t in_offset = entries[i].offset - header_size;
+        int64_t run_end = entries[i].offset + entries[i].size;
+        for (++i; i < end && entries[i].offset - header_size == run_end; ++i) {
+            run_end = entries[i].offset + entries[i].size;
+        }
+
+        while (in_offset < run_end) {
+            // the range is read and written in kernel, both are charged
+            int64_t len = std::min(run_end - in_offset, kCompactIOSize);
+            Throttle(len);
+            Throttle(len);
+            errno = 0;
+            ssize_t copied = CopyFileRange(old_block_fds_.data_fd, &in_offset,
+                                           new_block_fds_.data_fd, &out_offset, len);
+            if (copied < 0 && errno == EINTR) {
+                continue;
+            }
+            if (copied < 0 && out_offset == data_offset_ && (errno == ENOSYS ||
+                    errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                log_->Write(LL_NOTICE, "copy_file_range is not supported, %m");
+                copy_range_failed_ = true;
+                return status;
+            }
+            if (copied <= 0) {
+                status.set_code(kIOError);
+                status.set_msg("failed to copy data file range at offset %ld, %m", in_offset);
+                return status;
+            }
+        }
+    }
+
+    return AppendEntries(entries, begin, end);
+}
+
+Status BlockCompact::CopyChunkByBuffer(const std::vector<IndexEntry>& entries, size_t begin,
+                                       size_t end) {
+    const int64_t header_size = sizeof(ObjectHeader);
+    // the other buffer maybe still written
+    int buffer = num_chunks_++ % 2;
+    Status status = WaitForWrite(buffer);
+    if (status.code() != kOk) {
+        return status;
+    }
+
+    char* buf = internal_buf_ + buffer * kCompactIOSize;
+    int64_t chunk_start = entries[begin].offset - header_size;
+    int64_t chunk_size = entries[end - 1].offset + entries[end - 1].size - chunk_start;
+    Throttle(chunk_size);
+    errno = 0;
+    int64_t read_size = pread(old_block_fds_.data_fd, buf, chunk_size, chunk_start);
+    if (read_size != chunk_size) {
+        status.set_code(kIOError);
+        status.set_msg("only read %ld bytes of data file at offset %ld but expect %ld bytes, %m",
+                       read_size, chunk_start, chunk_size);
+        return status;
+    }
+
+    std::vector<struct iovec>& iovs = iovs_[buffer];
+    iovs.clear();
+    int64_t write_size = 0;
+    for (size_t i = begin; i < end; ++i) {
+        char* object = buf + (entries[i].offset - header_size - chunk_start);
+        ObjectHeader header;
+        memcpy(&header, object, header_size);
+        if (header.object_id != entries[i].object_id || header.size != entries[i].size) {
+            status.set_code(kDataCorrupted);
+            status.set_msg("object id %ld size %d in header but object id %ld size %d in index",
+                           header.object_id, header.size, entries[i].object_id,
+                           entries[i].size);
+            return status;
+        }
+        // the header is copied as is, so is its checksum type
+        if (block_->options_.verify_compaction && header.crc != ObjectChecksum(
+                    header.checksum_type, object + header_size, entries[i].size)) {
+            status.set_code(kDataCorrupted);
+            status.set_msg("failed to check crc for object %ld", entries[i].object_id);
             return status;
         }
 
-        if (last_entry->sequence_number > end_sequence_number) {
-            break;
+        int64_t object_size = header_size + entries[i].size;
+        if (!iovs.empty() && (char*)iovs.back().iov_base + iovs.back().iov_len == object) {
+            iovs.back().iov_len += object_size;
+        } else {
+            struct iovec iov;
+            iov.iov_base = object;
+            iov.iov_len = object_size;
+            iovs.push_back(iov);
         }
+        write_size += object_size;
+    }
 
-        if (last_entry->size <= 0) {
-            // this object is marked as deleted
-            indexes.erase(last_entry->object_id);
+    // written while the next chunk is read
+    Throttle(write_size);
+    IOFuture* future = new IOFuture();
+    IORequest request;
+    request.opcode = kIOWrite;
+    request.fd = new_block_fds_.data_fd;
+    request.iov = &iovs[0];
+    request.iovcnt = iovs.size();
+    request.offset = data_offset_;
+    request.callback = IOFuture::Done;
+    request.arg = future;
+    int submitted = 0;
+    status = block_->io_->Submit(&request, 1, &submitted);
+    if (status.code() != kOk) {
+        if (submitted == 0) {
+            delete future;
         } else {
-            indexes.insert(std::pair<int64_t, IndexEntry>(last_entry->object_id, *last_entry));
+            // the write stays in the queue of a broken backend and maybe never completed; its
+            // future and buffer are leaked rather than waited for or freed under it
+            log_->Write(LL_ERROR, "write of new data file is left in a broken io backend");
+            internal_buf_ = NULL;
         }
+        return status;
     }
+    pending_writes_[buffer] = future;
+    pending_sizes_[buffer] = write_size;
+    return AppendEntries(entries, begin, end);
+}
 
-    std::map<int64_t, IndexEntry>::const_iterator it = indexes.cbegin();
-    for (; it != indexes.cend(); ++it) {
-        // copy undeleted object
-        status = CopyObject(new_block_fds, old_block_fds.data_fd, it->second);
-        if (status.code() != kOk) {
+void BlockCompact::Throttle(int64_t bytes) {
+    if (block_->options_.rate_limiter != NULL) {
+        block_->options_.rate_limiter->Request(bytes);
+    }
+}
+
+Status BlockCompact::WaitForWrite(int buffer) {
+    Status status;
+    IOFuture* future = pending_writes_[buffer];
+    if (future == NULL) {
+        return status;
+    }
+    int64_t res = future->Wait();
+    delete future;
+    pending_writes_[buffer] = NULL;
+    if (res != pending_sizes_[buffer]) {
+        status.set_code(kIOError);
+        status.set_msg("failed to write %ld bytes to new data file, result %ld",
+                       pending_sizes_[buffer], res);
+    }
+    return status;
+}
+
+Status BlockCompact::FindCopied(int64_t object_id, IndexEntry* entry, bool* found) {
+    Status status;
+    *found = false;
+    if (deleted_ids_.count(object_id) > 0) {
+        return status;
+    }
+    // the first entry whose sequence number is not less than object_id
+    const int64_t entry_size = sizeof(IndexEntry);
+    int64_t low = 0;
+    int64_t high = new_index_entries_;
+    while (low < high) {
+        int64_t mid = low + (high - low) / 2;
+        Throttle(entry_size);
+        errno = 0;
+        if (pread(new_block_fds_.index_fd, entry, entry_size, mid * entry_size) != entry_size) {
+            status.set_code(kIOError);
+            status.set_msg("failed to read new index file at offset %ld, %m", mid * entry_size);
             return status;
         }
+        if (entry->sequence_number < object_id) {
+            low = mid + 1;
+        } else if (entry->sequence_number > object_id) {
+            high = mid;
+        } else {
+            *found = entry->size > 0 && entry->object_id == object_id;
+            break;
+        }
     }
+    return status;
+}
 
+Status BlockCompact::AppendEntries(const std::vector<IndexEntry>& entries, size_t begin,
+                                   size_t end) {
+    Status status;
+    const int header_size = sizeof(ObjectHeader);
+    std::vector<IndexEntry> new_entries(entries.begin() + begin, entries.begin() + end);
+    for (size_t i = 0; i < new_entries.size(); ++i) {
+        IndexEntry& new_entry = new_entries[i];
+        data_offset_ += header_size;
+        new_entry.offset = data_offset_;
+        data_offset_ += new_entry.size;
+        copied_bytes_ += header_size + new_entry.size;
+        num_objects_++;
+        if (new_entry.sequence_number <= max_sequence_number_) {
+            status.set_code(kDataCorrupted);
+            status.set_msg("sequence_number %ld is not after %ld in index file",
+                           new_entry.sequence_number, max_sequence_number_);
+            return status;
+        }
+        max_sequence_number_ = new_entry.sequence_number;
+    }
+
+    // write index file
+    const int64_t size = new_entries.size() * sizeof(IndexEntry);
+    Throttle(size);
+    errno = 0;
+    int64_t written_size = write(new_block_fds_.index_fd, &new_entries[0], size);
+    if (written_size != size) {
+        status.set_code(kIOError);
+        status.set_msg("failed to write index, only write %ld bytes but expect %ld bytes, "
+                       "%m", written_size, size);
+        return status;
+    }
+    new_index_entries_ += new_entries.size();
     return status;
 }
 
-Status BlockCompact::CopyRemainingObjects(int64_t end_sequence_number, const BlockFDs& new_block_fds,
-                                      const BlockFDs& old_block_fds, IndexEntry* last_entry) {
+Status BlockCompact::CopyRemainingObjects(int64_t target_sequence_number) {
     Status status;
+    IndexEntry* last_entry = &last_entry_;
     const int entry_size = sizeof(*last_entry);
-    bool copy_last_object = false;
-    if (last_entry->sequence_number > end_sequence_number) {
-        copy_last_object = true;
+    // objects of the block maybe only in its tail buffer
+    status = block_->FlushTail(true);
+    if (status.code() != kOk) {
+        return status;
     }
-    while (last_entry->sequence_number < block_->max_sequence_number()) {
-        if (!copy_last_object) {
+    while (has_pending_entry_ || last_entry->sequence_number < target_sequence_number) {
+        if (!has_pending_entry_) {
             // read indexes for all remainning objects
+            Throttle(entry_size);
             errno = 0;
-            int read_size = read(old_block_fds.index_fd, last_entry, entry_size);
+            int read_size = pread(old_block_fds_.index_fd, last_entry, entry_size,
+                                  old_index_offset_);
             if (read_size != entry_size) {
                 status.set_code(kIOError);
                 status.set_msg("only read %d bytes from index file but expect %d bytes, last "
@@ -260,11 +637,12 @@ Status BlockCompact::CopyRemainingObjects(int64_t end_sequence_number, const Blo
                         last_entry->sequence_number);
                 return status;
             }
+            old_index_offset_ += entry_size;
         } else {
-            copy_last_object = false;
+            has_pending_entry_ = false;
         }
 
-        status = CopyObject(new_block_fds, old_block_fds.data_fd, *last_entry);
+        status = CopyObject(new_block_fds_, old_block_fds_.data_fd, *last_entry);
         if (status.code() != kOk) {
             return status;
         }
@@ -273,67 +651,167 @@ Status BlockCompact::CopyRemainingObjects(int64_t end_sequence_number, const Blo
     return status;
 }
 
-Status BlockCompact::Run(int64_t end_sequence_number) {
+Status BlockCompact::WriteSealedTable(const BlockFDs& new_block_fds) {
+    Status status;
+    // the table is appended right after objects
+    SealedFooter footer;
+    footer.table_offset = data_offset_;
+    footer.max_sequence_number = max_sequence_number_;
+    footer.num_objects = num_objects_;
+
+    // puts in new index file are in order of object ids, since they are sequence numbers
+    const int64_t entry_size = sizeof(IndexEntry);
+    std::vector<IndexEntry> batch;
+    std::vector<IndexEntry> live;
+    int64_t last_object_id = -1;
+    for (int64_t offset = 0; status.code() == kOk && offset < new_index_entries_ * entry_size;
+            offset += batch.size() * entry_size) {
+        batch.resize(std::min(kCompactPlanEntries, new_index_entries_ - offset / entry_size));
+        Throttle(batch.size() * entry_size);
+        errno = 0;
+        int64_t read_size = pread(new_block_fds.index_fd, &batch[0], batch.size() * entry_size,
+                                  offset);
+        if (read_size != (int64_t)batch.size() * entry_size) {
+            status.set_code(kIOError);
+            status.set_msg("failed to read new index file at offset %ld, %m", offset);
+            break;
+        }
+        live.clear();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (batch[i].size <= 0 || deleted_ids_.count(batch[i].object_id) > 0) {
+                continue;
+            }
+            if (batch[i].object_id <= last_object_id) {
+                status.set_code(kDataCorrupted);
+                status.set_msg("object id %ld is not after %ld in new index file",
+                               batch[i].object_id, last_object_id);
+                break;
+            }
+            last_object_id = batch[i].object_id;
+            live.push_back(batch[i]);
+        }
+        if (status.code() == kOk && !live.empty()) {
+            status = SealedTable::WriteEntries(new_block_fds.data_fd, &live[0], live.size(),
+                                               &footer);
+        }
+    }
+    if (status.code() == kOk) {
+        status = SealedTable::WriteFooter(new_block_fds.data_fd, &footer);
+    }
+    return status;
+}
+
+Status BlockCompact::SyncNewFDs(IOOpcode opcode) {
+    IORequest requests[2];
+    requests[0].opcode = opcode;
+    requests[0].fd = new_block_fds_.data_fd;
+    requests[1].opcode = opcode;
+    requests[1].fd = new_block_fds_.index_fd;
+    int64_t results[2];
+    Status status = block_->io_->SubmitAndWait(requests, 2, results);
+    if (status.code() == kOk && results[0] != 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to fsync data file %s, %s", block_->GetFilePath(subdir_, kDataFile).c_str(), strerror(-results[0]));
+    }
+    if (status.code() == kOk && results[1] != 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to fsync index file %s, %s", block_->GetFilePath(subdir_, kIndexFile).c_str(), strerror(-results[1]));
+    }
+    return status;
+}
+
+Status BlockCompact::Copy(int64_t end_sequence_number) {
     Status status;
     if (end_sequence_number > block_->synced_sequence_number()) {
         status.set_code(kInvalidArg);
         status.set_msg("end_sequence_number cannot larger than synced_sequence_number");
         return status;
     }
-    std::string subdir;
     if (block_->current_subdir().compare(kDefaultSubdir) == 0) {
-        subdir = "1";
+        subdir_ = "1";
     } else {
-        subdir = kDefaultSubdir;
+        subdir_ = kDefaultSubdir;
     }
 
     // create fds for new block
-    BlockFDs new_block_fds;
-    status = CreateNewFDs(subdir, &new_block_fds);
+    status = CreateNewFDs(subdir_, &new_block_fds_);
     if (status.code() != kOk) {
         return status;
     }
 
     // open fds for old block
-    BlockFDs old_block_fds;
-    status = OpenOldFDs(&old_block_fds);
+    status = OpenOldFDs(&old_block_fds_);
     if (status.code() != kOk) {
         return status;
     }
 
     // copy synced objects
-    IndexEntry last_entry;
-    status = CopySyncedObjects(end_sequence_number, new_block_fds, old_block_fds,
-                               &last_entry);
-    if (status.code() == kOk) {
-        // copy remainning objects
-        status = CopyRemainingObjects(end_sequence_number, new_block_fds, old_block_fds,
-                                      &last_entry);
+    status = CopySyncedObjects(end_sequence_number);
+
+    // catch up with writes published meanwhile; a pass takes less time than the one before,
+    // unless writes are faster than copying
+    for (int i = 0; status.code() == kOk && i < kCompactCatchUpPasses; ++i) {
+        int64_t target = block_->max_sequence_number();
+        if (!has_pending_entry_ && target - last_entry_.sequence_number <= kCompactCatchUpEntries) {
+            break;
+        }
+        status = CopyRemainingObjects(target);
     }
 
-    // sync data & index
+    // sync what is copied while writes go on, so that Finish() only syncs the last few writes
     if (status.code() == kOk) {
-        if (0 != fsync(new_block_fds.data_fd)) {
-            status.set_code(kIOError);
-            status.set_msg("failed to fsync data file %s, %m", block_->GetFilePath(subdir, kDataFile).c_str());
-        }
-        if (0 != fsync(new_block_fds.index_fd)) {
+        status = SyncNewFDs(kIOFdatasync);
+    }
+    log_->Write(LL_NOTICE, "copied objects up to sequence_number %ld online with %s, %ld "
+                "bytes of synced objects are copied by %s", last_entry_.sequence_number,
+                status.ToString().c_str(), copied_bytes_,
+                block_->options_.verify_compaction || copy_range_failed_ ? "buffers" :
+                "copy_file_range");
+    return status;
+}
+
+Status BlockCompact::Finish() {
+    // writes of the block are stopped, all of them are published
+    Status status = CopyRemainingObjects(block_->max_sequence_number());
+
+    // the new block is sealed by its manifest, see Manifest
+    int64_t table_offset = -1;
+    int64_t table_index_offset = -1;
+    if (status.code() == kOk && block_->sealed()) {
+        table_offset = data_offset_;
+        status = WriteSealedTable(new_block_fds_);
+    }
+    if (table_offset >= 0 && status.code() == kOk) {
+        struct stat index_buf;
+        errno = 0;
+        if (0 != fstat(new_block_fds_.index_fd, &index_buf)) {
             status.set_code(kIOError);
-            status.set_msg("failed to fsync index file %s, %m", block_->GetFilePath(subdir, kIndexFile).c_str());
+            status.set_msg("failed to get index file info of %s, %m", subdir_.c_str());
+        } else {
+            table_index_offset = index_buf.st_size;
         }
     }
 
+    // sync data & index
+    if (status.code() == kOk) {
+        status = SyncNewFDs(kIOFsync);
+    }
+
     // create manifest
     if (status.code() == kOk) {
         Manifest manifest;
         manifest.max_block_size = block_->max_block_size();
         manifest.synced_sequence_number = max_sequence_number_;
-        status = block_->StoreManifestEx(manifest, block_->GetFilePath(subdir, kManifestFile));
+        manifest.live_bytes = data_offset_ - dead_bytes_;
+        manifest.dead_bytes = dead_bytes_;
+        manifest.table_offset = table_offset;
+        manifest.table_index_offset = table_index_offset;
+        status = block_->StoreManifestEx(manifest, block_->GetFilePath(subdir_, kManifestFile));
     }
 
     // set new current dir
     if (status.code() == kOk) {
-        status = block_->StoreCurrentSubdir(subdir);
+        status = block_->StoreCurrentSubdir(subdir_);
     }
 
     return status;
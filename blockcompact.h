@@ -11,6 +11,8 @@
 #define _EAGLEFS_BLOCKCOMPACT_H_
 
 #include <unistd.h>
+#include <set>
+#include <vector>
 #include "eagleengine/common.h"
 #include "eagleengine/status.h"
 #include "eagleengine/eagleblock.h"
@@ -35,26 +37,106 @@ struct BlockFDs {
     }
 };
 
+// live objects are copied by chunks of at most kCompactIOSize bytes; a chunk is read by one
+// pread and written by one pwritev, dead objects of less than kCompactMaxGap bytes between
+// live ones are read and skipped rather than splitting the chunk
+static const int64_t kCompactIOSize = 4 * 1024 * 1024;
+static const int64_t kCompactMaxGap = 64 * 1024;
+// old index file is read, and live objects are copied, by batches of kCompactPlanEntries
+// entries
+static const int64_t kCompactPlanEntries = 16384;
+// writes published during Copy() are caught up by passes, until less than
+// kCompactCatchUpEntries are left or kCompactCatchUpPasses passes are done
+static const int64_t kCompactCatchUpEntries = 4096;
+static const int kCompactCatchUpPasses = 8;
+
+// Note:
+// 1. live objects up to end_sequence_number are copied in order of their offsets, runs of
+//    adjacent ones are moved together and only their offsets in indexes are rewritten; with
+//    BlockOptions::verify_compaction, chunks are read into two buffers in turn, checked, and
+//    written asynchronously while the next chunk is read; without it, runs are moved by
+//    copy_file_range in kernel, which reflinks them where the filesystem supports it;
+// 2. compaction is online; Copy() copies live objects up to end_sequence_number, then catches
+//    up with writes published since, while new writes keep landing in old files;
+// 3. the block then stops writes, waits for pending ones, and calls Finish(), which copies the
+//    few writes left, syncs new files and switches current subdir to them; thus writes are
+//    only rejected during Finish() and the open of new block;
+// 4. every read & write is throttled by BlockOptions::rate_limiter, if any, so that
+//    compaction yields disk bandwidth to foreground requests
+//
 class BlockCompact {
 public:
     BlockCompact(EagleBlock* block, Log* log);
     virtual ~BlockCompact();
-    Status Run(int64_t end_sequence_number);
+    Status Copy(int64_t end_sequence_number);
+    Status Finish();
 
 private:
     // following funcs are related with compacting
     Status CreateNewFDs(const std::string& subdir, BlockFDs* fds);
     Status OpenOldFDs(BlockFDs* fds);
     Status CopyObject(const BlockFDs& new_block_fds, int old_data_fd, const IndexEntry& entry);
-    Status CopySyncedObjects(int64_t end_sequence_number, const BlockFDs& new_block_fds,
-                             const BlockFDs& old_block_fds, IndexEntry* last_entry);
-    Status CopyRemainingObjects(int64_t end_sequence_number, const BlockFDs& new_block_fds,
-                                const BlockFDs& old_block_fds, IndexEntry* last_entry);
+    // read entries->size() entries of old index file at offset, entries is resized to the
+    // number of entries read
+    Status ReadIndexEntries(int64_t offset, std::vector<IndexEntry>* entries);
+    // old index file is read twice by batches, for ids of deleted objects and then for live
+    // ones; the plan takes kCompactPlanEntries entries per batch and 8 bytes per deleted
+    // object
+    Status CopySyncedObjects(int64_t end_sequence_number);
+    // copy a batch of live objects, they are sorted by offset
+    Status CopyLiveObjects(std::vector<IndexEntry>* live);
+    // copy objects of entries[begin, end) to the end of new data file
+    Status CopyChunkByRange(const std::vector<IndexEntry>& entries, size_t begin, size_t end);
+    Status CopyChunkByBuffer(const std::vector<IndexEntry>& entries, size_t begin, size_t end);
+    // wait until write of a buffer is completed
+    Status WaitForWrite(int buffer);
+    // wait for BlockOptions::rate_limiter before an io of bytes
+    void Throttle(int64_t bytes);
+    // entry of a copied object in new index file, found is false if the object is not copied
+    // or deleted; it is a binary search of new index file, see new_index_entries_
+    Status FindCopied(int64_t object_id, IndexEntry* entry, bool* found);
+    // add entries[begin, end) copied to data_offset_ to indexes, and to new index file
+    Status AppendEntries(const std::vector<IndexEntry>& entries, size_t begin, size_t end);
+    // copy objects & deletes of index entries up to target_sequence_number, which should be
+    // published
+    Status CopyRemainingObjects(int64_t target_sequence_number);
+    // new block of a sealed one is sealed as well; the table is written by batches of live
+    // entries read from new index file
+    Status WriteSealedTable(const BlockFDs& new_block_fds);
+    // opcode is kIOFdatasync or kIOFsync
+    Status SyncNewFDs(IOOpcode opcode);
 private:
-    std::map<int64_t, IndexEntry> indexes_;
+    // entries written to new index file; they are in order of sequence numbers, and the entry
+    // of an object is the one whose sequence number is its id, thus copied objects are looked
+    // up in the file rather than kept in memory
+    int64_t new_index_entries_;
+    // objects copied and then deleted by remaining entries, 8 bytes per id plus the node
+    std::set<int64_t> deleted_ids_;
+    // it is split into two buffers of kCompactIOSize bytes for chunks
     char* internal_buf_;
+    // write of each buffer in flight, NULL if none
+    IOFuture* pending_writes_[2];
+    int64_t pending_sizes_[2];
+    std::vector<struct iovec> iovs_[2];
+    int64_t num_chunks_;
+    // copy_file_range is not supported by kernel or filesystem
+    bool copy_range_failed_;
+    // bytes of objects copied by chunks
+    int64_t copied_bytes_;
+    // bytes of objects copied and then deleted, with their headers
+    int64_t dead_bytes_;
     int64_t data_offset_;
     int64_t max_sequence_number_;
+    int64_t num_objects_;
+
+    std::string subdir_;
+    BlockFDs new_block_fds_;
+    BlockFDs old_block_fds_;
+    // the last entry read from old index file, and offset of the entry after it
+    IndexEntry last_entry_;
+    int64_t old_index_offset_;
+    // last_entry_ is read but not copied yet
+    bool has_pending_entry_;
 
     EagleBlock* block_;
     Log* log_;
@@ -36,7 +36,8 @@ enum ResultCode {
 enum BlockStatus {
     kNormal = 0,
     kCompacting = 1,
-    kFull = 2
+    kFull = 2,
+    kReadOnly = 3
 };
 
 const std::string kDefaultSubdir = "0";
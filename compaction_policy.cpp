@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file compaction_policy.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/10/21 15:37:02
+ * @brief
+ *
+*/
+#include "eagleengine/compaction_policy.h"
+#include <errno.h>
+#include <sys/statvfs.h>
+#include <algorithm>
+#include "eagleengine/eagleblock.h"
+
+namespace eagleengine {
+
+CompactionPolicy::CompactionPolicy(const CompactionPolicyOptions& options)
+        : options_(options) {
+}
+
+bool CompactionPolicy::RatioGreater(const Candidate& left, const Candidate& right) {
+    double left_ratio = (double)left.dead_bytes / (left.live_bytes + left.dead_bytes);
+    double right_ratio = (double)right.dead_bytes / (right.live_bytes + right.dead_bytes);
+    return left_ratio > right_ratio;
+}
+
+bool CompactionPolicy::DeadBytesGreater(const Candidate& left, const Candidate& right) {
+    return left.dead_bytes > right.dead_bytes;
+}
+
+Status CompactionPolicy::FindDisk(EagleBlock* block, std::vector<Disk>* disks, Disk** disk) {
+    Status status;
+    struct statvfs buf;
+    errno = 0;
+    if (0 != statvfs(block->root_dir().c_str(), &buf)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to get filesystem info of %s, %m", block->root_dir().c_str());
+        return status;
+    }
+    for (size_t i = 0; i < disks->size(); ++i) {
+        if ((*disks)[i].fsid == buf.f_fsid) {
+            *disk = &(*disks)[i];
+            return status;
+        }
+    }
+    Disk new_disk;
+    new_disk.fsid = buf.f_fsid;
+    new_disk.free_bytes = (int64_t)buf.f_bavail * buf.f_frsize;
+    new_disk.total_bytes = (int64_t)buf.f_blocks * buf.f_frsize;
+    disks->push_back(new_disk);
+    *disk = &disks->back();
+    return status;
+}
+
+Status CompactionPolicy::PickBlocks(const std::vector<EagleBlock*>& blocks,
+                                    std::vector<EagleBlock*>* picked) {
+    Status status;
+    picked->clear();
+    std::vector<Disk> disks;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        EagleBlock* block = blocks[i];
+        // blocks being compacted or read only are left alone
+        BlockStatus block_status = block->GetStatus();
+        if (block_status != kNormal && block_status != kFull) {
+            continue;
+        }
+        // its status is unchanged while live objects are copied
+        if (block->compacting()) {
+            continue;
+        }
+        Candidate candidate;
+        candidate.block = block;
+        candidate.live_bytes = block->live_bytes();
+        candidate.dead_bytes = block->dead_bytes();
+        if (candidate.dead_bytes <= 0 || candidate.dead_bytes < options_.min_dead_bytes) {
+            continue;
+        }
+
+        Disk* disk = NULL;
+        Status disk_status = FindDisk(block, &disks, &disk);
+        if (disk_status.code() != kOk) {
+            if (status.code() == kOk) {
+                status = disk_status;
+            }
+            continue;
+        }
+        disk->candidates.push_back(candidate);
+    }
+
+    for (size_t i = 0; i < disks.size(); ++i) {
+        PickOnDisk(&disks[i], picked);
+    }
+    return status;
+}
+
+void CompactionPolicy::PickOnDisk(Disk* disk, std::vector<EagleBlock*>* picked) {
+    bool low_free = disk->free_bytes * 100 < disk->total_bytes * options_.low_free_percent;
+    int garbage_percent = low_free ? options_.urgent_garbage_percent :
+            options_.garbage_percent;
+    std::vector<Candidate> candidates;
+    for (size_t i = 0; i < disk->candidates.size(); ++i) {
+        const Candidate& candidate = disk->candidates[i];
+        if (candidate.dead_bytes * 100 >= (candidate.live_bytes + candidate.dead_bytes) *
+                garbage_percent) {
+            candidates.push_back(candidate);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     low_free ? DeadBytesGreater : RatioGreater);
+
+    int64_t free_bytes = disk->free_bytes;
+    int64_t budget_used = 0;
+    int num_picked = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (options_.max_blocks_per_disk > 0 && num_picked >= options_.max_blocks_per_disk) {
+            break;
+        }
+        const Candidate& candidate = candidates[i];
+        // new files of all picked blocks may coexist with old ones
+        if (candidate.live_bytes > free_bytes) {
+            continue;
+        }
+        if (options_.io_budget_bytes > 0 && num_picked > 0 &&
+                budget_used + candidate.live_bytes > options_.io_budget_bytes) {
+            continue;
+        }
+        picked->push_back(candidate.block);
+        free_bytes -= candidate.live_bytes;
+        budget_used += candidate.live_bytes;
+        num_picked++;
+    }
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file compaction_policy.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/10/21 15:37:02
+ * @brief pick blocks of a node to compact by garbage ratio, free space and io budget
+ *
+*/
+#ifndef _EAGLEFS_COMPACTION_POLICY_H_
+#define _EAGLEFS_COMPACTION_POLICY_H_
+
+#include <stdint.h>
+#include <vector>
+#include "eagleengine/common.h"
+#include "eagleengine/status.h"
+
+namespace eagleengine {
+
+class EagleBlock;
+
+struct CompactionPolicyOptions {
+    // a block is compacted once dead bytes are at least garbage_percent of its data, and
+    // there are at least min_dead_bytes of them
+    int garbage_percent;
+    int64_t min_dead_bytes;
+    // once free space of a disk is below low_free_percent, its blocks are compacted with
+    // urgent_garbage_percent of dead bytes, the ones with most dead bytes first
+    int low_free_percent;
+    int urgent_garbage_percent;
+    // live bytes of blocks picked on a disk in one round, which are read & written by their
+    // compactions; a block larger than it is picked only if it is the first; 0 means no limit
+    int64_t io_budget_bytes;
+    // blocks picked on a disk in one round; 0 means no limit
+    int max_blocks_per_disk;
+
+    CompactionPolicyOptions() : garbage_percent(30), min_dead_bytes(64 * 1024 * 1024),
+                                low_free_percent(10), urgent_garbage_percent(10),
+                                io_budget_bytes(4L * 1024 * 1024 * 1024),
+                                max_blocks_per_disk(1) {
+    }
+};
+
+// Note:
+// 1. the policy keeps no state, PickBlocks() is given all blocks of a node every round, eg.
+//    by a timer; the caller compacts the picked blocks by Compact() and replaces them with
+//    new ones, blocks on different disks can be compacted in parallel;
+// 2. garbage is measured by EagleBlock::live_bytes() & dead_bytes(), which are kept up to
+//    date by writes and persisted in manifest; blocks on a disk are grouped by the
+//    filesystem of their root dirs, and a block is picked only if its live bytes fit in the
+//    free space left, since new files are written before old ones are removed;
+// 3. blocks of a disk are ordered by garbage ratio, so that most space is reclaimed by the
+//    least copying; on a disk short of space, they are ordered by dead bytes instead
+//
+class CompactionPolicy {
+public:
+    explicit CompactionPolicy(const CompactionPolicyOptions& options);
+
+    // picked are grouped by disk, in order of their priorities on each disk; a block whose
+    // disk cannot be checked is skipped, and the error is returned after others are picked
+    Status PickBlocks(const std::vector<EagleBlock*>& blocks,
+                      std::vector<EagleBlock*>* picked);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(CompactionPolicy);
+
+    struct Candidate {
+        EagleBlock* block;
+        int64_t live_bytes;
+        int64_t dead_bytes;
+    };
+    struct Disk {
+        uint64_t fsid;
+        int64_t free_bytes;
+        int64_t total_bytes;
+        std::vector<Candidate> candidates;
+    };
+
+    static bool RatioGreater(const Candidate& left, const Candidate& right);
+    static bool DeadBytesGreater(const Candidate& left, const Candidate& right);
+    // find disk of block in disks, or add it
+    Status FindDisk(EagleBlock* block, std::vector<Disk>* disks, Disk** disk);
+    void PickOnDisk(Disk* disk, std::vector<EagleBlock*>* picked);
+
+    CompactionPolicyOptions options_;
+};
+
+}
+
+#endif  //_EAGLEFS_COMPACTION_POLICY_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
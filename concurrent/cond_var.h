@@ -0,0 +1,63 @@
+/**
+ * Copyright 2017 LIHAIBING. All rights reserved.
+ *
+ * @file cond_var.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/07/29 11:57:55
+ * @brief
+ *
+ **/
+
+#ifndef _EAGLEFS_CONCURRENT_COND_VAR_H_
+#define _EAGLEFS_CONCURRENT_COND_VAR_H_
+
+#include <pthread.h>
+#include <sys/time.h>
+#include "eagleengine/concurrent/mutex_lock.h"
+
+namespace eagleengine {
+
+class CondVar {
+public:
+    explicit CondVar(MutexLock* mu) : mu_(mu) {
+        pthread_cond_init(&cond_, NULL);
+    }
+
+    ~CondVar() {
+        pthread_cond_destroy(&cond_);
+    }
+
+    // caller should hold mu_
+    void Wait() {
+        pthread_cond_wait(&cond_, &mu_->lock_);
+    }
+
+    // caller should hold mu_; return false if timeout
+    bool TimedWait(int64_t timeout_ms) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        int64_t deadline_us = now.tv_sec * 1000000L + now.tv_usec + timeout_ms * 1000;
+        struct timespec deadline;
+        deadline.tv_sec = deadline_us / 1000000;
+        deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+        return pthread_cond_timedwait(&cond_, &mu_->lock_, &deadline) == 0;
+    }
+
+    void Signal() {
+        pthread_cond_signal(&cond_);
+    }
+
+    void SignalAll() {
+        pthread_cond_broadcast(&cond_);
+    }
+
+private:
+    pthread_cond_t cond_;
+    MutexLock* mu_;
+};
+
+}
+
+#endif
+
+/* vim: set ts=4 sw=4 sts=4 tw=100 */
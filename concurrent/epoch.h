@@ -0,0 +1,112 @@
+/**
+ * Copyright 2017 LIHAIBING. All rights reserved.
+ *
+ * @file epoch.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/19 10:36:20
+ * @brief epoch based reclamation for lock free readers
+ *
+ **/
+
+#ifndef _EAGLEFS_CONCURRENT_EPOCH_H_
+#define _EAGLEFS_CONCURRENT_EPOCH_H_
+
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace eagleengine {
+
+// Note:
+// 1. readers enter a read section with Enter() and leave it with Exit(), they never block;
+//    each reader counts itself in one of kEpochStripes cache lines picked by its thread, so
+//    readers on different threads seldom share a cache line;
+// 2. a writer unlinks memory, then Synchronize() waits until every read section entered
+//    before returns, after which the memory can be freed or reused; Synchronize() should be
+//    called by one thread at a time;
+// 3. counters of the current epoch are incremented by new readers, Synchronize() moves to
+//    the next epoch and waits for counters of the previous one to drop to zero; a reader
+//    which sees the epoch changed after counting itself retries with the new epoch
+//
+class Epoch {
+public:
+    Epoch() : epoch_(1) {
+        memset(counters_, 0, sizeof(counters_));
+    }
+
+    // return the counter to pass to Exit()
+    int Enter() {
+        int stripe = ThreadStripe();
+        while (true) {
+            uint64_t epoch = __atomic_load_n(&epoch_, __ATOMIC_SEQ_CST);
+            int index = (int)(epoch & 1) * kEpochStripes + stripe;
+            __atomic_add_fetch(&counters_[index].count, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&epoch_, __ATOMIC_SEQ_CST) == epoch) {
+                return index;
+            }
+            __atomic_sub_fetch(&counters_[index].count, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    void Exit(int index) {
+        __atomic_sub_fetch(&counters_[index].count, 1, __ATOMIC_RELEASE);
+    }
+
+    void Synchronize() {
+        uint64_t epoch = __atomic_load_n(&epoch_, __ATOMIC_RELAXED);
+        __atomic_store_n(&epoch_, epoch + 1, __ATOMIC_SEQ_CST);
+        int base = (int)(epoch & 1) * kEpochStripes;
+        for (int i = 0; i < kEpochStripes; ++i) {
+            while (__atomic_load_n(&counters_[base + i].count, __ATOMIC_ACQUIRE) != 0) {
+                sched_yield();
+            }
+        }
+    }
+
+private:
+    static const int kEpochStripes = 32;
+
+    // one counter per cache line
+    struct Counter {
+        int64_t count;
+        char padding[56];
+    };
+
+    // threads take stripes in turn
+    static int ThreadStripe() {
+        static int next_stripe = 0;
+        static __thread int stripe = -1;
+        if (stripe < 0) {
+            stripe = __sync_fetch_and_add(&next_stripe, 1) % kEpochStripes;
+        }
+        return stripe;
+    }
+
+    Epoch(const Epoch&);
+    Epoch& operator=(const Epoch&);
+
+    uint64_t epoch_;
+    // counters of even epochs, then those of odd epochs
+    Counter counters_[2 * kEpochStripes];
+};
+
+class ScopedEpoch {
+public:
+    explicit ScopedEpoch(Epoch& epoch) : epoch_(&epoch) {
+        index_ = epoch_->Enter();
+    }
+
+    ~ScopedEpoch() {
+        epoch_->Exit(index_);
+    }
+
+private:
+    Epoch* epoch_;
+    int index_;
+};
+
+}
+
+#endif
+
+/* vim: set ts=4 sw=4 sts=4 tw=100 */
@@ -34,6 +34,7 @@ public:
     }
 
 private:
+    friend class CondVar;
     pthread_mutex_t lock_;
 };
 
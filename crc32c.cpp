@@ -11,6 +11,10 @@
 #include <stdint.h>
 #include <string.h>
 #include "zlib.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
 
 #define IS_LITTLE_ENDIAN (__BYTE_ORDER == __LITTLE_ENDIAN)
 
@@ -301,7 +305,7 @@ static inline uint32_t LE_LOAD32(const uint8_t *p) {
   return DecodeFixed32(reinterpret_cast<const char*>(p));
 }
 
-uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+uint32_t ExtendPortable(uint32_t crc, const char* buf, size_t size) {
   const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
   const uint8_t *e = p + size;
   uint32_t l = crc ^ 0xffffffffu;
@@ -346,6 +350,188 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
   return l ^ 0xffffffffu;
 }
 
+#if defined(__x86_64__)
+
+// Process the bytes before the first 8-byte aligned one and after the last, with the crc32
+// instruction; return the crc of them and the middle aligned words.
+__attribute__((target("sse4.2")))
+uint32_t ExtendSse42(uint32_t crc, const char* buf, size_t size) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
+  const uint8_t *e = p + size;
+  uint64_t l = crc ^ 0xffffffffu;
+  while (p != e && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    l = _mm_crc32_u8(l, *p++);
+  }
+  while (e - p >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    l = _mm_crc32_u64(l, word);
+    p += 8;
+  }
+  while (p != e) {
+    l = _mm_crc32_u8(l, *p++);
+  }
+  return l ^ 0xffffffffu;
+}
+
+// The crc32 instruction has a latency of 3 cycles but a throughput of 1 per cycle, so a
+// buffer is split into three streams which are computed at the same time. The crc of the
+// first stream is then shifted past the other two and combined by a carry-less multiply:
+// for a 32-bit state a (bit reversed), clmul(a, k) followed by crc32(0, .) is
+// a * k * x^33 mod P, thus k = x^(8 * n - 33) mod P shifts the state by n zero bytes.
+static const size_t kLongStream = 8192;
+static const size_t kShortStream = 256;
+
+static uint32_t ShiftConstant(size_t bytes) {
+  // x^0 is the highest bit of a bit reversed state
+  uint32_t k = 0x80000000u;
+  for (size_t i = 0; i < bytes * 8 - 33; ++i) {
+    k = (k >> 1) ^ ((k & 1) ? 0x82f63b78u : 0);
+  }
+  return k;
+}
+
+struct ShiftConstants {
+  // shift by one and two streams
+  uint64_t long1, long2;
+  uint64_t short1, short2;
+
+  ShiftConstants() {
+    long1 = ShiftConstant(kLongStream);
+    long2 = ShiftConstant(2 * kLongStream);
+    short1 = ShiftConstant(kShortStream);
+    short2 = ShiftConstant(2 * kShortStream);
+  }
+};
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t Combine(uint64_t a, uint64_t k2, uint64_t b, uint64_t k1, uint64_t c) {
+  __m128i shifted = _mm_xor_si128(
+      _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(k2), 0x00),
+      _mm_clmulepi64_si128(_mm_cvtsi64_si128(b), _mm_cvtsi64_si128(k1), 0x00));
+  return _mm_crc32_u64(0, _mm_cvtsi128_si64(shifted)) ^ c;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+uint32_t ExtendSse42Pclmul(uint32_t crc, const char* buf, size_t size) {
+  if (size < 3 * kShortStream + 8) {
+    // too short to be split
+    return ExtendSse42(crc, buf, size);
+  }
+  static const ShiftConstants constants;
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
+  const uint8_t *e = p + size;
+  uint64_t l = crc ^ 0xffffffffu;
+  while (p != e && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    l = _mm_crc32_u8(l, *p++);
+  }
+
+#define STEP3(n) do {                                   \
+    uint64_t w0, w1, w2;                                \
+    memcpy(&w0, p, 8);                                  \
+    memcpy(&w1, p + n, 8);                              \
+    memcpy(&w2, p + 2 * n, 8);                          \
+    l = _mm_crc32_u64(l, w0);                           \
+    l1 = _mm_crc32_u64(l1, w1);                         \
+    l2 = _mm_crc32_u64(l2, w2);                         \
+    p += 8;                                             \
+} while (0)
+
+  while (static_cast<size_t>(e - p) >= 3 * kLongStream) {
+    uint64_t l1 = 0;
+    uint64_t l2 = 0;
+    const uint8_t* end = p + kLongStream;
+    while (p != end) {
+      STEP3(kLongStream);
+    }
+    l = Combine(l, constants.long2, l1, constants.long1, l2);
+    p += 2 * kLongStream;
+  }
+  while (static_cast<size_t>(e - p) >= 3 * kShortStream) {
+    uint64_t l1 = 0;
+    uint64_t l2 = 0;
+    const uint8_t* end = p + kShortStream;
+    while (p != end) {
+      STEP3(kShortStream);
+    }
+    l = Combine(l, constants.short2, l1, constants.short1, l2);
+    p += 2 * kShortStream;
+  }
+#undef STEP3
+
+  while (e - p >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    l = _mm_crc32_u64(l, word);
+    p += 8;
+  }
+  while (p != e) {
+    l = _mm_crc32_u8(l, *p++);
+  }
+  return l ^ 0xffffffffu;
+}
+
+bool Sse42Supported() {
+  return __builtin_cpu_supports("sse4.2");
+}
+
+bool PclmulSupported() {
+  return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+
+#else
+
+uint32_t ExtendSse42(uint32_t crc, const char* buf, size_t size) {
+  return ExtendPortable(crc, buf, size);
+}
+
+uint32_t ExtendSse42Pclmul(uint32_t crc, const char* buf, size_t size) {
+  return ExtendPortable(crc, buf, size);
+}
+
+bool Sse42Supported() {
+  return false;
+}
+
+bool PclmulSupported() {
+  return false;
+}
+
+#endif
+
+typedef uint32_t (*ExtendFunc)(uint32_t crc, const char* buf, size_t size);
+
+static ExtendFunc ChooseExtend() {
+  if (PclmulSupported()) {
+    return ExtendSse42Pclmul;
+  }
+  if (Sse42Supported()) {
+    return ExtendSse42;
+  }
+  return ExtendPortable;
+}
+
+// chosen once by cpuid, at the first call rather than by a static initializer, since other
+// static initializers may compute crc
+static ExtendFunc extend_func = NULL;
+
+uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+  ExtendFunc func = __atomic_load_n(&extend_func, __ATOMIC_RELAXED);
+  if (func == NULL) {
+    func = ChooseExtend();
+    __atomic_store_n(&extend_func, func, __ATOMIC_RELAXED);
+  }
+  return func(crc, buf, size);
+}
+
+const char* Crc32cImplementation() {
+  ExtendFunc func = ChooseExtend();
+  if (func == ExtendSse42Pclmul) {
+    return "sse4.2+pclmul";
+  }
+  return func == ExtendSse42 ? "sse4.2" : "portable";
+}
+
 uint32_t Adler32_Value(const char* data, size_t n) {
     unsigned long  adler = adler32(0L, Z_NULL, 0);
     unsigned long adler1 = adler32(adler, (const Bytef*)data, n);
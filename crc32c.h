@@ -23,6 +23,30 @@ inline uint32_t Value(const char* data, size_t n) {
 
 extern uint32_t Adler32_Value(const char* data, size_t n);
 
+// Implementations of Extend(), which chooses the fastest one supported by the cpu at
+// runtime; they are exposed for tests and benchmarks. ExtendSse42Pclmul computes three
+// streams at the same time with the crc32 instruction and combines them with carry-less
+// multiplication; it should only be called if PclmulSupported(), and ExtendSse42 only if
+// Sse42Supported().
+extern uint32_t ExtendPortable(uint32_t init_crc, const char* data, size_t n);
+extern uint32_t ExtendSse42(uint32_t init_crc, const char* data, size_t n);
+extern uint32_t ExtendSse42Pclmul(uint32_t init_crc, const char* data, size_t n);
+extern bool Sse42Supported();
+extern bool PclmulSupported();
+// name of the implementation chosen by Extend()
+extern const char* Crc32cImplementation();
+
+// Checksum of object contents, recorded in ObjectHeader; blocks written before crc32c was
+// used have a zero type, ie. adler32
+enum ChecksumType {
+  kChecksumAdler32 = 0,
+  kChecksumCrc32c = 1,
+};
+
+inline uint32_t ObjectChecksum(uint8_t type, const char* data, size_t n) {
+  return type == kChecksumCrc32c ? Value(data, n) : Adler32_Value(data, n);
+}
+
 static const uint32_t kMaskDelta = 0xa282ead8ul;
 
 // Return a masked representation of crc.
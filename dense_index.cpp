@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file dense_index.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/26 09:12:44
+ * @brief
+ *
+*/
+#include "eagleengine/dense_index.h"
+#include <string.h>
+#include <algorithm>
+
+namespace eagleengine {
+
+static bool ObjectIdLess(const IndexEntry& left, const IndexEntry& right) {
+    return left.object_id < right.object_id;
+}
+
+DenseIndex::DenseIndex() : base_id_(0), num_chunks_(0), size_(0) {
+}
+
+DenseIndex::~DenseIndex() {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        delete chunks_[i];
+    }
+}
+
+bool DenseIndex::Insert(const IndexEntry& new_entry, IndexEntry* old_entry) {
+    ScopedWriteLocker lock(lock_);
+    return InsertInternal(new_entry, old_entry);
+}
+
+int DenseIndex::InsertBatch(const std::vector<IndexEntry>& new_entries, IndexEntry* old_entry) {
+    ScopedWriteLocker lock(lock_);
+    int num = (int)new_entries.size();
+    for (int i = 0; i < num; ++i) {
+        if (!InsertInternal(new_entries[i], old_entry)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int DenseIndex::BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry) {
+    // the array is extended only once if entries are inserted in order
+    if (!std::is_sorted(entries->begin(), entries->end(), ObjectIdLess)) {
+        std::sort(entries->begin(), entries->end(), ObjectIdLess);
+    }
+    return InsertBatch(*entries, old_entry);
+}
+
+bool DenseIndex::Get(int64_t object_id, IndexEntry* entry) {
+    ScopedReadLocker lock(lock_);
+    return Find(object_id, entry);
+}
+
+int DenseIndex::GetBatch(const std::vector<int64_t>& object_ids,
+                         std::vector<IndexEntry>* entries, std::vector<bool>* found) {
+    ScopedReadLocker lock(lock_);
+    int num = (int)object_ids.size();
+    int found_num = 0;
+    entries->resize(num);
+    found->assign(num, false);
+    for (int i = 0; i < num; ++i) {
+        if (Find(object_ids[i], &(*entries)[i])) {
+            (*found)[i] = true;
+            found_num++;
+        }
+    }
+    return found_num;
+}
+
+void DenseIndex::Delete(int64_t object_id) {
+    ScopedWriteLocker lock(lock_);
+    Chunk* chunk = GetChunk(object_id, false);
+    if (chunk != NULL) {
+        int64_t chunk_index = (object_id - base_id_) / kDenseChunkSize;
+        uint64_t bit = 1ul << ((object_id - base_id_) % kDenseChunkSize);
+        if ((chunk->live & bit) != 0) {
+            chunk->live &= ~bit;
+            if (chunk->live == 0) {
+                delete chunk;
+                chunks_[chunk_index] = NULL;
+                num_chunks_--;
+            }
+            size_--;
+            return;
+        }
+    }
+    if (overflow_.erase(object_id) > 0) {
+        size_--;
+    }
+}
+
+void DenseIndex::Dump(std::vector<IndexEntry>* entries) {
+    ScopedReadLocker lock(lock_);
+    entries->clear();
+    entries->reserve(size_);
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        Chunk* chunk = chunks_[i];
+        if (chunk == NULL) {
+            continue;
+        }
+        for (int bit = 0; bit < kDenseChunkSize; ++bit) {
+            if ((chunk->live & (1ul << bit)) != 0) {
+                IndexEntry entry;
+                entry.object_id = base_id_ + i * kDenseChunkSize + bit;
+                entry.sequence_number = entry.object_id;
+                entry.offset = chunk->base_offset + chunk->offsets[bit];
+                entry.size = chunk->sizes[bit];
+                entries->push_back(entry);
+            }
+        }
+    }
+    std::map<int64_t, IndexEntry>::const_iterator it = overflow_.begin();
+    for (; it != overflow_.end(); ++it) {
+        entries->push_back(it->second);
+    }
+}
+
+int64_t DenseIndex::size() {
+    ScopedReadLocker lock(lock_);
+    return size_;
+}
+
+int64_t DenseIndex::memory_usage() {
+    ScopedReadLocker lock(lock_);
+    // a map node holds an entry besides 3 pointers & color
+    return chunks_.capacity() * sizeof(Chunk*) + num_chunks_ * sizeof(Chunk) +
+            overflow_.size() * (sizeof(std::pair<int64_t, IndexEntry>) + 32);
+}
+
+bool DenseIndex::Find(int64_t object_id, IndexEntry* entry) {
+    Chunk* chunk = GetChunk(object_id, false);
+    if (chunk != NULL) {
+        int bit = (object_id - base_id_) % kDenseChunkSize;
+        if ((chunk->live & (1ul << bit)) != 0) {
+            entry->sequence_number = object_id;
+            entry->object_id = object_id;
+            entry->offset = chunk->base_offset + chunk->offsets[bit];
+            entry->size = chunk->sizes[bit];
+            return true;
+        }
+    }
+    if (overflow_.empty()) {
+        return false;
+    }
+    std::map<int64_t, IndexEntry>::const_iterator it = overflow_.find(object_id);
+    if (it == overflow_.end()) {
+        return false;
+    }
+    *entry = it->second;
+    return true;
+}
+
+bool DenseIndex::InsertInternal(const IndexEntry& new_entry, IndexEntry* old_entry) {
+    if (Find(new_entry.object_id, old_entry)) {
+        return false;
+    }
+    if (!Encode(new_entry)) {
+        overflow_[new_entry.object_id] = new_entry;
+    }
+    size_++;
+    return true;
+}
+
+bool DenseIndex::Encode(const IndexEntry& entry) {
+    if (entry.sequence_number != entry.object_id || entry.offset < 0) {
+        return false;
+    }
+    Chunk* chunk = GetChunk(entry.object_id, true);
+    if (chunk == NULL) {
+        return false;
+    }
+
+    int bit = (entry.object_id - base_id_) % kDenseChunkSize;
+    if (chunk->live == 0) {
+        chunk->base_offset = entry.offset;
+    } else if (entry.offset < chunk->base_offset) {
+        // objects maybe inserted out of order by concurrent writers, lower the base offset
+        // if deltas of existing objects still fit
+        int64_t diff = chunk->base_offset - entry.offset;
+        for (int i = 0; i < kDenseChunkSize; ++i) {
+            if ((chunk->live & (1ul << i)) != 0 && chunk->offsets[i] + diff > UINT32_MAX) {
+                return false;
+            }
+        }
+        for (int i = 0; i < kDenseChunkSize; ++i) {
+            if ((chunk->live & (1ul << i)) != 0) {
+                chunk->offsets[i] += diff;
+            }
+        }
+        chunk->base_offset = entry.offset;
+    } else if (entry.offset - chunk->base_offset > UINT32_MAX) {
+        return false;
+    }
+
+    chunk->offsets[bit] = (uint32_t)(entry.offset - chunk->base_offset);
+    chunk->sizes[bit] = entry.size;
+    chunk->live |= 1ul << bit;
+    return true;
+}
+
+DenseIndex::Chunk* DenseIndex::GetChunk(int64_t object_id, bool create) {
+    if (object_id < 0) {
+        return NULL;
+    }
+    if (chunks_.empty()) {
+        if (!create) {
+            return NULL;
+        }
+        base_id_ = object_id - object_id % kDenseChunkSize;
+    }
+    if (object_id < base_id_) {
+        if (!create) {
+            return NULL;
+        }
+        int64_t prepend = (base_id_ - object_id + kDenseChunkSize - 1) / kDenseChunkSize;
+        if (prepend > kDenseMaxGapChunks) {
+            return NULL;
+        }
+        chunks_.insert(chunks_.begin(), prepend, NULL);
+        base_id_ -= prepend * kDenseChunkSize;
+    }
+
+    int64_t chunk_index = (object_id - base_id_) / kDenseChunkSize;
+    if (chunk_index >= (int64_t)chunks_.size()) {
+        if (!create || chunk_index - (int64_t)chunks_.size() >= kDenseMaxGapChunks) {
+            return NULL;
+        }
+        chunks_.resize(chunk_index + 1, NULL);
+    }
+
+    Chunk* chunk = chunks_[chunk_index];
+    if (chunk == NULL && create) {
+        chunk = new Chunk();
+        memset(chunk, 0, sizeof(*chunk));
+        chunks_[chunk_index] = chunk;
+        num_chunks_++;
+    }
+    return chunk;
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
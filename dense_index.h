@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file dense_index.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/26 09:12:44
+ * @brief block index as an array indexed by object id
+ *
+*/
+#ifndef _EAGLEFS_DENSE_INDEX_H_
+#define _EAGLEFS_DENSE_INDEX_H_
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "eagleengine/block_index.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// object ids of a chunk are [base_id_ + i * kDenseChunkSize, base_id_ + (i + 1) * kDenseChunkSize)
+static const int kDenseChunkSize = 64;
+// an object is kept in the overflow map rather than the array if its chunk is further than
+// kDenseMaxGapChunks chunks from existing ones
+static const int64_t kDenseMaxGapChunks = 1024 * 1024;
+
+// Note:
+// 1. object ids of a block are its sequence numbers, thus dense; objects are kept in chunks
+//    of kDenseChunkSize ids: a bitmap of live ids, and for each id its offset as a 32 bits
+//    delta from the base offset of its chunk and its size, ie. about 8 bytes per id;
+// 2. a lookup is one access to the chunk array and one to the chunk; a chunk is freed once
+//    all its objects are deleted;
+// 3. entries which cannot be encoded, eg. sequence number is not object id, or offset is too
+//    far from others of its chunk, are kept in an overflow map, so any entry is accepted
+//
+class DenseIndex : public BlockIndex {
+public:
+    DenseIndex();
+    virtual ~DenseIndex();
+
+    virtual bool Insert(const IndexEntry& new_entry, IndexEntry* old_entry);
+    virtual int InsertBatch(const std::vector<IndexEntry>& new_entries, IndexEntry* old_entry);
+    virtual int BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry);
+    virtual bool Get(int64_t object_id, IndexEntry* entry);
+    virtual int GetBatch(const std::vector<int64_t>& object_ids,
+                         std::vector<IndexEntry>* entries, std::vector<bool>* found);
+    virtual void Delete(int64_t object_id);
+    virtual void Dump(std::vector<IndexEntry>* entries);
+    virtual int64_t size();
+
+    // bytes used by chunks & overflow entries
+    int64_t memory_usage();
+
+private:
+    struct Chunk {
+        int64_t base_offset;
+        uint64_t live;
+        uint32_t offsets[kDenseChunkSize];
+        int32_t sizes[kDenseChunkSize];
+    };
+
+    DISALLOW_COPY_AND_ASSIGN(DenseIndex);
+
+    // following are called with lock_ held
+    bool Find(int64_t object_id, IndexEntry* entry);
+    bool InsertInternal(const IndexEntry& new_entry, IndexEntry* old_entry);
+    // try to put entry into the array, return false if it cannot be encoded
+    bool Encode(const IndexEntry& entry);
+    // return the chunk of object_id, which is created if create is true; NULL if object_id
+    // is not covered by the array
+    Chunk* GetChunk(int64_t object_id, bool create);
+
+    // object id of the first chunk
+    int64_t base_id_;
+    std::vector<Chunk*> chunks_;
+    int64_t num_chunks_;
+    std::map<int64_t, IndexEntry> overflow_;
+    int64_t size_;
+
+    RWLock lock_;
+};
+
+}
+
+#endif  //_EAGLEFS_DENSE_INDEX_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -13,34 +13,83 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <algorithm>
 #include <map>
 #include "eagleengine/blockcompact.h"
 #include "eagleengine/crc32c.h"
+#include "eagleengine/object_cache.h"
+#include "eagleengine/rate_limiter.h"
+#include "eagleengine/sealed_index.h"
+#include "eagleengine/sealed_table.h"
 
 namespace eagleengine {
 
-EagleBlock::EagleBlock() {
+EagleBlock::EagleBlock(const BlockOptions& options)
+        : publish_cond_(&publish_lock_), sync_wait_cond_(&sync_wait_lock_), options_(options) {
     log_ = NULL;
     indexs_ = NULL;
-    internal_buf_ = NULL;
+    sealed_ = false;
+    table_offset_ = -1;
+    table_index_offset_ = -1;
+    compacting_ = false;
+    cache_id_ = options_.object_cache != NULL ? options_.object_cache->NewId() : 0;
+    tail_buffer_ = NULL;
+    io_ = AsyncIO::Default();
+    synced_data_offset_ = 0;
+    synced_index_offset_ = 0;
+    writeback_data_offset_ = 0;
+    writeback_index_offset_ = 0;
+    last_sync_time_ = NowMicros();
+    sync_waiters_ = 0;
+    sync_failures_ = 0;
+    sync_scheduler_ = NULL;
+    durable_sequence_number_ = -1;
+    group_syncing_ = false;
+    failed_sync_sequence_number_ = -1;
+    published_index_offset_ = 0;
+    published_data_offset_ = 0;
+    checkpoint_index_offset_ = 0;
+    synced_live_bytes_ = 0;
+    synced_dead_bytes_ = 0;
 
     data_fd_ = -1;
     index_fd_ = -1;
 
     max_sequence_number_ = -1;
     synced_sequence_number_ = -1;
+    last_sequence_number_ = -1;
+    publish_sequence_number_ = -1;
+    write_failed_ = false;
     data_offset_ = 0;
     index_offset_ = 0;
 
     num_objects_ = 0;
+    live_bytes_ = 0;
+    dead_bytes_ = 0;
 
     status_ = kNormal;
 }
 
 EagleBlock::~EagleBlock() {
+    if (sync_scheduler_ != NULL) {
+        sync_scheduler_->RemoveBlock(this);
+    }
+    if (options_.object_cache != NULL) {
+        options_.object_cache->EraseBlock(cache_id_);
+    }
+    if (tail_buffer_ != NULL) {
+        // not synced, the same as other unsynced writes
+        Status status = FlushTail(true);
+        if (status.code() != kOk) {
+            log_->Write(LL_ERROR, "failed to flush tail buffer with %s",
+                        status.ToString().c_str());
+        }
+        delete tail_buffer_;
+    }
     delete log_;
     delete indexs_;
-    free(internal_buf_);
 
     if (data_fd_ >= 0) {
         close(data_fd_);
@@ -51,7 +100,12 @@ EagleBlock::~EagleBlock() {
 }
 
 Status EagleBlock::OpenBlock(const std::string& folder, EagleBlock** result) {
-    EagleBlock* tmp_block = new EagleBlock();
+    return OpenBlock(folder, BlockOptions(), result);
+}
+
+Status EagleBlock::OpenBlock(const std::string& folder, const BlockOptions& options,
+                             EagleBlock** result) {
+    EagleBlock* tmp_block = new EagleBlock(options);
     Status status = tmp_block->Open(folder);
     if (status.code() == kOk) {
         *result = tmp_block;
@@ -62,6 +116,11 @@ Status EagleBlock::OpenBlock(const std::string& folder, EagleBlock** result) {
 }
 
 Status EagleBlock::CreateBlock(const std::string& folder, EagleBlock** result, int64_t max_block_size) {
+    return CreateBlock(folder, BlockOptions(), result, max_block_size);
+}
+
+Status EagleBlock::CreateBlock(const std::string& folder, const BlockOptions& options,
+                               EagleBlock** result, int64_t max_block_size) {
     Status status;
     if (max_block_size > kMaxBlockSize) {
         status.set_code(kInvalidArg);
@@ -69,7 +128,7 @@ Status EagleBlock::CreateBlock(const std::string& folder, EagleBlock** result, i
         return status;
     }
 
-    EagleBlock* tmp_block = new EagleBlock();
+    EagleBlock* tmp_block = new EagleBlock(options);
     status = tmp_block->Create(folder, max_block_size);
     if (status.code() == kOk) {
         // return the new block
@@ -81,7 +140,190 @@ Status EagleBlock::CreateBlock(const std::string& folder, EagleBlock** result, i
     return status;
 }
 
+// write all iovecs to fd starting at offset; retry on short writes
+static Status PwritevFully(int fd, struct iovec* iov, int iovcnt, int64_t offset) {
+    Status status;
+    while (iovcnt > 0) {
+        int cnt = iovcnt > IOV_MAX ? IOV_MAX : iovcnt;
+        errno = 0;
+        ssize_t written_size = pwritev(fd, iov, cnt, offset);
+        if (written_size <= 0) {
+            status.set_code(kIOError);
+            status.set_msg("failed to pwritev %d iovecs at offset %ld, %m", cnt, offset);
+            return status;
+        }
+        offset += written_size;
+
+        // skip fully written iovecs, and adjust the partially written one
+        while (iovcnt > 0 && written_size >= (ssize_t)iov->iov_len) {
+            written_size -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + written_size;
+            iov->iov_len -= written_size;
+        }
+    }
+    return status;
+}
+
+Status EagleBlock::ReserveSpace(int64_t data_size, int num_entries, int64_t* first_seq,
+                                int64_t* data_offset, int64_t* index_offset, bool* buffered) {
+    Status status;
+    ScopedLocker<MutexLock> lock(write_lock_);
+    // no data is written by deletes
+    if (data_size > 0 ? !IsNormal() : !AcceptDeletes()) {
+        status.set_code(kInternalError);
+        status.set_msg("block status %d, it is not normal", status_);
+        return status;
+    }
+
+    if (data_offset_ + data_size > max_block_size_) {
+        status.set_code(kInternalError);
+        status.set_msg("current block size is %ld, max block size is %ld, no free space "
+                       "to hold %ld bytes", data_offset_, max_block_size_, data_size);
+        return status;
+    }
+
+    *first_seq = last_sequence_number_ + 1;
+    *data_offset = data_offset_;
+    *index_offset = index_offset_;
+    last_sequence_number_ += num_entries;
+    data_offset_ += data_size;
+    index_offset_ += num_entries * sizeof(IndexEntry);
+    if (buffered != NULL) {
+        *buffered = tail_buffer_ != NULL && tail_buffer_->Reserve(*data_offset, data_size);
+    }
+    return status;
+}
+
+Status EagleBlock::WriteData(struct iovec* iov, int iovcnt, int64_t offset, bool buffered) {
+    if (buffered) {
+        tail_buffer_->Write(offset, iov, iovcnt);
+        return Status();
+    }
+    return PwritevFully(data_fd_, iov, iovcnt, offset);
+}
+
+Status EagleBlock::FlushTail(bool force) {
+    Status status;
+    if (tail_buffer_ == NULL) {
+        return status;
+    }
+    int64_t published_end = 0;
+    int64_t published_index_end = 0;
+    {
+        ScopedLocker<MutexLock> lock(publish_lock_);
+        published_end = published_data_offset_;
+        published_index_end = published_index_offset_;
+    }
+    if (!force && !tail_buffer_->NeedFlush(published_end)) {
+        return status;
+    }
+    status = tail_buffer_->Flush(data_fd_, published_end, index_fd_, published_index_end);
+    if (status.code() != kOk) {
+        // published objects cannot be written to data file, they would be lost
+        log_->Write(LL_ERROR, "failed to flush tail buffer with %s", status.ToString().c_str());
+        ScopedLocker<MutexLock> lock(publish_lock_);
+        MarkWriteFailed(max_sequence_number_, status);
+    }
+    return status;
+}
+
+Status EagleBlock::FlushTailBefore(int64_t end) {
+    if (tail_buffer_ == NULL || end <= tail_buffer_->flushed_offset()) {
+        return Status();
+    }
+    return FlushTail(true);
+}
+
+void EagleBlock::BeginPublish(int64_t first_seq) {
+    publish_lock_.Lock();
+    while (publish_sequence_number_ != first_seq - 1) {
+        publish_cond_.Wait();
+    }
+}
+
+void EagleBlock::MarkWriteFailed(int64_t seq, const Status& status) {
+    if (!write_failed_) {
+        // the index file has a hole now; writes after it would be dropped by recovery,
+        // so stop accepting new writes
+        write_failed_ = true;
+        status_ = kReadOnly;
+        log_->Write(LL_ERROR, "write of sequence_number %ld failed with %s, block is read only",
+                    seq, status.ToString().c_str());
+    }
+}
+
+void EagleBlock::EndPublish(int64_t last_seq, const Status& status) {
+    if (status.code() != kOk) {
+        MarkWriteFailed(last_seq, status);
+    }
+    publish_sequence_number_ = last_seq;
+    DrainPendingPutsAndUnlock();
+}
+
+void EagleBlock::DrainPendingPutsAndUnlock() {
+    // publish async puts which are written but waiting for earlier writes
+    std::vector<AsyncPutContext*> done;
+    while (!pending_puts_.empty() &&
+            pending_puts_.begin()->first == publish_sequence_number_ + 1) {
+        AsyncPutContext* context = pending_puts_.begin()->second;
+        pending_puts_.erase(pending_puts_.begin());
+        ApplyAsyncPut(context);
+        publish_sequence_number_ = context->entry.sequence_number;
+        done.push_back(context);
+    }
+    publish_cond_.SignalAll();
+    publish_lock_.Unlock();
+
+    for (size_t i = 0; i < done.size(); ++i) {
+        AsyncPutContext* context = done[i];
+        context->callback(context->arg, context->status, context->entry.object_id);
+        delete context;
+    }
+}
+
+void EagleBlock::SetPublished(int64_t seq, int64_t index_end, int64_t data_end,
+                              const IndexEntry* entries, int num_entries) {
+    if (tail_buffer_ != NULL) {
+        tail_buffer_->AppendIndex(entries, num_entries * sizeof(IndexEntry));
+    }
+    published_index_offset_ = index_end;
+    published_data_offset_ = data_end;
+    __atomic_store_n(&max_sequence_number_, seq, __ATOMIC_RELEASE);
+}
+
+void EagleBlock::AddLiveBytes(int64_t bytes) {
+    __atomic_store_n(&live_bytes_, live_bytes_ + bytes, __ATOMIC_RELEASE);
+}
+
+void EagleBlock::AddDeadEntry(const IndexEntry& entry) {
+    int64_t bytes = sizeof(ObjectHeader) + entry.size;
+    __atomic_store_n(&live_bytes_, live_bytes_ - bytes, __ATOMIC_RELEASE);
+    __atomic_store_n(&dead_bytes_, dead_bytes_ + bytes, __ATOMIC_RELEASE);
+}
+
+void EagleBlock::WaitForPendingWrites() {
+    int64_t last_seq = -1;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        last_seq = last_sequence_number_;
+    }
+
+    ScopedLocker<MutexLock> lock(publish_lock_);
+    while (publish_sequence_number_ < last_seq) {
+        publish_cond_.Wait();
+    }
+}
+
 Status EagleBlock::PutObject(const std::string& content, int64_t* object_id) {
+    return PutObject(WriteOptions(), content, object_id);
+}
+
+Status EagleBlock::PutObject(const WriteOptions& options, const std::string& content,
+                             int64_t* object_id) {
     Status status;
     if (content.length() <= 0) {
         status.set_code(kInvalidArg);
@@ -94,142 +336,774 @@ Status EagleBlock::PutObject(const std::string& content, int64_t* object_id) {
         return status;
     }
 
-    if (!IsNormal()) {
-        status.set_code(kInternalError);
-        status.set_msg("block status %d, it is not normal", status_);
-        return status;
-    }
-
+    // 1. reserve sequence number, data space & index space
     ObjectHeader header;
     const int header_size = sizeof(header);
-    int64_t tmp_size = data_offset_;
-    tmp_size += header_size;
-    tmp_size += content.length();
-    if (tmp_size > max_block_size_) {
-        status.set_code(kInternalError);
-        status.set_msg("current block size is %ld, max object size is %ld, no free space "
-                       "to hold this object", data_offset_, max_block_size_);
+    int64_t current_max_seq = -1;
+    int64_t start_offset = 0;
+    int64_t index_offset = 0;
+    bool buffered = false;
+    status = ReserveSpace(header_size + content.length(), 1, &current_max_seq, &start_offset,
+                          &index_offset, &buffered);
+    if (status.code() != kOk) {
         return status;
     }
 
-    int64_t current_max_seq = max_sequence_number_ + 1;
-    // 1. write data file
-    // 1). write object header
+    // 2. write object header & content to data file
     header.object_id = current_max_seq;
     header.size = content.size();
-    header.crc = Adler32_Value(content.data(), content.size());
-    errno = 0;
-    int64_t start_offset = data_offset_;
-    int written_size = pwrite(data_fd_, &header, header_size, start_offset);
-    if (written_size != header_size) {
-        status.set_code(kIOError);
-        status.set_msg("failed to write object header,only write %d bytes but expect %d bytes, %m",
-                       written_size, header_size);
-        return status;
-    }
-    // 2). write data
-    errno = 0;
-    start_offset += header_size;
-    written_size = pwrite(data_fd_, content.data(), content.length(), start_offset);
-    if (written_size != (int)content.length()) {
-        status.set_code(kIOError);
-        status.set_msg("failed to write object content, only write %d bytes but expect %d bytes, %m",
-                       written_size, content.length());
-        return status;
-    }
-
-    // 2. write index file
+    header.checksum_type = kChecksumCrc32c;
+    header.crc = Value(content.data(), content.size());
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = (void*)content.data();
+    iov[1].iov_len = content.length();
     IndexEntry entry;
     entry.sequence_number = current_max_seq;
     entry.object_id = header.object_id;
-    entry.offset = start_offset;
+    entry.offset = start_offset + header_size;
     entry.size = content.length();
     const int entry_size = sizeof(entry);
-    errno = 0;
-    written_size = pwrite(index_fd_, &entry, entry_size, index_offset_);
-    if (written_size != entry_size) {
+    {
+        // only the writes are reported, waiting for publishing & syncing is not caused by
+        // background io
+        ScopedLatency latency(options_.rate_limiter);
+        status = WriteData(iov, 2, start_offset, buffered);
+
+        // 3. write index file; with a tail buffer, it is written after data by FlushTail
+        if (status.code() == kOk && tail_buffer_ == NULL) {
+            errno = 0;
+            int written_size = pwrite(index_fd_, &entry, entry_size, index_offset);
+            if (written_size != entry_size) {
+                status.set_code(kIOError);
+                status.set_msg("failed to write index, only written %d bytes but expect %d "
+                               "bytes, %m", written_size, entry_size);
+            }
+        }
+    }
+
+    // 4. update index in sequence order
+    BeginPublish(current_max_seq);
+    if (status.code() == kOk && write_failed_) {
         status.set_code(kIOError);
-        status.set_msg("failed to write index, only written %d bytes but expect %d bytes, %m",
-                       written_size, entry_size);
+        status.set_msg("a previous write failed, block is read only");
+    }
+    if (status.code() == kOk) {
+        IndexEntry old_entry;
+        if (!indexs_->Insert(entry, &old_entry)) {
+            log_->Write(LL_FATAL, "duplicated object id %ld, exit!", entry.object_id);
+            exit(1);
+        }
+        SetPublished(current_max_seq, index_offset + entry_size, entry.offset + entry.size,
+                     &entry, 1);
+        num_objects_++;
+        AddLiveBytes(header_size + entry.size);
+        *object_id = current_max_seq;
+    }
+    EndPublish(current_max_seq, status);
+    // a write which didn't fit in the buffer flushes it too, so that it can restart
+    FlushTail(false);
+
+    if (status.code() == kOk && options.sync) {
+        status = GroupSync(current_max_seq);
+    }
+    return status;
+}
+
+void EagleBlock::ApplyAsyncPut(AsyncPutContext* context) {
+    if (context->status.code() == kOk && write_failed_) {
+        context->status.set_code(kIOError);
+        context->status.set_msg("a previous write failed, block is read only");
+    }
+    if (context->status.code() == kOk) {
+        IndexEntry old_entry;
+        if (!indexs_->Insert(context->entry, &old_entry)) {
+            log_->Write(LL_FATAL, "duplicated object id %ld, exit!", context->entry.object_id);
+            exit(1);
+        }
+        SetPublished(context->entry.sequence_number, context->index_offset + sizeof(IndexEntry),
+                     context->entry.offset + context->entry.size, &context->entry, 1);
+        num_objects_++;
+        AddLiveBytes(sizeof(ObjectHeader) + context->entry.size);
+    } else {
+        MarkWriteFailed(context->entry.sequence_number, context->status);
+    }
+}
+
+void EagleBlock::PublishAsyncPut(AsyncPutContext* context) {
+    publish_lock_.Lock();
+    pending_puts_[context->entry.sequence_number] = context;
+    DrainPendingPutsAndUnlock();
+}
+
+void EagleBlock::OnAsyncPutWritten(AsyncPutContext* context, int64_t res, int64_t expect_size,
+                                   const char* file) {
+    if (res != expect_size && __sync_bool_compare_and_swap(&context->failed, 0, 1)) {
+        context->status.set_code(kIOError);
+        context->status.set_msg("failed to write %s file for object %ld, result %ld but expect "
+                                "%ld, %s", file, context->entry.object_id, res, expect_size,
+                                res < 0 ? strerror(-res) : "short write");
+    }
+    if (__sync_sub_and_fetch(&context->pending_writes, 1) == 0) {
+        context->block->PublishAsyncPut(context);
+    }
+}
+
+void EagleBlock::OnAsyncPutDataWritten(void* arg, int64_t res) {
+    AsyncPutContext* context = (AsyncPutContext*)arg;
+    OnAsyncPutWritten(context, res, context->iovs[0].iov_len + context->iovs[1].iov_len, "data");
+}
+
+void EagleBlock::OnAsyncPutIndexWritten(void* arg, int64_t res) {
+    AsyncPutContext* context = (AsyncPutContext*)arg;
+    OnAsyncPutWritten(context, res, context->iovs[2].iov_len, "index");
+}
+
+Status EagleBlock::AsyncPutObject(const Slice& content, ObjectCallback callback, void* arg) {
+    Status status;
+    if (content.size() <= 0) {
+        status.set_code(kInvalidArg);
+        status.set_msg("content is empty");
+        return status;
+    }
+    if (content.size() > kMaxObjectSize) {
+        status.set_code(kInvalidArg);
+        status.set_msg("object size exceeds %d", kMaxObjectSize);
         return status;
     }
 
-    // 3. update index
-    IndexEntry old_entry;
-    if (!indexs_->Insert(entry, &old_entry)) {
-        status.set_code(kInternalError);
-        status.set_msg("duplicated object id %ld", entry.object_id);
-        log_->Write(LL_FATAL, "duplicated object id %ld, exit!", entry.object_id);
-        exit(1);
+    const int header_size = sizeof(ObjectHeader);
+    int64_t seq = -1;
+    int64_t start_offset = 0;
+    int64_t index_offset = 0;
+    bool buffered = false;
+    status = ReserveSpace(header_size + content.size(), 1, &seq, &start_offset, &index_offset,
+                          &buffered);
+    if (status.code() != kOk) {
         return status;
     }
 
-    start_offset += content.length();
-    data_offset_ = start_offset;
-    index_offset_ += entry_size;
-    max_sequence_number_ = current_max_seq;
-    *object_id = max_sequence_number_;
+    AsyncPutContext* context = new AsyncPutContext();
+    context->block = this;
+    context->callback = callback;
+    context->arg = arg;
+    context->header.object_id = seq;
+    context->header.size = content.size();
+    context->header.checksum_type = kChecksumCrc32c;
+    context->header.crc = Value(content.data(), content.size());
+    context->entry.sequence_number = seq;
+    context->entry.object_id = seq;
+    context->entry.offset = start_offset + header_size;
+    context->entry.size = content.size();
+    context->iovs[0].iov_base = &context->header;
+    context->iovs[0].iov_len = header_size;
+    context->iovs[1].iov_base = (void*)content.data();
+    context->iovs[1].iov_len = content.size();
+    context->iovs[2].iov_base = &context->entry;
+    context->iovs[2].iov_len = sizeof(IndexEntry);
+    context->index_offset = index_offset;
+    context->failed = 0;
+
+    // data & index are written at the same time; the put is published in sequence order
+    // once both of them are completed; with a tail buffer, index is written after data by
+    // FlushTail, and buffered data is only copied
+    int num_requests = 2;
+    if (tail_buffer_ != NULL) {
+        num_requests = buffered ? 0 : 1;
+    }
+    context->pending_writes = num_requests;
+    if (buffered) {
+        tail_buffer_->Write(start_offset, context->iovs, 2);
+    }
+    if (num_requests == 0) {
+        // completed already
+        PublishAsyncPut(context);
+        FlushTail(false);
+        return status;
+    }
+    IORequest requests[2];
+    requests[0].opcode = kIOWrite;
+    requests[0].fd = data_fd_;
+    requests[0].iov = context->iovs;
+    requests[0].iovcnt = 2;
+    requests[0].offset = start_offset;
+    requests[0].callback = OnAsyncPutDataWritten;
+    requests[0].arg = context;
+    requests[1].opcode = kIOWrite;
+    requests[1].fd = index_fd_;
+    requests[1].iov = context->iovs + 2;
+    requests[1].iovcnt = 1;
+    requests[1].offset = index_offset;
+    requests[1].callback = OnAsyncPutIndexWritten;
+    requests[1].arg = context;
+    int submitted = 0;
+    status = io_->Submit(requests, num_requests, &submitted);
+    if (status.code() != kOk) {
+        log_->Write(LL_ERROR, "failed to submit put of object %ld with %s, %d of %d requests "
+                    "submitted", seq, status.ToString().c_str(), submitted, num_requests);
+        if (submitted < num_requests) {
+            // the sequence number is reserved, it fails like a write which is not completed,
+            // and is published once submitted requests are completed; the context cannot be
+            // freed before, since unsubmitted requests are still counted in pending_writes
+            if (__sync_bool_compare_and_swap(&context->failed, 0, 1)) {
+                context->status = status;
+            }
+            if (__sync_sub_and_fetch(&context->pending_writes, num_requests - submitted) == 0) {
+                PublishAsyncPut(context);
+            }
+        }
+        // the put is reported by callback either way
+        status = Status();
+    }
+    // earlier puts maybe published by now
+    FlushTail(false);
+    return status;
+}
 
-    num_objects_++;
+Status EagleBlock::PutObjects(const std::vector<Slice>& contents, std::vector<int64_t>* ids) {
+    return PutObjects(WriteOptions(), contents, ids);
+}
 
+Status EagleBlock::PutObjects(const WriteOptions& options, const std::vector<Slice>& contents,
+                              std::vector<int64_t>* ids) {
+    Status status;
+    const int num = (int)contents.size();
+    if (num <= 0) {
+        status.set_code(kInvalidArg);
+        status.set_msg("contents is empty");
+        return status;
+    }
+
+    const int header_size = sizeof(ObjectHeader);
+    int64_t data_size = 0;
+    for (int i = 0; i < num; ++i) {
+        if (contents[i].size() <= 0) {
+            status.set_code(kInvalidArg);
+            status.set_msg("content %d is empty", i);
+            return status;
+        }
+        if (contents[i].size() > kMaxObjectSize) {
+            status.set_code(kInvalidArg);
+            status.set_msg("size of object %d exceeds %d", i, kMaxObjectSize);
+            return status;
+        }
+        data_size += header_size;
+        data_size += contents[i].size();
+    }
+
+    // 1. reserve sequence numbers, data space & index space for the whole batch
+    int64_t first_seq = -1;
+    int64_t start_offset = 0;
+    int64_t index_offset = 0;
+    bool buffered = false;
+    status = ReserveSpace(data_size, num, &first_seq, &start_offset, &index_offset, &buffered);
+    if (status.code() != kOk) {
+        return status;
+    }
+    int64_t last_seq = first_seq + num - 1;
+
+    // 2. lay out object headers, contents and index entries
+    std::vector<ObjectHeader> headers(num);
+    std::vector<IndexEntry> entries(num);
+    std::vector<struct iovec> iovs(num * 2);
+    int64_t offset = start_offset;
+    for (int i = 0; i < num; ++i) {
+        ObjectHeader& header = headers[i];
+        header.object_id = first_seq + i;
+        header.size = contents[i].size();
+        header.checksum_type = kChecksumCrc32c;
+        header.crc = Value(contents[i].data(), contents[i].size());
+        iovs[i * 2].iov_base = &header;
+        iovs[i * 2].iov_len = header_size;
+        iovs[i * 2 + 1].iov_base = (void*)contents[i].data();
+        iovs[i * 2 + 1].iov_len = contents[i].size();
+
+        offset += header_size;
+        IndexEntry& entry = entries[i];
+        entry.sequence_number = header.object_id;
+        entry.object_id = header.object_id;
+        entry.offset = offset;
+        entry.size = contents[i].size();
+        offset += contents[i].size();
+    }
+
+    {
+        // only writes are reported, as PutObject
+        ScopedLatency latency(options_.rate_limiter);
+        // 3. write data file with pwritev, or copy into tail buffer
+        status = WriteData(&iovs[0], (int)iovs.size(), start_offset, buffered);
+
+        // 4. append all indexes to index file, unless FlushTail does
+        if (status.code() == kOk && tail_buffer_ == NULL) {
+            const int entries_size = sizeof(IndexEntry) * num;
+            errno = 0;
+            int written_size = pwrite(index_fd_, &entries[0], entries_size, index_offset);
+            if (written_size != entries_size) {
+                status.set_code(kIOError);
+                status.set_msg("failed to write index, only written %d bytes but expect %d "
+                               "bytes, %m", written_size, entries_size);
+            }
+        }
+    }
+
+    // 5. update mem indexes in one critical section, in sequence order
+    BeginPublish(first_seq);
+    if (status.code() == kOk && write_failed_) {
+        status.set_code(kIOError);
+        status.set_msg("a previous write failed, block is read only");
+    }
+    if (status.code() == kOk) {
+        IndexEntry old_entry;
+        if (indexs_->InsertBatch(entries, &old_entry) >= 0) {
+            log_->Write(LL_FATAL, "duplicated object id %ld, exit!", old_entry.object_id);
+            exit(1);
+        }
+        SetPublished(last_seq, index_offset + num * sizeof(IndexEntry),
+                     entries.back().offset + entries.back().size, &entries[0], num);
+        num_objects_ += num;
+        AddLiveBytes(data_size);
+        ids->resize(num);
+        for (int i = 0; i < num; ++i) {
+            (*ids)[i] = first_seq + i;
+        }
+    }
+    EndPublish(last_seq, status);
+    // a write which didn't fit in the buffer flushes it too, so that it can restart
+    FlushTail(false);
+
+    if (status.code() == kOk && options.sync) {
+        status = GroupSync(last_seq);
+    }
+    return status;
+}
+
+bool EagleBlock::GetIndexEntry(int64_t object_id, IndexEntry* entry) {
+    ScopedEpoch epoch(index_epoch_);
+    return __atomic_load_n(&indexs_, __ATOMIC_ACQUIRE)->Get(object_id, entry);
+}
+
+void EagleBlock::CacheObject(int64_t object_id, const Slice& content) {
+    ObjectCache* cache = options_.object_cache;
+    cache->Insert(cache_id_, object_id, content);
+    // the object maybe deleted after it was read, and DeleteObject erased it from cache
+    // before it was inserted; ids are never reused, so check it once more
+    IndexEntry entry;
+    if (!GetIndexEntry(object_id, &entry)) {
+        cache->Erase(cache_id_, object_id);
+    }
+}
+
+// whether this read should be verified; reads are sampled per thread, so that readers don't
+// share a counter
+static bool ShouldVerify(const ReadOptions& options) {
+    static __thread uint32_t reads = 0;
+    if (!options.verify_checksums) {
+        return false;
+    }
+    return options.verify_sample_rate <= 1 || ++reads % options.verify_sample_rate == 0;
+}
+
+Status EagleBlock::ReadObjectData(const ReadOptions& options, const IndexEntry& entry,
+                                  char* buf) {
+    Status status;
+    // only reads of data file are reported, objects in memory are not slowed down by
+    // background io
+    ScopedLatency latency(options_.rate_limiter);
+    if (!ShouldVerify(options)) {
+        int read_size = pread(data_fd_, buf, entry.size, entry.offset);
+        if (read_size != entry.size) {
+            status.set_code(kIOError);
+            status.set_msg("only read %d bytes but expect %d bytes for object %ld", read_size,
+                           entry.size, entry.object_id);
+        }
+        return status;
+    }
+
+    // header is just before the object, both are read by one syscall
+    ObjectHeader header;
+    const int header_size = sizeof(header);
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = entry.size;
+    int read_size = preadv(data_fd_, iov, 2, entry.offset - header_size);
+    if (read_size != header_size + entry.size) {
+        status.set_code(kIOError);
+        status.set_msg("only read %d bytes but expect %d bytes for object %ld with header",
+                       read_size, header_size + entry.size, entry.object_id);
+        return status;
+    }
+    uint32_t crc = 0;
+    if (header.magic != kMagicNumber || header.object_id != entry.object_id ||
+            header.size != entry.size ||
+            (crc = ObjectChecksum(header.checksum_type, buf, entry.size)) != header.crc) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("object %ld is corrupted, header object id %ld size %d crc %u, but "
+                       "size %d crc %u are expected, data offset %ld", entry.object_id,
+                       header.object_id, header.size, header.crc, entry.size, crc,
+                       entry.offset);
+        log_->Write(LL_ERROR, "%s", status.msg().c_str());
+    }
     return status;
 }
 
 Status EagleBlock::GetObject(int64_t object_id, std::string* result) {
+    return GetObject(ReadOptions(), object_id, result);
+}
+
+Status EagleBlock::GetObject(const ReadOptions& options, int64_t object_id,
+                             std::string* result) {
+    Status status;
+    ObjectCache* cache = options_.object_cache;
+    if (cache != NULL) {
+        ObjectCache::Handle* handle = cache->Lookup(cache_id_, object_id);
+        if (handle != NULL) {
+            Slice content = cache->Value(handle);
+            result->assign(content.data(), content.size());
+            cache->Release(handle);
+            return status;
+        }
+    }
+
+    IndexEntry entry;
+    if (!GetIndexEntry(object_id, &entry)) {
+        status.set_code(kObjectNotFound);
+        status.set_msg("object %ld doesn't exist", object_id);
+        return status;
+    }
+
+    // read into result directly, no intermediate buffer
+    result->resize(entry.size);
+    if (tail_buffer_ != NULL && tail_buffer_->Read(entry.offset, entry.size, &(*result)[0])) {
+        return status;
+    }
+    status = ReadObjectData(options, entry, &(*result)[0]);
+    if (status.code() != kOk) {
+        result->clear();
+        return status;
+    }
+
+    if (cache != NULL) {
+        CacheObject(object_id, *result);
+    }
+    return status;
+}
+
+Status EagleBlock::GetObject(int64_t object_id, char* buf, int buf_len, int* size) {
+    return GetObject(ReadOptions(), object_id, buf, buf_len, size);
+}
+
+Status EagleBlock::GetObject(const ReadOptions& options, int64_t object_id, char* buf,
+                             int buf_len, int* size) {
     Status status;
+    ObjectCache* cache = options_.object_cache;
+    if (cache != NULL) {
+        ObjectCache::Handle* handle = cache->Lookup(cache_id_, object_id);
+        if (handle != NULL) {
+            Slice content = cache->Value(handle);
+            *size = content.size();
+            if (buf_len < *size) {
+                status.set_code(kInvalidArg);
+                status.set_msg("buffer length %d is less than size %d of object %ld", buf_len,
+                               *size, object_id);
+            } else {
+                memcpy(buf, content.data(), content.size());
+            }
+            cache->Release(handle);
+            return status;
+        }
+    }
+
     IndexEntry entry;
-    if (!indexs_->Get(object_id, &entry)) {
+    if (!GetIndexEntry(object_id, &entry)) {
         status.set_code(kObjectNotFound);
         status.set_msg("object %ld doesn't exist", object_id);
         return status;
     }
 
-    int read_size = pread(data_fd_, internal_buf_, entry.size, entry.offset);
-    if (read_size != entry.size) {
+    *size = entry.size;
+    if (buf_len < entry.size) {
+        status.set_code(kInvalidArg);
+        status.set_msg("buffer length %d is less than size %d of object %ld", buf_len,
+                       entry.size, object_id);
+        return status;
+    }
+
+    if (tail_buffer_ != NULL && tail_buffer_->Read(entry.offset, entry.size, buf)) {
+        return status;
+    }
+    status = ReadObjectData(options, entry, buf);
+    if (status.code() == kOk && cache != NULL) {
+        CacheObject(object_id, Slice(buf, entry.size));
+    }
+    return status;
+}
+
+struct AsyncGetContext {
+    int64_t object_id;
+    int size;
+    struct iovec iov;
+    ObjectCallback callback;
+    void* arg;
+};
+
+static void OnAsyncGetDone(void* arg, int64_t res) {
+    AsyncGetContext* context = (AsyncGetContext*)arg;
+    Status status;
+    if (res != context->size) {
         status.set_code(kIOError);
-        status.set_msg("only read %d bytes but expect %d bytes for object %ld", read_size,
+        status.set_msg("only read %ld bytes but expect %d bytes for object %ld, %s", res,
+                       context->size, context->object_id, res < 0 ? strerror(-res) : "");
+    }
+    context->callback(context->arg, status, context->size);
+    delete context;
+}
+
+Status EagleBlock::AsyncGetObject(int64_t object_id, char* buf, int buf_len,
+                                  ObjectCallback callback, void* arg) {
+    Status status;
+    IndexEntry entry;
+    if (!GetIndexEntry(object_id, &entry)) {
+        status.set_code(kObjectNotFound);
+        status.set_msg("object %ld doesn't exist", object_id);
+        return status;
+    }
+
+    if (buf_len < entry.size) {
+        status.set_code(kInvalidArg);
+        status.set_msg("buffer length %d is less than size %d of object %ld", buf_len,
                        entry.size, object_id);
         return status;
     }
-    result->assign(internal_buf_, entry.size);
 
+    // the read is submitted to data file, the object should be flushed
+    status = FlushTailBefore(entry.offset + entry.size);
+    if (status.code() != kOk) {
+        return status;
+    }
+
+    AsyncGetContext* context = new AsyncGetContext();
+    context->object_id = object_id;
+    context->size = entry.size;
+    context->iov.iov_base = buf;
+    context->iov.iov_len = entry.size;
+    context->callback = callback;
+    context->arg = arg;
+
+    IORequest request;
+    request.opcode = kIORead;
+    request.fd = data_fd_;
+    request.iov = &context->iov;
+    request.iovcnt = 1;
+    request.offset = entry.offset;
+    request.callback = OnAsyncGetDone;
+    request.arg = context;
+    int submitted = 0;
+    status = io_->Submit(&request, 1, &submitted);
+    if (status.code() != kOk) {
+        log_->Write(LL_ERROR, "failed to submit read of object %ld with %s", object_id,
+                    status.ToString().c_str());
+        if (submitted == 0) {
+            delete context;
+        }
+        // otherwise the read is submitted, and callback frees the context
+    }
     return status;
 }
 
-Status EagleBlock::DeleteObject(int64_t object_id) {
+// order lookups of MultiGet by data offset
+struct OffsetLess {
+    explicit OffsetLess(const std::vector<IndexEntry>& entries) : entries_(entries) {
+    }
+
+    bool operator()(int a, int b) const {
+        return entries_[a].offset < entries_[b].offset;
+    }
+
+    const std::vector<IndexEntry>& entries_;
+};
+
+Status EagleBlock::MultiGet(const std::vector<int64_t>& object_ids,
+                            std::vector<std::string>* results, std::vector<Status>* statuses) {
     Status status;
-    if (!IsNormal()) {
-        status.set_code(kInternalError);
-        status.set_msg("block status %d, it is not normal", status_);
+    const int num = (int)object_ids.size();
+    results->clear();
+    results->resize(num);
+    statuses->clear();
+    statuses->resize(num);
+
+    // 1. resolve all ids under one lock
+    std::vector<IndexEntry> entries;
+    std::vector<bool> found;
+    {
+        ScopedEpoch epoch(index_epoch_);
+        __atomic_load_n(&indexs_, __ATOMIC_ACQUIRE)->GetBatch(object_ids, &entries, &found);
+    }
+    std::vector<int> order;
+    order.reserve(num);
+    int64_t read_end = 0;
+    for (int i = 0; i < num; ++i) {
+        if (!found[i]) {
+            (*statuses)[i].set_code(kObjectNotFound);
+            (*statuses)[i].set_msg("object %ld doesn't exist", object_ids[i]);
+            continue;
+        }
+        order.push_back(i);
+        read_end = std::max(read_end, entries[i].offset + entries[i].size);
+    }
+    // objects are read from data file, they should be flushed
+    status = FlushTailBefore(read_end);
+    if (status.code() != kOk) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            (*statuses)[order[i]] = status;
+        }
         return status;
     }
 
+    // 2. sort by data offset, and merge adjacent or nearby objects into one preadv;
+    // bytes between them (object headers, deleted objects) are read into gap_buf and dropped
+    std::sort(order.begin(), order.end(), OffsetLess(entries));
+    std::string gap_buf;
+    std::vector<struct iovec> iovs;
+    const int order_num = (int)order.size();
+    int run_begin = 0;
+    while (run_begin < order_num) {
+        int64_t run_offset = entries[order[run_begin]].offset;
+        int64_t run_end = run_offset;
+        int run_next = run_begin;
+        iovs.clear();
+        for (; run_next < order_num; ++run_next) {
+            const IndexEntry& entry = entries[order[run_next]];
+            if (entry.offset < run_end) {
+                // duplicated object id, copied after read
+                continue;
+            }
+
+            int64_t gap = entry.offset - run_end;
+            if (run_next > run_begin && (gap > kMultiGetMaxGap ||
+                    entry.offset + entry.size - run_offset > kMultiGetMaxReadSize ||
+                    (int)iovs.size() + 2 > IOV_MAX)) {
+                break;
+            }
+
+            struct iovec iov;
+            if (gap > 0) {
+                if (gap_buf.empty()) {
+                    gap_buf.resize(kMultiGetMaxGap);
+                }
+                iov.iov_base = &gap_buf[0];
+                iov.iov_len = gap;
+                iovs.push_back(iov);
+            }
+            std::string& result = (*results)[order[run_next]];
+            result.resize(entry.size);
+            iov.iov_base = &result[0];
+            iov.iov_len = entry.size;
+            iovs.push_back(iov);
+            run_end = entry.offset + entry.size;
+        }
+
+        errno = 0;
+        ssize_t read_size = preadv(data_fd_, &iovs[0], (int)iovs.size(), run_offset);
+        for (int i = run_begin; i < run_next; ++i) {
+            int idx = order[i];
+            if (read_size != run_end - run_offset) {
+                (*results)[idx].clear();
+                (*statuses)[idx].set_code(kIOError);
+                (*statuses)[idx].set_msg("only read %ld bytes but expect %ld bytes at offset "
+                                         "%ld for object %ld, %m", read_size,
+                                         run_end - run_offset, run_offset, object_ids[idx]);
+                status = (*statuses)[idx];
+            } else if (i > run_begin && entries[order[i - 1]].offset == entries[idx].offset) {
+                (*results)[idx] = (*results)[order[i - 1]];
+            }
+        }
+        run_begin = run_next;
+    }
+
+    return status;
+}
+
+Status EagleBlock::DeleteObject(int64_t object_id) {
+    return DeleteObject(WriteOptions(), object_id);
+}
+
+Status EagleBlock::DeleteObject(const WriteOptions& options, int64_t object_id) {
+    Status status;
+    // at most one tombstone is written for an object: a delete in flight owns the id until it
+    // is published, later ones find the id either in deleting_ids_ or gone from mem indexes
     IndexEntry entry;
-    if (!indexs_->Get(object_id, &entry)) {
-        // not exist; return ok
-        status.set_msg("object %ld doesn't exist", object_id);
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        if (!AcceptDeletes()) {
+            status.set_code(kInternalError);
+            status.set_msg("block status %d, it is not normal", status_);
+            return status;
+        }
+        if (deleting_ids_.count(object_id) > 0 || !GetIndexEntry(object_id, &entry)) {
+            // not exist; return ok
+            status.set_msg("object %ld doesn't exist", object_id);
+            return status;
+        }
+        deleting_ids_.insert(object_id);
+    }
+
+    int64_t current_max_seq = -1;
+    int64_t data_offset = 0;
+    int64_t index_offset = 0;
+    status = ReserveSpace(0, 1, &current_max_seq, &data_offset, &index_offset, NULL);
+    if (status.code() != kOk) {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        deleting_ids_.erase(object_id);
         return status;
     }
 
-    int64_t current_max_seq = max_sequence_number_ + 1;
     IndexEntry delete_entry;
     delete_entry.sequence_number = current_max_seq;
     delete_entry.object_id = object_id;
     delete_entry.offset = entry.offset;
     delete_entry.size = 0;
-    errno = 0;
     const int entry_size = sizeof(delete_entry);
-    int written_size = pwrite(index_fd_, &delete_entry, entry_size, index_offset_);
-    if (written_size != entry_size) {
+    if (tail_buffer_ == NULL) {
+        // with a tail buffer, it is written after the data before it by FlushTail
+        errno = 0;
+        int written_size = pwrite(index_fd_, &delete_entry, entry_size, index_offset);
+        if (written_size != entry_size) {
+            status.set_code(kIOError);
+            status.set_msg("failed to write index, only written %d bytes but expect %d bytes",
+                           written_size, entry_size);
+        }
+    }
+
+    BeginPublish(current_max_seq);
+    if (status.code() == kOk && write_failed_) {
         status.set_code(kIOError);
-        status.set_msg("failed to write index, only written %d bytes but expect %d bytes",
-                       written_size, entry_size);
-        return status;
+        status.set_msg("a previous write failed, block is read only");
+    }
+    if (status.code() == kOk) {
+        IndexEntry deleted;
+        if (indexs_->Get(object_id, &deleted)) {
+            AddDeadEntry(deleted);
+            indexs_->Delete(object_id);
+        }
+        SetPublished(current_max_seq, index_offset + entry_size, published_data_offset_,
+                     &delete_entry, 1);
+    }
+    EndPublish(current_max_seq, status);
+    FlushTail(false);
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        deleting_ids_.erase(object_id);
+    }
+    if (status.code() == kOk && options_.object_cache != NULL) {
+        options_.object_cache->Erase(cache_id_, object_id);
     }
 
-    indexs_->Delete(object_id);
-    max_sequence_number_ = current_max_seq;
-    index_offset_ += entry_size;
+    if (status.code() == kOk && options.sync) {
+        status = GroupSync(current_max_seq);
+    }
     return status;
 }
 
@@ -346,11 +1220,155 @@ Status EagleBlock::StoreManifest() {
     Manifest manifest;
     manifest.max_block_size = max_block_size_;
     manifest.synced_sequence_number = synced_sequence_number_;
+    manifest.live_bytes = synced_live_bytes_;
+    manifest.dead_bytes = synced_dead_bytes_;
+    manifest.table_offset = table_offset_;
+    manifest.table_index_offset = table_index_offset_;
 
     std::string manifest_file = GetFilePath(current_subdir_, kManifestFile);
     return StoreManifestEx(manifest, manifest_file);
 }
 
+// write all bytes, return false and keep errno on failure
+static bool WriteFully(int fd, const char* buf, int64_t size) {
+    while (size > 0) {
+        errno = 0;
+        ssize_t written_size = write(fd, buf, size);
+        if (written_size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written_size <= 0) {
+            return false;
+        }
+        buf += written_size;
+        size -= written_size;
+    }
+    return true;
+}
+
+Status EagleBlock::StoreCheckpoint(const CheckpointHeader& header,
+                                   const std::vector<IndexEntry>& entries) {
+    Status status;
+    std::string checkpoint_file = GetFilePath(current_subdir_, kCheckpointFile);
+    std::string tmp_checkpoint_file = checkpoint_file;
+    tmp_checkpoint_file.append("_tmp");
+
+    CheckpointHeader final_header = header;
+    final_header.num_entries = entries.size();
+    const char* data = entries.empty() ? NULL : (const char*)&entries[0];
+    const int64_t data_size = entries.size() * sizeof(IndexEntry);
+    final_header.crc = Extend(0, data, data_size);
+
+    errno = 0;
+    int tmp_fd = open(tmp_checkpoint_file.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (tmp_fd < 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to create file %s, %m", tmp_checkpoint_file.c_str());
+        return status;
+    }
+
+    if (!WriteFully(tmp_fd, (const char*)&final_header, sizeof(final_header)) ||
+            !WriteFully(tmp_fd, data, data_size)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to write file %s, %m", tmp_checkpoint_file.c_str());
+    } else if (fsync(tmp_fd) != 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to fsync file %s, %m", tmp_checkpoint_file.c_str());
+    }
+
+    // rename tmp checkpoint file to formal checkpoint file
+    errno = 0;
+    if (status.code() == kOk &&
+            rename(tmp_checkpoint_file.c_str(), checkpoint_file.c_str()) != 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to rename file %s to %s, %m", tmp_checkpoint_file.c_str(),
+                       checkpoint_file.c_str());
+    }
+
+    close(tmp_fd);
+    return status;
+}
+
+Status EagleBlock::LoadCheckpoint(int64_t index_file_size) {
+    Status status;
+    std::string checkpoint_file = GetFilePath(current_subdir_, kCheckpointFile);
+    errno = 0;
+    int checkpoint_fd = open(checkpoint_file.c_str(), O_RDONLY);
+    if (checkpoint_fd < 0) {
+        if (errno != ENOENT) {
+            log_->Write(LL_WARNING, "failed to open checkpoint file, %m; replay index file");
+        }
+        return status;
+    }
+
+    // any error makes the checkpoint ignored, the whole index file is replayed then
+    CheckpointHeader header;
+    const int header_size = sizeof(header);
+    struct stat checkpoint_buf;
+    const char* error = NULL;
+    errno = 0;
+    if (0 != fstat(checkpoint_fd, &checkpoint_buf) ||
+            read(checkpoint_fd, &header, header_size) != header_size) {
+        error = "failed to read checkpoint header";
+    } else if (header.magic_number != (int64_t)kMagicNumber || header.num_entries < 0 ||
+               checkpoint_buf.st_size !=
+               header_size + header.num_entries * (int64_t)sizeof(IndexEntry)) {
+        error = "invalid checkpoint header";
+    } else if (header.index_offset > index_file_size ||
+               header.index_offset % sizeof(IndexEntry) != 0) {
+        error = "checkpoint is beyond index file";
+    }
+
+    // the last entry covered by checkpoint should be the same with index file
+    IndexEntry last_entry;
+    if (error == NULL && header.index_offset > 0) {
+        const int entry_size = sizeof(last_entry);
+        if (pread(index_fd_, &last_entry, entry_size, header.index_offset - entry_size) !=
+                entry_size || last_entry.sequence_number != header.sequence_number) {
+            error = "checkpoint doesn't match index file";
+        }
+    }
+
+    std::vector<IndexEntry> entries;
+    if (error == NULL) {
+        entries.resize(header.num_entries);
+        const int64_t data_size = header.num_entries * sizeof(IndexEntry);
+        char* data = entries.empty() ? NULL : (char*)&entries[0];
+        if (pread(checkpoint_fd, data, data_size, header_size) != data_size) {
+            error = "failed to read checkpoint entries";
+        } else if (Extend(0, data, data_size) != header.crc) {
+            error = "checkpoint crc check error";
+        }
+    }
+    close(checkpoint_fd);
+    if (error != NULL) {
+        log_->Write(LL_WARNING, "%s, ignore checkpoint and replay index file", error);
+        return status;
+    }
+
+    // entries in checkpoint are live objects
+    int64_t live_bytes = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        live_bytes += sizeof(ObjectHeader) + entries[i].size;
+    }
+    IndexEntry old_entry;
+    if (indexs_->BulkInsert(&entries, &old_entry) >= 0) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("checkpoint maybe corrupted! duplicated object id %ld",
+                       old_entry.object_id);
+        return status;
+    }
+    max_sequence_number_ = header.sequence_number;
+    index_offset_ = header.index_offset;
+    data_offset_ = header.data_offset;
+    num_objects_ = header.num_objects;
+    live_bytes_ = live_bytes;
+    checkpoint_index_offset_ = header.index_offset;
+    log_->Write(LL_NOTICE, "load checkpoint with %ld entries, sequence_number %ld",
+                header.num_entries, header.sequence_number);
+    return status;
+}
+
 std::string EagleBlock::GetBlockRootDir(const std::string& subdir) {
     std::string full_path = root_dir_;
     full_path.append("/");
@@ -378,7 +1396,7 @@ Status EagleBlock::GetManifest(Manifest* manifest) {
 
     int expect_size = sizeof(*manifest);
     int size = (int)read(manifest_fd, (char*)manifest, expect_size);
-    if (size != expect_size) {
+    if (size != expect_size && size != kManifestV1Size && size != kManifestV2Size) {
         status.set_code(kIOError);
         status.set_msg("failed to read manifest file,only read %d bytes but expect %d bytes,"
                        "%m", size, expect_size);
@@ -386,6 +1404,14 @@ Status EagleBlock::GetManifest(Manifest* manifest) {
         // check magic
         status.set_code(kIOError);
         status.set_msg("manifest is corrupted, magic number read is not equal with expected value");
+    } else if (size != expect_size) {
+        // written by an old version
+        if (size == kManifestV1Size) {
+            manifest->live_bytes = -1;
+            manifest->dead_bytes = -1;
+        }
+        manifest->table_offset = -1;
+        manifest->table_index_offset = -1;
     }
 
     close(manifest_fd);
@@ -405,7 +1431,6 @@ Status EagleBlock::Init(const std::string& folder, int64_t max_block_size, bool
     } else {
         root_dir_ = folder;
     }
-    internal_buf_ = (char*)malloc(kMaxObjectSize);
 
     if (!exist) {
         // default sub dir is 0
@@ -434,12 +1459,13 @@ Status EagleBlock::Init(const std::string& folder, int64_t max_block_size, bool
     }
 
     // 2. construct index fd
+    // no O_APPEND for data & index fd: concurrent writers pwrite at their reserved offsets
     std::string index_file = GetFilePath(current_subdir_, kIndexFile);
     errno = 0;
     if (exist) {
-        index_fd_ = open(index_file.c_str(), O_RDWR | O_APPEND);
+        index_fd_ = open(index_file.c_str(), O_RDWR);
     } else {
-        index_fd_ = open(index_file.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        index_fd_ = open(index_file.c_str(), O_RDWR | O_CREAT, 0644);
     }
     if (index_fd_ < 0) {
         status.set_code(kIOError);
@@ -451,9 +1477,9 @@ Status EagleBlock::Init(const std::string& folder, int64_t max_block_size, bool
     std::string data_file = GetFilePath(current_subdir_, kDataFile);
     errno = 0;
     if (exist) {
-        data_fd_ = open(data_file.c_str(), O_RDWR | O_APPEND);
+        data_fd_ = open(data_file.c_str(), O_RDWR | O_LARGEFILE);
     } else {
-        data_fd_ = open(data_file.c_str(), O_RDWR | O_CREAT | O_APPEND | O_LARGEFILE, 0644);
+        data_fd_ = open(data_file.c_str(), O_RDWR | O_CREAT | O_LARGEFILE, 0644);
     }
     if (data_fd_ < 0) {
         status.set_code(kIOError);
@@ -472,16 +1498,18 @@ Status EagleBlock::Init(const std::string& folder, int64_t max_block_size, bool
         }
         max_block_size_ = manifest.max_block_size;
         synced_sequence_number_ = manifest.synced_sequence_number;
+        table_offset_ = manifest.table_offset;
+        table_index_offset_ = manifest.table_index_offset;
     }
 
-    // 5. init mem indexs
+    // 5. init mem indexs, they are resized with the number of objects
     int slot_num = (int)(max_block_size_ / kAveObjectSize);
-    indexs_ = new HashTable<IndexEntry>(slot_num);
+    indexs_ = BlockIndex::Create(options_.index_type, slot_num);
 
     return status;
 }
 
-Status EagleBlock::ValidateObject(const IndexEntry& entry) {
+Status EagleBlock::ValidateObject(const IndexEntry& entry, std::string* buf) {
     Status status;
     ObjectHeader header;
     const int header_size = sizeof(header);
@@ -503,59 +1531,447 @@ Status EagleBlock::ValidateObject(const IndexEntry& entry) {
         return status;
     }
 
-    // validate header
-    if (header.object_id != entry.object_id) {
-        status.set_code(kDataCorrupted);
-        status.set_msg("object id in header %ld but in index is %ld, sequence_number %ld",
-                       header.object_id, entry.object_id, entry.sequence_number);
+    // validate header
+    if (header.object_id != entry.object_id) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("object id in header %ld but in index is %ld, sequence_number %ld",
+                       header.object_id, entry.object_id, entry.sequence_number);
+        return status;
+    }
+
+    if (entry.size > 0) {
+        if (header.object_id != entry.sequence_number) {
+            status.set_code(kDataCorrupted);
+            status.set_msg("object id in header %ld but sequence_number in index is %ld",
+                    header.object_id, entry.sequence_number);
+            return status;
+        }
+    }
+
+    int size = entry.size;
+    if (size <= 0) {
+        // this object is marked as deleted
+        size = header.size;
+    }
+
+    if (size < 0 || size > kMaxObjectSize) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("invalid object size %d, data offset %ld, sequence_number %ld", size,
+                       start_offset, entry.sequence_number);
+        return status;
+    }
+    if ((int)buf->size() < size) {
+        buf->resize(size);
+    }
+
+    // read object data
+    start_offset += header_size;
+    read_size = pread(data_fd_, &(*buf)[0], size, start_offset);
+    if (read_size != size) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("only read %d bytes for object , expect %d bytes, data "
+                "offset %ld, sequence_number %ld", read_size, size, start_offset,
+                entry.sequence_number);
+        return status;
+    }
+
+    // check crc
+    uint32_t crc = ObjectChecksum(header.checksum_type, buf->data(), size);
+    if (crc != header.crc) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("crc check error!crc calculated is %d but stored in header is %d, data "
+                "offset %ld, sequence_number %ld", crc, header.crc, entry.offset, entry.sequence_number);
+    }
+
+    return status;
+}
+
+Status EagleBlock::TruncateTail() {
+    Status status;
+    log_->Write(LL_WARNING, "truncate index file to %ld bytes, data file to %ld bytes",
+                index_offset_, data_offset_);
+    errno = 0;
+    if (0 != ftruncate(index_fd_, index_offset_)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to truncate index file to %ld bytes, %m", index_offset_);
+        return status;
+    }
+
+    struct stat data_buf;
+    errno = 0;
+    if (0 != fstat(data_fd_, &data_buf)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to get data file info, %m");
+        return status;
+    }
+    if (data_buf.st_size > data_offset_ && 0 != ftruncate(data_fd_, data_offset_)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to truncate data file to %ld bytes, %m", data_offset_);
+    }
+    return status;
+}
+
+// unsynced entries of one index chunk, validated by a pool of threads
+struct ValidateTask {
+    EagleBlock* block;
+    const IndexEntry* entries;
+    // positions of entries to validate
+    const std::vector<int>* positions;
+    std::vector<Status>* statuses;
+    volatile int next;
+    // the first failed position; later ones needn't be validated since they are dropped
+    volatile int first_failed;
+};
+
+void* EagleBlock::ValidateThread(void* arg) {
+    ValidateTask* task = (ValidateTask*)arg;
+    std::string validate_buf;
+    int num = (int)task->positions->size();
+    while (true) {
+        int i = __sync_fetch_and_add(&task->next, 1);
+        if (i >= num || i > task->first_failed) {
+            break;
+        }
+        int position = (*task->positions)[i];
+        Status status = task->block->ValidateObject(task->entries[position], &validate_buf);
+        if (status.code() != kOk) {
+            (*task->statuses)[position] = status;
+            int first_failed = task->first_failed;
+            while (i < first_failed &&
+                   !__sync_bool_compare_and_swap(&task->first_failed, first_failed, i)) {
+                first_failed = task->first_failed;
+            }
+        }
+    }
+    return NULL;
+}
+
+void EagleBlock::ValidateEntries(const IndexEntry* entries, const std::vector<int>& positions,
+                                 std::vector<Status>* statuses) {
+    // readahead data of objects to validate
+    int64_t start_offset = -1;
+    int64_t end_offset = -1;
+    for (size_t i = 0; i < positions.size(); ++i) {
+        const IndexEntry& entry = entries[positions[i]];
+        if (entry.size > 0) {
+            int64_t offset = entry.offset - sizeof(ObjectHeader);
+            start_offset = start_offset < 0 ? offset : std::min(start_offset, offset);
+            end_offset = std::max(end_offset, entry.offset + entry.size);
+        }
+    }
+    if (start_offset >= 0) {
+        posix_fadvise(data_fd_, start_offset, end_offset - start_offset, POSIX_FADV_WILLNEED);
+    }
+
+    ValidateTask task;
+    task.block = this;
+    task.entries = entries;
+    task.positions = &positions;
+    task.statuses = statuses;
+    task.next = 0;
+    task.first_failed = INT_MAX;
+
+    int thread_num = std::min(kValidateThreadNum,
+                              (int)positions.size() / kValidateEntriesPerThread);
+    std::vector<pthread_t> threads;
+    for (int i = 0; i < thread_num; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, ValidateThread, &task) == 0) {
+            threads.push_back(thread);
+        }
+    }
+    // validate in current thread too, so that all entries are validated even if no thread
+    // is created
+    ValidateThread(&task);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static bool ObjectIdLess(const IndexEntry& left, const IndexEntry& right) {
+    return left.object_id < right.object_id;
+}
+
+static bool IsDeletedEntry(const IndexEntry& entry) {
+    return entry.size <= 0;
+}
+
+// bulk insert entries which are not deleted, and clear them
+static Status FlushNewEntries(BlockIndex* indexs, std::vector<IndexEntry>* entries) {
+    Status status;
+    entries->erase(std::remove_if(entries->begin(), entries->end(), IsDeletedEntry),
+                   entries->end());
+    IndexEntry old_entry;
+    int duplicated = indexs->BulkInsert(entries, &old_entry);
+    if (duplicated >= 0) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("index data maybe corrupted! duplicated object id %ld, sequence_number "
+                       "%ld", old_entry.object_id, (*entries)[duplicated].sequence_number);
+    }
+    entries->clear();
+    return status;
+}
+
+Status EagleBlock::Open(const std::string& folder) {
+    Status status = Init(folder, 0, true);
+    if (status.code() != kOk) {
+        return status;
+    }
+    log_->Write(LL_NOTICE, "begin to open block");
+
+    // 0. a sealed block is opened by the footer of data file, only deletes after the table
+    // are replayed; it is sealed only if manifest says so, a footer alone maybe the tail of
+    // an object
+    if (table_offset_ >= 0) {
+        int64_t accounted_sequence_number = -1;
+        status = OpenSealedTable(&accounted_sequence_number);
+        if (status.code() != kOk) {
+            log_->Write(LL_WARNING, "%s, replay index file", status.ToString().c_str());
+            // drop the record before new puts overwrite the table
+            table_offset_ = -1;
+            table_index_offset_ = -1;
+            Manifest manifest;
+            status = GetManifest(&manifest);
+            if (status.code() == kOk) {
+                manifest.table_offset = -1;
+                manifest.table_index_offset = -1;
+                status = StoreManifestEx(manifest, GetFilePath(current_subdir_, kManifestFile));
+            }
+            if (status.code() != kOk) {
+                return status;
+            }
+        } else {
+            status = ReplaySealedDeletes(accounted_sequence_number);
+            log_->Write(LL_NOTICE, "finish open sealed block with %ld objects, %s",
+                        indexs_->size(), status.ToString().c_str());
+            return status;
+        }
+    }
+
+    // 1. load index file to consturct memory indexs
+    struct stat index_buf;
+    errno = 0;
+    if (0 != fstat(index_fd_, &index_buf)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to get index file info, %m");
+        return status;
+    }
+
+    // only entries after checkpoint are replayed
+    status = LoadCheckpoint(index_buf.st_size);
+    if (status.code() != kOk) {
         return status;
     }
 
-    if (entry.size > 0) {
-        if (header.object_id != entry.sequence_number) {
-            status.set_code(kDataCorrupted);
-            status.set_msg("object id in header %ld but sequence_number in index is %ld",
-                    header.object_id, entry.sequence_number);
+    const int entry_size = sizeof(IndexEntry);
+    int64_t end_offset = index_buf.st_size - (index_buf.st_size % entry_size);
+    // index file is read by large chunks
+    std::string read_buf;
+    read_buf.resize(std::min(end_offset - index_offset_, (int64_t)kIndexReadBufferSize));
+    // positions of unsynced entries in current chunk and results of their validation
+    std::vector<int> validate_positions;
+    std::vector<Status> validate_statuses;
+    // objects are bulk inserted into mem indexes when the whole index file is replayed;
+    // they are ordered by object id, and deleted ones are marked by size 0
+    std::vector<IndexEntry> new_entries;
+    int64_t deleted_new_entries = 0;
+    bool stop = false;
+    while (!stop && index_offset_ < end_offset) {
+        int64_t chunk_size = std::min(end_offset - index_offset_, (int64_t)read_buf.size());
+        errno = 0;
+        int64_t read_size = pread(index_fd_, &read_buf[0], chunk_size, index_offset_);
+        if (read_size != chunk_size) {
+            status.set_code(kIOError);
+            status.set_msg("failed to read index file, only read %ld bytes but expect %ld "
+                           "bytes, offset %ld, %m", read_size, chunk_size, index_offset_);
             return status;
         }
-    }
 
-    int size = entry.size;
-    if (size <= 0) {
-        // this object is marked as deleted
-        size = header.size;
+        const IndexEntry* entries = (const IndexEntry*)read_buf.data();
+        int num_entries = (int)(chunk_size / entry_size);
+
+        // concurrent writers may leave a hole in index file when crashing; only the
+        // prefix before it can be trusted
+        int valid_entries = 0;
+        int64_t last_seq = max_sequence_number_;
+        validate_positions.clear();
+        for (; valid_entries < num_entries; ++valid_entries) {
+            const IndexEntry& entry = entries[valid_entries];
+            if (entry.sequence_number <= last_seq ||
+                    entry.offset < (int64_t)sizeof(ObjectHeader)) {
+                break;
+            }
+            last_seq = entry.sequence_number;
+            if (entry.sequence_number > synced_sequence_number_) {
+                // for unsynced objects; need to validate
+                validate_positions.push_back(valid_entries);
+            }
+        }
+        validate_statuses.assign(valid_entries, Status());
+        if (!validate_positions.empty()) {
+            ValidateEntries(entries, validate_positions, &validate_statuses);
+        }
+
+        // apply in sequence order, until the first invalid entry
+        for (int i = 0; i < num_entries; ++i) {
+            const IndexEntry& entry = entries[i];
+            if (i == valid_entries) {
+                status.set_code(kDataCorrupted);
+                status.set_msg("invalid index entry at offset %ld, sequence_number %ld, last "
+                               "sequence_number %ld", index_offset_, entry.sequence_number,
+                               max_sequence_number_);
+                log_->Write(LL_ERROR, status.ToString().c_str());
+                stop = true;
+                break;
+            }
+            if (validate_statuses[i].code() != kOk) {
+                status = validate_statuses[i];
+                log_->Write(LL_ERROR, status.ToString().c_str());
+                stop = true;
+                break;
+            }
+
+            // for synced objects, no need to validate
+            // update mem indexes
+            if (entry.size > 0) {
+                num_objects_++;
+                live_bytes_ += sizeof(ObjectHeader) + entry.size;
+                // normal object, is not deleted, add it to indexes later
+                if (!new_entries.empty() && new_entries.back().object_id >= entry.object_id) {
+                    // object ids are increasing in index file, just in case
+                    status = FlushNewEntries(indexs_, &new_entries);
+                    if (status.code() != kOk) {
+                        return status;
+                    }
+                    deleted_new_entries = 0;
+                }
+                new_entries.push_back(entry);
+                assert(entry.offset + entry.size > data_offset_);
+                data_offset_ = entry.offset + entry.size;
+            } else {
+                // object is deleted
+                IndexEntry key;
+                key.object_id = entry.object_id;
+                std::vector<IndexEntry>::iterator it = std::lower_bound(
+                        new_entries.begin(), new_entries.end(), key, ObjectIdLess);
+                IndexEntry deleted;
+                if (it != new_entries.end() && it->object_id == entry.object_id) {
+                    if (it->size > 0) {
+                        live_bytes_ -= sizeof(ObjectHeader) + it->size;
+                        it->size = 0;
+                        deleted_new_entries++;
+                    }
+                } else if (indexs_->Get(entry.object_id, &deleted)) {
+                    live_bytes_ -= sizeof(ObjectHeader) + deleted.size;
+                    indexs_->Delete(entry.object_id);
+                }
+            }
+            index_offset_ += entry_size;
+            max_sequence_number_ = entry.sequence_number;
+        }
+
+        // drop deleted entries once they are the majority
+        if (deleted_new_entries > (int64_t)new_entries.size() / 2) {
+            new_entries.erase(std::remove_if(new_entries.begin(), new_entries.end(),
+                                             IsDeletedEntry), new_entries.end());
+            deleted_new_entries = 0;
+        }
     }
 
-    // read object data
-    start_offset += header_size;
-    read_size = pread(data_fd_, internal_buf_, size, start_offset);
-    if (read_size != size) {
-        status.set_code(kDataCorrupted);
-        status.set_msg("only read %d bytes for object , expect %d bytes, data "
-                "offset %ld, sequence_number %ld", read_size, size, start_offset,
-                entry.sequence_number);
-        return status;
+    Status flush_status = FlushNewEntries(indexs_, &new_entries);
+    if (flush_status.code() != kOk) {
+        return flush_status;
     }
 
-    // check crc
-    uint32_t crc = Adler32_Value(internal_buf_, size);
-    if (crc != header.crc) {
+    if (max_sequence_number_ < synced_sequence_number_) {
         status.set_code(kDataCorrupted);
-        status.set_msg("crc check error!crc calculated is %d but stored in header is %d, data "
-                "offset %ld, sequence_number %ld", crc, header.crc, entry.offset, entry.sequence_number);
+        status.set_msg("max_sequence_number %ld less than synced_sequence_number %ld, block "
+                       "maybe corrupted", max_sequence_number_, synced_sequence_number_);
+    } else if (status.code() != kOk || index_offset_ < index_buf.st_size) {
+        // drop the unsynced tail after the last valid entry
+        status = TruncateTail();
     }
-
+    last_sequence_number_ = max_sequence_number_;
+    publish_sequence_number_ = max_sequence_number_;
+    published_index_offset_ = index_offset_;
+    published_data_offset_ = data_offset_;
+    // all bytes before data_offset_ but live objects are garbage
+    dead_bytes_ = data_offset_ - live_bytes_;
+    // existing files are accounted as synced, unsynced writes are still tracked by
+    // synced_sequence_number
+    synced_data_offset_ = data_offset_;
+    synced_index_offset_ = index_offset_;
+    writeback_data_offset_ = data_offset_;
+    writeback_index_offset_ = index_offset_;
+
+    if (status.code() == kOk && options_.tail_buffer_size > 0) {
+        tail_buffer_ = new TailBuffer(options_.tail_buffer_size, data_offset_, index_offset_);
+    }
+    log_->Write(LL_NOTICE, "finish open block with %s", status.ToString().c_str());
     return status;
 }
 
-Status EagleBlock::Open(const std::string& folder) {
-    Status status = Init(folder, 0, true);
+Status EagleBlock::OpenSealedTable(int64_t* accounted_sequence_number) {
+    Status status;
+    struct stat data_buf;
+    errno = 0;
+    if (0 != fstat(data_fd_, &data_buf)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to get data file info, %m");
+        return status;
+    }
+    SealedTable* table = NULL;
+    SealedFooter footer;
+    status = SealedTable::Load(data_fd_, data_buf.st_size, options_.verify_sealed_table, &table,
+                               &footer);
     if (status.code() != kOk) {
         return status;
     }
-    log_->Write(LL_NOTICE, "begin to open block");
+    if (table == NULL || footer.table_offset != table_offset_ || table_index_offset_ < 0) {
+        delete table;
+        status.set_code(kDataCorrupted);
+        status.set_msg("sealed table at %ld in manifest is not found at the end of data file",
+                       table_offset_);
+        return status;
+    }
+    *accounted_sequence_number = OpenSealed(table, footer);
+    return status;
+}
 
-    // 1. load index file to consturct memory indexs
+int64_t EagleBlock::OpenSealed(SealedTable* table, const SealedFooter& footer) {
+    delete indexs_;
+    indexs_ = table;
+    sealed_ = true;
+    status_ = kFull;
+    num_objects_ = footer.num_objects;
+    // manifest is stored by the last sync, with deletes after the table; objects are counted
+    // by the table if live bytes are unknown
+    int64_t accounted_sequence_number = footer.max_sequence_number;
+    Manifest manifest;
+    if (GetManifest(&manifest).code() == kOk && manifest.live_bytes >= 0 &&
+            manifest.synced_sequence_number >= footer.max_sequence_number) {
+        live_bytes_ = manifest.live_bytes;
+        accounted_sequence_number = manifest.synced_sequence_number;
+    } else {
+        std::vector<IndexEntry> entries;
+        table->Dump(&entries);
+        live_bytes_ = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            live_bytes_ += sizeof(ObjectHeader) + entries[i].size;
+        }
+    }
+    max_sequence_number_ = footer.max_sequence_number;
+    // objects end at the table, entries before table_index_offset_ are in the table
+    data_offset_ = footer.table_offset;
+    index_offset_ = table_index_offset_;
+    published_data_offset_ = data_offset_;
+    synced_data_offset_ = data_offset_;
+    writeback_data_offset_ = data_offset_;
+    return accounted_sequence_number;
+}
+
+Status EagleBlock::ReplaySealedDeletes(int64_t accounted_sequence_number) {
+    Status status;
     struct stat index_buf;
     errno = 0;
     if (0 != fstat(index_fd_, &index_buf)) {
@@ -564,57 +1980,122 @@ Status EagleBlock::Open(const std::string& folder) {
         return status;
     }
 
-    IndexEntry entry;
-    const int entry_size = sizeof(entry);
+    const int entry_size = sizeof(IndexEntry);
     int64_t end_offset = index_buf.st_size - (index_buf.st_size % entry_size);
-    while (index_offset_ < end_offset) {
+    std::vector<IndexEntry> entries;
+    std::string validate_buf;
+    bool stop = false;
+    while (!stop && index_offset_ < end_offset) {
+        entries.resize(std::min((end_offset - index_offset_) / entry_size,
+                                (int64_t)kIndexReadBufferSize / entry_size));
+        int64_t chunk_size = entries.size() * entry_size;
         errno = 0;
-        int read_size = read(index_fd_, &entry, entry_size);
-        if (read_size != entry_size) {
+        int64_t read_size = pread(index_fd_, &entries[0], chunk_size, index_offset_);
+        if (read_size != chunk_size) {
             status.set_code(kIOError);
-            status.set_msg("failed to read index file, only read %d bytes but expect %d bytes"
-                           ", offset %ld, %m", read_size, entry_size, index_offset_);
+            status.set_msg("failed to read index file, only read %ld bytes but expect %ld "
+                           "bytes, offset %ld, %m", read_size, chunk_size, index_offset_);
             return status;
         }
 
-        if (entry.sequence_number > synced_sequence_number_) {
-            // for unsynced objects; need to validate
-            status = ValidateObject(entry);
+        // only deletes are written after the table; apply them in sequence order, until the
+        // first invalid one
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const IndexEntry& entry = entries[i];
+            if (entry.sequence_number <= max_sequence_number_ || entry.size > 0 ||
+                    entry.offset < (int64_t)sizeof(ObjectHeader) ||
+                    entry.offset >= data_offset_) {
+                status.set_code(kDataCorrupted);
+                status.set_msg("invalid index entry of sealed block at offset %ld, "
+                               "sequence_number %ld, last sequence_number %ld", index_offset_,
+                               entry.sequence_number, max_sequence_number_);
+            } else if (entry.sequence_number > synced_sequence_number_) {
+                status = ValidateObject(entry, &validate_buf);
+            }
             if (status.code() != kOk) {
                 log_->Write(LL_ERROR, status.ToString().c_str());
+                stop = true;
                 break;
             }
-        }
 
-        // for synced objects, no need to validate 
-        // update mem indexes
-        if (entry.size > 0) {
-            num_objects_++;
-            // normal object, is not deleted, add it to indexes
-            IndexEntry old_entry;
-            if (!indexs_->Insert(entry, &old_entry)) {
-                status.set_code(kDataCorrupted);
-                status.set_msg("index data maybe corrupted! duplicated sequence_number %ld",
-                        entry.sequence_number);
-                return status;
+            IndexEntry deleted;
+            if (indexs_->Get(entry.object_id, &deleted)) {
+                if (entry.sequence_number > accounted_sequence_number) {
+                    live_bytes_ -= sizeof(ObjectHeader) + deleted.size;
+                }
+                indexs_->Delete(entry.object_id);
             }
-            assert(entry.offset + entry.size > data_offset_);
-            data_offset_ = entry.offset + entry.size;
-        } else {
-            // object is deleted
-            indexs_->Delete(entry.object_id);
+            index_offset_ += entry_size;
+            max_sequence_number_ = entry.sequence_number;
         }
-        index_offset_ += entry_size;
-        max_sequence_number_ = entry.sequence_number;
     }
 
     if (max_sequence_number_ < synced_sequence_number_) {
         status.set_code(kDataCorrupted);
         status.set_msg("max_sequence_number %ld less than synced_sequence_number %ld, block "
                        "maybe corrupted", max_sequence_number_, synced_sequence_number_);
+        return status;
+    }
+    status = Status();
+    if (index_offset_ < index_buf.st_size) {
+        // drop the unsynced tail after the last valid entry; data file ends with the table,
+        // it is kept
+        log_->Write(LL_WARNING, "truncate index file to %ld bytes", index_offset_);
+        errno = 0;
+        if (0 != ftruncate(index_fd_, index_offset_)) {
+            status.set_code(kIOError);
+            status.set_msg("failed to truncate index file to %ld bytes, %m", index_offset_);
+            return status;
+        }
     }
+    dead_bytes_ = data_offset_ - live_bytes_;
+    durable_sequence_number_ = max_sequence_number_;
+    last_sequence_number_ = max_sequence_number_;
+    publish_sequence_number_ = max_sequence_number_;
+    published_index_offset_ = index_offset_;
+    synced_index_offset_ = index_offset_;
+    writeback_index_offset_ = index_offset_;
+    return status;
+}
 
-    log_->Write(LL_NOTICE, "finish open block with %s", status.ToString().c_str());
+Status EagleBlock::WriteSealedTable(const std::vector<IndexEntry>& entries) {
+    Status status;
+    SealedFooter footer;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        footer.table_offset = data_offset_;
+    }
+    footer.max_sequence_number = max_sequence_number();
+    footer.num_objects = num_objects_;
+    status = SealedTable::Write(data_fd_, entries, &footer);
+    if (status.code() != kOk) {
+        return status;
+    }
+
+    // the footer should be the last bytes of data file, drop any stale tail after it
+    int64_t file_size = footer.table_offset + footer.num_entries * sizeof(IndexEntry) +
+            sizeof(footer);
+    errno = 0;
+    if (0 != ftruncate(data_fd_, file_size)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to truncate data file to %ld, %m", file_size);
+    } else if (0 != fdatasync(data_fd_)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to sync sealed table, %m");
+    }
+    return status;
+}
+
+Status EagleBlock::DropSealedTable(int64_t table_offset) {
+    Status status;
+    errno = 0;
+    if (0 != ftruncate(data_fd_, table_offset)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to truncate sealed table at %ld, %m", table_offset);
+    } else if (0 != fdatasync(data_fd_)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to sync data file after dropping sealed table, %m");
+    }
     return status;
 }
 
@@ -662,50 +2143,461 @@ Status EagleBlock::Create(const std::string& folder, int64_t max_block_size) {
         return status;
     }
 
+    if (options_.tail_buffer_size > 0) {
+        tail_buffer_ = new TailBuffer(options_.tail_buffer_size, data_offset_, index_offset_);
+    }
     log_->Write(LL_NOTICE, "finish create block with %s", status.ToString().c_str());
     return status;
 }
 
-void EagleBlock::Sync() {
-    int64_t current_max_seq = max_sequence_number_;
-    // sync data file
+Status EagleBlock::Sync() {
+    return SyncInternal(false);
+}
+
+Status EagleBlock::Checkpoint() {
+    return SyncInternal(true);
+}
+
+Status EagleBlock::SyncInternal(bool force_checkpoint) {
+    ScopedLocker<MutexLock> sync_lock(sync_lock_);
+    Status status;
+    int64_t current_max_seq = -1;
+    int64_t live_bytes = 0;
+    int64_t dead_bytes = 0;
+    {
+        // usage stored in manifest is the one at synced sequence number
+        ScopedLocker<MutexLock> lock(publish_lock_);
+        current_max_seq = max_sequence_number_;
+        live_bytes = live_bytes_;
+        dead_bytes = dead_bytes_;
+    }
+    int64_t data_offset = 0;
+    int64_t index_offset = 0;
+    {
+        // offsets maybe reserved but not written yet, they are only used for accounting
+        ScopedLocker<MutexLock> lock(write_lock_);
+        data_offset = data_offset_;
+        index_offset = index_offset_;
+    }
+
+    // snapshot mem indexes before syncing, so that all entries in checkpoint are synced
+    CheckpointHeader checkpoint;
+    std::vector<IndexEntry> live_entries;
+    int64_t new_entries = (index_offset - checkpoint_index_offset_) / sizeof(IndexEntry);
+    // a sealed block is opened by its table, which is checkpoint enough
+    bool need_checkpoint = force_checkpoint && !sealed_;
+    {
+        ScopedEpoch epoch(index_epoch_);
+        BlockIndex* indexs = __atomic_load_n(&indexs_, __ATOMIC_ACQUIRE);
+        if (!sealed_ && new_entries >= std::max(kCheckpointMinEntries, indexs->size() / 2)) {
+            need_checkpoint = true;
+        }
+        if (need_checkpoint) {
+            ScopedLocker<MutexLock> lock(publish_lock_);
+            if (published_index_offset_ > checkpoint_index_offset_) {
+                checkpoint.sequence_number = max_sequence_number_;
+                checkpoint.index_offset = published_index_offset_;
+                checkpoint.data_offset = published_data_offset_;
+                checkpoint.num_objects = num_objects_;
+                indexs->Dump(&live_entries);
+                current_max_seq = max_sequence_number_;
+                live_bytes = live_bytes_;
+                dead_bytes = dead_bytes_;
+            } else {
+                need_checkpoint = false;
+            }
+        }
+    }
+
+    if (current_max_seq == synced_sequence_number_ && !need_checkpoint) {
+        __atomic_store_n(&last_sync_time_, NowMicros(), __ATOMIC_RELEASE);
+        return status;
+    }
+
+    // buffered data of published writes should be in data file before syncing
+    status = FlushTail(true);
+    if (status.code() != kOk) {
+        ScopedLocker<MutexLock> lock(sync_wait_lock_);
+        sync_failures_++;
+        last_sync_status_ = status;
+        sync_wait_cond_.SignalAll();
+        return status;
+    }
+
+    // sync data file & index file; they are synced in parallel with async io backend;
+    // file size is flushed by fdatasync too
+    IORequest requests[2];
+    requests[0].opcode = kIOFdatasync;
+    requests[0].fd = data_fd_;
+    requests[1].opcode = kIOFdatasync;
+    requests[1].fd = index_fd_;
+    int64_t results[2];
+    status = io_->SubmitAndWait(requests, 2, results);
+    if (status.code() == kOk && results[0] != 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to sync data file, %s", strerror(-results[0]));
+    }
+    if (status.code() == kOk && results[1] != 0) {
+        status.set_code(kIOError);
+        status.set_msg("failed to sync index file, %s", strerror(-results[1]));
+    }
+    if (status.code() != kOk) {
+        log_->Write(LL_ERROR, "failed to sync with %s", status.ToString().c_str());
+        ScopedLocker<MutexLock> lock(sync_wait_lock_);
+        sync_failures_++;
+        last_sync_status_ = status;
+        sync_wait_cond_.SignalAll();
+        return status;
+    }
+
+    synced_data_offset_ = data_offset;
+    synced_index_offset_ = index_offset;
+    synced_live_bytes_ = live_bytes;
+    synced_dead_bytes_ = dead_bytes;
+    writeback_data_offset_ = std::max(writeback_data_offset_, data_offset);
+    writeback_index_offset_ = std::max(writeback_index_offset_, index_offset);
+    __atomic_store_n(&last_sync_time_, NowMicros(), __ATOMIC_RELEASE);
+    {
+        ScopedLocker<MutexLock> lock(sync_wait_lock_);
+        __atomic_store_n(&synced_sequence_number_, current_max_seq, __ATOMIC_RELEASE);
+        if (current_max_seq > durable_sequence_number_) {
+            __atomic_store_n(&durable_sequence_number_, current_max_seq, __ATOMIC_RELEASE);
+        }
+        sync_wait_cond_.SignalAll();
+    }
+
+    if (need_checkpoint) {
+        // it is only an accelerator of open, failure is not returned
+        Status checkpoint_status = StoreCheckpoint(checkpoint, live_entries);
+        if (checkpoint_status.code() == kOk) {
+            checkpoint_index_offset_ = checkpoint.index_offset;
+        } else {
+            log_->Write(LL_ERROR, "failed to store checkpoint with %s",
+                        checkpoint_status.ToString().c_str());
+        }
+    }
+
+    // persistent manifest; objects are already durable even if it failed, and open
+    // validates objects after the stale synced_sequence_number
+    status = StoreManifest();
+    if (status.code() != kOk) {
+        log_->Write(LL_ERROR, "failed to store manifest with %s", status.ToString().c_str());
+    }
+    return status;
+}
+
+Status EagleBlock::WaitForSync(int64_t sequence_number) {
+    Status status;
+    if (sequence_number > max_sequence_number()) {
+        status.set_code(kInvalidArg);
+        status.set_msg("sequence_number %ld is not written yet, max sequence_number %ld",
+                       sequence_number, max_sequence_number());
+        return status;
+    }
+
+    if (sync_scheduler_ == NULL) {
+        // concurrent callers are serialized by sync_lock_, later ones find their writes
+        // synced by the earlier ones
+        while (synced_sequence_number() < sequence_number) {
+            status = Sync();
+            if (status.code() != kOk && synced_sequence_number() < sequence_number) {
+                return status;
+            }
+        }
+        return Status();
+    }
+
+    ScopedLocker<MutexLock> lock(sync_wait_lock_);
+    int64_t sync_failures = sync_failures_;
+    __sync_add_and_fetch(&sync_waiters_, 1);
+    sync_scheduler_->Notify();
+    while (synced_sequence_number_ < sequence_number && sync_failures_ == sync_failures) {
+        sync_wait_cond_.Wait();
+    }
+    __sync_sub_and_fetch(&sync_waiters_, 1);
+    if (synced_sequence_number_ < sequence_number) {
+        status = last_sync_status_;
+    }
+    return status;
+}
+
+Status EagleBlock::GroupSync(int64_t sequence_number) {
+    Status status;
+    sync_wait_lock_.Lock();
+    while (group_syncing_ && durable_sequence_number_ < sequence_number) {
+        // follower, wait for the leader
+        sync_wait_cond_.Wait();
+        if (failed_sync_sequence_number_ >= sequence_number &&
+                durable_sequence_number_ < sequence_number) {
+            status = last_sync_status_;
+            sync_wait_lock_.Unlock();
+            return status;
+        }
+    }
+    if (durable_sequence_number_ >= sequence_number) {
+        sync_wait_lock_.Unlock();
+        return status;
+    }
+
+    // leader; all writes before target are published, thus written to page cache
+    group_syncing_ = true;
+    int64_t target = max_sequence_number();
+    sync_wait_lock_.Unlock();
+
+    IORequest requests[2];
+    requests[0].opcode = kIOFdatasync;
+    requests[0].fd = data_fd_;
+    requests[1].opcode = kIOFdatasync;
+    requests[1].fd = index_fd_;
+    int64_t results[2];
+    // buffered data up to target is flushed, since it is published
+    status = FlushTail(true);
+    if (status.code() == kOk) {
+        status = io_->SubmitAndWait(requests, 2, results);
+    }
+    if (status.code() == kOk && (results[0] != 0 || results[1] != 0)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to fdatasync %s file, %s", results[0] != 0 ? "data" : "index",
+                       strerror(results[0] != 0 ? -results[0] : -results[1]));
+    }
+
+    if (status.code() != kOk) {
+        // dirty pages maybe dropped by the failed fdatasync, later writes cannot be
+        // promised durable anymore
+        log_->Write(LL_ERROR, "group sync to sequence_number %ld failed with %s", target,
+                    status.ToString().c_str());
+        ScopedLocker<MutexLock> lock(publish_lock_);
+        MarkWriteFailed(target, status);
+    }
+
+    ScopedLocker<MutexLock> lock(sync_wait_lock_);
+    group_syncing_ = false;
+    if (status.code() == kOk) {
+        if (target > durable_sequence_number_) {
+            __atomic_store_n(&durable_sequence_number_, target, __ATOMIC_RELEASE);
+        }
+    } else {
+        sync_failures_++;
+        last_sync_status_ = status;
+        failed_sync_sequence_number_ = target;
+    }
+    sync_wait_cond_.SignalAll();
+    return status;
+}
+
+int64_t EagleBlock::unsynced_bytes() {
+    int64_t data_offset = 0;
+    int64_t index_offset = 0;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        data_offset = data_offset_;
+        index_offset = index_offset_;
+    }
+    ScopedLocker<MutexLock> lock(sync_lock_);
+    return data_offset - synced_data_offset_ + index_offset - synced_index_offset_;
+}
+
+int64_t EagleBlock::unwritten_back_bytes() {
+    int64_t data_offset = 0;
+    int64_t index_offset = 0;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        data_offset = data_offset_;
+        index_offset = index_offset_;
+    }
+    ScopedLocker<MutexLock> lock(sync_lock_);
+    return data_offset - writeback_data_offset_ + index_offset - writeback_index_offset_;
+}
+
+void EagleBlock::StartWriteback() {
+    ScopedLocker<MutexLock> sync_lock(sync_lock_);
+    int64_t data_offset = 0;
+    int64_t index_offset = 0;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        data_offset = data_offset_;
+        index_offset = index_offset_;
+    }
+
+    // only initiate writeback of dirty pages, durability still relies on Sync
+    if (FlushTail(true).code() != kOk) {
+        return;
+    }
     errno = 0;
-    if (0 != fsync(data_fd_)) {
-        log_->Write(LL_ERROR, "failed to sync data file, %m");
+    if (data_offset > writeback_data_offset_ &&
+            0 != sync_file_range(data_fd_, writeback_data_offset_,
+                                 data_offset - writeback_data_offset_, SYNC_FILE_RANGE_WRITE)) {
+        log_->Write(LL_ERROR, "failed to start writeback of data file, %m");
         return;
     }
-
-    // sync index file
     errno = 0;
-    if (0 != fsync(index_fd_)) {
-        log_->Write(LL_ERROR, "failed to sync index file, %m");
+    if (index_offset > writeback_index_offset_ &&
+            0 != sync_file_range(index_fd_, writeback_index_offset_,
+                                 index_offset - writeback_index_offset_,
+                                 SYNC_FILE_RANGE_WRITE)) {
+        log_->Write(LL_ERROR, "failed to start writeback of index file, %m");
         return;
     }
+    writeback_data_offset_ = data_offset;
+    writeback_index_offset_ = index_offset;
+}
+
+Status EagleBlock::Seal() {
+    Status status;
+    BlockStatus old_status = kNormal;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        if (status_ != kNormal && status_ != kFull) {
+            status.set_code(kInternalError);
+            status.set_msg("block status %d, it cannot be sealed", status_);
+            return status;
+        }
+        if (compacting_) {
+            // the sealed table would be lost, since new files are written by the compaction
+            status.set_code(kInternalError);
+            status.set_msg("block is being compacted, it cannot be sealed");
+            return status;
+        }
+        if (sealed()) {
+            return status;
+        }
+        old_status = status_;
+        SetStatus(kFull);
+    }
+    // writes reserved before status changed should be in mem indexes before they are dumped,
+    // and they are synced before the sealed table refers to them
+    WaitForPendingWrites();
+    status = SyncInternal(false);
 
-    synced_sequence_number_ = current_max_seq;
-    // persistent manifest
-    Status status = StoreManifest();
+    ScopedLocker<MutexLock> sync_lock(sync_lock_);
+    if (status.code() == kOk && sealed_) {
+        return status;
+    }
+    int64_t table_offset = 0;
+    int64_t table_index_offset = 0;
+    {
+        // nothing is reserved after status changed
+        ScopedLocker<MutexLock> lock(write_lock_);
+        table_offset = data_offset_;
+        table_index_offset = index_offset_;
+    }
+    std::vector<IndexEntry> entries;
+    SealedIndex* sealed_index = NULL;
+    bool table_written = false;
+    if (status.code() == kOk) {
+        indexs_->Dump(&entries);
+        sealed_index = new SealedIndex();
+        // entries are sorted by object id as well, as the sealed table requires
+        sealed_index->Build(&entries);
+        status = WriteSealedTable(entries);
+        table_written = true;
+    }
+    if (status.code() == kOk) {
+        // the block is sealed once manifest records the table
+        table_offset_ = table_offset;
+        table_index_offset_ = table_index_offset;
+        status = StoreManifest();
+        if (status.code() != kOk) {
+            table_offset_ = -1;
+            table_index_offset_ = -1;
+        }
+    }
     if (status.code() != kOk) {
-        log_->Write(LL_ERROR, "failed to store manifest with %s", status.ToString().c_str());
+        log_->Write(LL_ERROR, "failed to seal block with %s", status.ToString().c_str());
+        delete sealed_index;
+        BlockStatus restored_status = old_status;
+        if (table_written) {
+            // new puts would land on the table
+            Status drop_status = DropSealedTable(table_offset);
+            if (drop_status.code() != kOk) {
+                log_->Write(LL_ERROR, "failed to drop sealed table with %s, block is read only",
+                            drop_status.ToString().c_str());
+                restored_status = kReadOnly;
+            }
+        }
+        {
+            // a failed flush of tail buffer may make it read only meanwhile, see MarkWriteFailed
+            ScopedLocker<MutexLock> lock(write_lock_);
+            ScopedLocker<MutexLock> publish_lock(publish_lock_);
+            if (status_ == kFull) {
+                SetStatus(restored_status);
+            }
+        }
+        return status;
     }
+
+    BlockIndex* old_indexs = indexs_;
+    __atomic_store_n(&indexs_, (BlockIndex*)sealed_index, __ATOMIC_RELEASE);
+    __atomic_store_n(&sealed_, true, __ATOMIC_RELEASE);
+    // readers maybe still on old indexes
+    index_epoch_.Synchronize();
+    delete old_indexs;
+
+    log_->Write(LL_NOTICE, "block sealed, %ld objects, mem indexes use %ld bytes",
+                (int64_t)entries.size(), sealed_index->memory_usage());
+    return status;
 }
 
 Status EagleBlock::Compact(int64_t end_sequence_number, EagleBlock** new_block) {
-    // set block status; preventing new put & delete
-    BlockStatus old_status = GetStatus();
-    SetStatus(kCompacting);
-
+    // objects are copied while puts & deletes go on in old files
+    Status status;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        if (compacting_) {
+            status.set_code(kInternalError);
+            status.set_msg("block is being compacted");
+            return status;
+        }
+        if (status_ != kNormal && status_ != kFull) {
+            status.set_code(kInternalError);
+            status.set_msg("block status %d, it cannot be compacted", status_);
+            return status;
+        }
+        if (status_ == kFull && !sealed()) {
+            status.set_code(kInternalError);
+            status.set_msg("block is being sealed, it cannot be compacted");
+            return status;
+        }
+        __atomic_store_n(&compacting_, true, __ATOMIC_RELEASE);
+    }
     log_->Write(LL_NOTICE, "start to compact");
     BlockCompact block_compact(this, log_);
-    Status status = block_compact.Run(end_sequence_number);
+    status = block_compact.Copy(end_sequence_number);
+    if (status.code() != kOk) {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        __atomic_store_n(&compacting_, false, __ATOMIC_RELEASE);
+        log_->Write(LL_NOTICE, "finish compact %s", status.ToString().c_str());
+        return status;
+    }
+
+    // set block status; preventing new put & delete
+    BlockStatus old_status = kNormal;
+    {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        old_status = status_;
+        SetStatus(kCompacting);
+    }
+    // writes reserved before status changed should be published before copying the rest,
+    // and be in data file
+    WaitForPendingWrites();
+    status = block_compact.Finish();
     if (status.code() == kOk) {
         // open new block
-        status = OpenBlock(root_dir_, new_block);
+        status = OpenBlock(root_dir_, options_, new_block);
+    }
+    if (status.code() == kOk && options_.object_cache != NULL) {
+        // the new block has its own cache id
+        options_.object_cache->EraseBlock(cache_id_);
     }
 
     if (status.code() != kOk) {
-        // reset block status
-        SetStatus(old_status);
+        // reset block status, unless a failed write made it read only meanwhile
+        ScopedLocker<MutexLock> lock(write_lock_);
+        ScopedLocker<MutexLock> publish_lock(publish_lock_);
+        if (status_ == kCompacting) {
+            SetStatus(old_status);
+        }
+        __atomic_store_n(&compacting_, false, __ATOMIC_RELEASE);
     }
     log_->Write(LL_NOTICE, "finish compact %s", status.ToString().c_str());
     return status;
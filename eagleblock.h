@@ -11,9 +11,19 @@
 #define _EAGLEFS_EAGLEBLOCK_H_
 
 #include <unistd.h>
+#include <map>
+#include <set>
+#include <vector>
 #include "eagleengine/common.h"
+#include "eagleengine/slice.h"
+#include "eagleengine/options.h"
+#include "eagleengine/async_io.h"
+#include "eagleengine/sync_scheduler.h"
 #include "eagleengine/status.h"
-#include "eagleengine/hash_table.h"
+#include "eagleengine/block_index.h"
+#include "eagleengine/tail_buffer.h"
+#include "eagleengine/concurrent/cond_var.h"
+#include "eagleengine/concurrent/epoch.h"
 #include "eagleengine/log/log.h"
 
 namespace eagleengine {
@@ -23,31 +33,53 @@ static const char* const kCurrentFile = "current";
 static const char* const kDataFile = "dat";
 static const char* const kIndexFile = "idx";
 static const char* const kManifestFile = "manifest";
+static const char* const kCheckpointFile = "checkpoint";
 static const uint64_t kMagicNumber = 0x7e7e7e7e7e7e7e7eul;
 static const int kManifestSizeLimit = 1024;
+// MultiGet merges objects whose distance is no more than kMultiGetMaxGap into one read,
+// and a merged read is no larger than kMultiGetMaxReadSize unless it holds only one object
+static const int kMultiGetMaxGap = 64 * 1024;
+static const int kMultiGetMaxReadSize = 4 * 1024 * 1024;
+// index file is read by chunks of kIndexReadBufferSize bytes when a block is opened
+static const int kIndexReadBufferSize = 4 * 1024 * 1024;
+// unsynced objects are validated by at most kValidateThreadNum threads when a block is
+// opened, one thread for every kValidateEntriesPerThread entries
+static const int kValidateThreadNum = 8;
+static const int kValidateEntriesPerThread = 64;
+// Sync writes a checkpoint once index file has grown by so many entries since the last one,
+// and by at least half of live objects; thus the cost of checkpoints is amortized by writes
+static const int64_t kCheckpointMinEntries = 64 * 1024;
 
-struct IndexEntry {
-    int64_t sequence_number;
+struct ObjectHeader {
+    uint64_t magic;
     int64_t object_id;
-    int64_t offset;
     int size;
+    uint32_t crc;
+    // ChecksumType of crc, zero in blocks written before crc32c was used
+    uint8_t checksum_type;
+    char reserved[7];
 
-    IndexEntry() : sequence_number(-1), object_id(-1), offset(0), size(0) {
-    }
-
-    int64_t key() const {
-        return object_id;
+    ObjectHeader() : magic(kMagicNumber), object_id(-1), size(0), crc(0), checksum_type(0) {
+        memset(reserved, 0, sizeof(reserved));
     }
 };
 
-struct ObjectHeader {
-    uint64_t magic;
-    int64_t object_id;
-    int size;
+// checkpoint file is a header followed by num_entries live index entries; crc covers
+// the entries
+struct CheckpointHeader {
+    int64_t magic_number;
+    // all index entries up to sequence_number are in checkpoint, they end at index_offset
+    // of index file
+    int64_t sequence_number;
+    int64_t index_offset;
+    int64_t data_offset;
+    int64_t num_objects;
+    int64_t num_entries;
     uint32_t crc;
-    char reserved[8];
+    char reserved[12];
 
-    ObjectHeader() : magic(kMagicNumber), object_id(-1), size(0), crc(0) {
+    CheckpointHeader() : magic_number(kMagicNumber), sequence_number(-1), index_offset(0),
+                         data_offset(0), num_objects(0), num_entries(0), crc(0) {
         memset(reserved, 0, sizeof(reserved));
     }
 };
@@ -56,38 +88,127 @@ struct Manifest {
     int64_t max_block_size;
     int64_t synced_sequence_number;
     int64_t magic_number;
-    Manifest() : max_block_size(0), synced_sequence_number(-1), magic_number(kMagicNumber) {
+    // fields below are appended later, a manifest of kManifestV1Size bytes has none of them;
+    // bytes of live & deleted objects with their headers up to synced_sequence_number, -1 if
+    // unknown
+    int64_t live_bytes;
+    int64_t dead_bytes;
+    // fields below are appended later too, a manifest of kManifestV2Size bytes has none of
+    // them; offset of the sealed table in data file, -1 if the block is not sealed; the footer
+    // at the end of data file is only trusted if it matches, since the bytes before it are
+    // written by clients
+    int64_t table_offset;
+    // size of index file when the table was written
+    int64_t table_index_offset;
+    Manifest() : max_block_size(0), synced_sequence_number(-1), magic_number(kMagicNumber),
+                 live_bytes(-1), dead_bytes(-1), table_offset(-1), table_index_offset(-1) {
     }
 };
+// size of manifest written before live_bytes & dead_bytes were added
+static const int kManifestV1Size = 3 * sizeof(int64_t);
+// size of manifest written before table_offset & table_index_offset were added
+static const int kManifestV2Size = 5 * sizeof(int64_t);
+
 
+// callback of async object operations; value is object id for put, object size for get
+typedef void (*ObjectCallback)(void* arg, const Status& status, int64_t value);
+
+struct AsyncPutContext;
+class SealedTable;
+struct SealedFooter;
 
 // Note:
-// 1. PutObject, DeleteObject , are not thread safe; those func should be called serialized;
-//    GetObject also is not thread safee, but it canbe called with PutObject & DeleteObject
-//    concurrently;
+// 1. PutObject, PutObjects, DeleteObject are thread safe; writers reserve sequence numbers
+//    and file space under a short lock, write in parallel, and publish to mem indexes in
+//    sequence order; GetObject reads into caller owned memory, it canbe called from any
+//    number of threads, concurrently with PutObject & DeleteObject;
 // 2. Sync() should be called periodically ; thus objects and indexes canbe flushed to disk
-//    permanently
+//    permanently; or add the block to a SyncScheduler, which syncs it in background
+//    writes with WriteOptions::sync are durable once returned, without rewriting manifest
+// 3. async funcs submit io through the AsyncIO set by set_async_io(), and return once
+//    submitted; callback is invoked on completion; all async operations should be completed
+//    before the block is deleted
 //
 class EagleBlock {
 public:
     virtual ~EagleBlock();
     Status PutObject(const std::string& content, int64_t* object_id);
+    Status PutObject(const WriteOptions& options, const std::string& content,
+                     int64_t* object_id);
+    // put a batch of objects; headers and contents of the whole batch are written to data
+    // file with one pwritev, and their indexes are appended to index file with one write;
+    // ids are returned in the same order with contents
+    Status PutObjects(const std::vector<Slice>& contents, std::vector<int64_t>* ids);
+    Status PutObjects(const WriteOptions& options, const std::vector<Slice>& contents,
+                      std::vector<int64_t>* ids);
     Status DeleteObject(int64_t object_id);
+    Status DeleteObject(const WriteOptions& options, int64_t object_id);
+    // objects are looked up in BlockOptions::object_cache first if there is one, and added to
+    // it once read from data file
     Status GetObject(int64_t object_id, std::string* result);
+    Status GetObject(const ReadOptions& options, int64_t object_id, std::string* result);
+    // read object into buf directly; *size is set to object size, if buf_len is less
+    // than it, kInvalidArg is returned and nothing is read
+    Status GetObject(int64_t object_id, char* buf, int buf_len, int* size);
+    Status GetObject(const ReadOptions& options, int64_t object_id, char* buf, int buf_len,
+                     int* size);
+    // get a batch of objects; ids are resolved under one lock, and objects close to each
+    // other in data file are read together with one preadv; results & statuses are in the
+    // same order with object_ids, the returned status is not ok if any read failed
+    Status MultiGet(const std::vector<int64_t>& object_ids, std::vector<std::string>* results,
+                    std::vector<Status>* statuses);
+
+    // content should be kept until callback is invoked; the put is visible to readers when
+    // callback is invoked, in sequence order with other writes; callback is not invoked if
+    // an error is returned, a put which fails once its sequence number is reserved is
+    // reported by callback
+    Status AsyncPutObject(const Slice& content, ObjectCallback callback, void* arg);
+    // buf should be kept until callback is invoked, callback is not invoked if an error is
+    // returned
+    Status AsyncGetObject(int64_t object_id, char* buf, int buf_len, ObjectCallback callback,
+                          void* arg);
 
-    // should call this func periodically
-    // this func fsync data&index to disk
-    void Sync();
+    // should call this func periodically if the block is not added to a SyncScheduler
+    // this func fdatasync data&index to disk; it canbe called concurrently with writers
+    Status Sync();
+    // wait until all writes up to sequence_number are synced; the sync scheduler of the
+    // block is woken up if there is one, otherwise the block is synced in caller thread
+    Status WaitForSync(int64_t sequence_number);
+    // sync and write a checkpoint of mem indexes, then open only replays index entries
+    // after it; Sync writes checkpoints too when index file has grown enough
+    Status Checkpoint();
+    // start writeback of unsynced data & indexes without waiting for it
+    void StartWriteback();
 
     // when there is lots of deleted objects in this block, should call this func to
-    // recycle space; when this func is called, the block's status will be set as kCompacting,
-    // and putobject & deleteobject will return error
+    // recycle space; live objects are copied to new files while putobject & deleteobject go
+    // on, see blockcompact.h; then the block's status will be set as kCompacting, and
+    // putobject & deleteobject will return error, while the last few writes are copied and
+    // the new block is opened; the old block keeps kCompacting if this func succeeded;
+    // only one compaction runs on a block at a time, and it is not sealed meanwhile
     //
     // end_sequence_number: compact all deleted objects whose object id doesn't larger than it;
     // value of end_sequence_number cannot larger than synced_sequence_number;
     // after calling this func; the old EagleBlock object should be deleted ASAP;
+    // blocks worth compacting are picked by live_bytes() & dead_bytes(), see
+    // compaction_policy.h
     Status Compact(int64_t end_sequence_number, EagleBlock** new_block);
 
+    // seal a full block: its status is set as kFull so that puts are rejected, and mem
+    // indexes are replaced by a compressed SealedIndex; a table of index entries sorted by
+    // object id is appended to data file and recorded by manifest, so that a reopened block
+    // is still sealed and only deletes after the table are replayed from index file, see
+    // sealed_table.h; deletes are accepted once the block is sealed
+    Status Seal();
+    bool sealed() {
+        return __atomic_load_n(&sealed_, __ATOMIC_ACQUIRE);
+    }
+    // true from the start of Compact, even while objects are copied and the status is still
+    // kNormal or kFull; it is cleared only if the compaction failed
+    bool compacting() {
+        return __atomic_load_n(&compacting_, __ATOMIC_ACQUIRE);
+    }
+
     void SetStatus(BlockStatus status) {
         status_ = status;
     }
@@ -95,19 +216,52 @@ public:
         return status_;
     }
     bool IsNormal() { return status_ == kNormal; }
+    // a sealed block still accepts deletes, but not while it is being sealed
+    bool AcceptDeletes() { return status_ == kNormal || (status_ == kFull && sealed()); }
+
+    // io backend used by async funcs, Sync & Compact; it is usually shared by all blocks
+    // on one disk and not owned by the block; synchronous backend is used by default
+    void set_async_io(AsyncIO* io) {
+        io_ = io;
+    }
 
     int64_t max_sequence_number() {
-        return max_sequence_number_;
+        return __atomic_load_n(&max_sequence_number_, __ATOMIC_ACQUIRE);
     }
     int64_t synced_sequence_number() {
-        return synced_sequence_number_;
+        return __atomic_load_n(&synced_sequence_number_, __ATOMIC_ACQUIRE);
+    }
+    // bytes of data & index files which are written after last sync
+    int64_t unsynced_bytes();
+    // bytes of data & index files which are written after last sync or writeback
+    int64_t unwritten_back_bytes();
+    // monotonic time in microseconds
+    int64_t last_sync_time() {
+        return __atomic_load_n(&last_sync_time_, __ATOMIC_ACQUIRE);
+    }
+    // all writes up to it are durable, but maybe not recorded in manifest yet
+    int64_t durable_sequence_number() {
+        return __atomic_load_n(&durable_sequence_number_, __ATOMIC_ACQUIRE);
+    }
+    int sync_waiters() {
+        return __atomic_load_n(&sync_waiters_, __ATOMIC_ACQUIRE);
     }
 
     int64_t num_objects() {
         return num_objects_;
     }
     int64_t deleted_num_objects() {
-        return num_objects_ - indexs_->size();
+        ScopedEpoch epoch(index_epoch_);
+        return num_objects_ - __atomic_load_n(&indexs_, __ATOMIC_ACQUIRE)->size();
+    }
+    // bytes of live objects with their headers, which are copied by Compact
+    int64_t live_bytes() {
+        return __atomic_load_n(&live_bytes_, __ATOMIC_ACQUIRE);
+    }
+    // bytes of data file reclaimed by Compact: deleted objects with their headers, and
+    // holes left by failed writes once the block is reopened
+    int64_t dead_bytes() {
+        return __atomic_load_n(&dead_bytes_, __ATOMIC_ACQUIRE);
     }
 
     std::string current_subdir() {
@@ -122,14 +276,82 @@ public:
 
 
     static Status OpenBlock(const std::string& folder, EagleBlock** result);
+    static Status OpenBlock(const std::string& folder, const BlockOptions& options,
+                            EagleBlock** result);
     static Status CreateBlock(const std::string& folder, EagleBlock** result,
                               int64_t max_block_size = kDefaultMaxBlockSize);
+    static Status CreateBlock(const std::string& folder, const BlockOptions& options,
+                              EagleBlock** result,
+                              int64_t max_block_size = kDefaultMaxBlockSize);
 private:
     friend class BlockCompact;
-    EagleBlock();
-    Status ValidateObject(const IndexEntry& entry);
+    friend class SyncScheduler;
+    explicit EagleBlock(const BlockOptions& options);
+    // look up mem indexes, safe against Seal replacing them
+    bool GetIndexEntry(int64_t object_id, IndexEntry* entry);
+    // add an object read from data file to object cache
+    void CacheObject(int64_t object_id, const Slice& content);
+    // read object of entry from data file into buf, and verify it if options tell so;
+    // kDataCorrupted is returned if its header or crc doesn't match
+    Status ReadObjectData(const ReadOptions& options, const IndexEntry& entry, char* buf);
+    // buf is enlarged if it cannot hold the object
+    Status ValidateObject(const IndexEntry& entry, std::string* buf);
+    // validate entries[positions[i]] in parallel, their results are set to statuses
+    // at the same position; entries after a failed one maybe not validated
+    void ValidateEntries(const IndexEntry* entries, const std::vector<int>& positions,
+                         std::vector<Status>* statuses);
+    static void* ValidateThread(void* arg);
+    Status TruncateTail();
+
+    // following funcs are related with concurrent writers
+    // buffered is set if data should be copied into tail buffer rather than written to data
+    // file, it can be NULL if data_size is 0
+    Status ReserveSpace(int64_t data_size, int num_entries, int64_t* first_seq,
+                        int64_t* data_offset, int64_t* index_offset, bool* buffered);
+    Status WriteData(struct iovec* iov, int iovcnt, int64_t offset, bool buffered);
+    // flush tail buffer up to published data & index entries, if it is large enough or force
+    // is set
+    Status FlushTail(bool force);
+    // flush tail buffer if data before end is not in data file, for reads from data file
+    Status FlushTailBefore(int64_t end);
+    // wait until all sequence numbers before first_seq are published, with publish_lock_ held
+    void BeginPublish(int64_t first_seq);
+    void EndPublish(int64_t last_seq, const Status& status);
+    void MarkWriteFailed(int64_t seq, const Status& status);
+    void WaitForPendingWrites();
+    // caller should hold publish_lock_; with a tail buffer, entries of the write are appended
+    // to it rather than written by the writer, see tail_buffer.h
+    void SetPublished(int64_t seq, int64_t index_end, int64_t data_end,
+                      const IndexEntry* entries, int num_entries);
+    // make writes up to sequence_number durable, merged with concurrent callers: the first
+    // one becomes leader and fdatasyncs for all published writes, others wait for it
+    Status GroupSync(int64_t sequence_number);
+
+    // following funcs are related with async puts
+    static void OnAsyncPutDataWritten(void* arg, int64_t res);
+    static void OnAsyncPutIndexWritten(void* arg, int64_t res);
+    static void OnAsyncPutWritten(AsyncPutContext* context, int64_t res, int64_t expect_size,
+                                  const char* file);
+    void PublishAsyncPut(AsyncPutContext* context);
+    void ApplyAsyncPut(AsyncPutContext* context);
+    void DrainPendingPutsAndUnlock();
     Status Create(const std::string& folder, int64_t max_block_size);
     Status Open(const std::string& folder);
+    // load the table recorded by manifest from data file, it fails if the footer at the end
+    // of data file is not the one recorded; see OpenSealed for accounted_sequence_number
+    Status OpenSealedTable(int64_t* accounted_sequence_number);
+    // take over the table loaded from data file of a sealed block; return the sequence number
+    // which live_bytes_ is counted at
+    int64_t OpenSealed(SealedTable* table, const SealedFooter& footer);
+    // apply deletes written to index file after the table, deletes after
+    // accounted_sequence_number are accounted as dead bytes; the unsynced tail after the first
+    // invalid entry is dropped from index file
+    Status ReplaySealedDeletes(int64_t accounted_sequence_number);
+    // write entries sorted by object id and a footer after objects, and sync them
+    Status WriteSealedTable(const std::vector<IndexEntry>& entries);
+    // truncate data file at table_offset after a failed Seal, so that the table is not left
+    // behind objects put later
+    Status DropSealedTable(int64_t table_offset);
     Status Init(const std::string& folder, int64_t max_block_size, bool exist);
 
     std::string GetBlockRootDir(const std::string& subdir);
@@ -138,7 +360,19 @@ private:
 
     static Status StoreManifestEx(const Manifest& manifest, const std::string& manifest_file);
     Status StoreManifest();
+    // a manifest of kManifestV1Size bytes is read with live_bytes & dead_bytes of -1, and
+    // one of kManifestV1Size or kManifestV2Size bytes is read as not sealed
     Status GetManifest(Manifest* manifest);
+    // add a published put of bytes with headers, or a published delete of entry; caller
+    // should hold publish_lock_
+    void AddLiveBytes(int64_t bytes);
+    void AddDeadEntry(const IndexEntry& entry);
+
+    Status SyncInternal(bool force_checkpoint);
+    Status StoreCheckpoint(const CheckpointHeader& header,
+                           const std::vector<IndexEntry>& entries);
+    // load checkpoint if there is a valid one; an invalid checkpoint is ignored
+    Status LoadCheckpoint(int64_t index_file_size);
 
     Status GetCurrentSubdir(std::string* result);
 private:
@@ -150,18 +384,98 @@ private:
     int index_fd_;
 
     volatile BlockStatus status_;
+    // max published sequence number, all writes before it are visible
     volatile int64_t max_sequence_number_;
     volatile int64_t synced_sequence_number_;
+
+    // protect last_sequence_number_, data_offset_ & index_offset_, which are reserved
+    // but maybe not written yet
+    MutexLock write_lock_;
+    int64_t last_sequence_number_;
     int64_t data_offset_;
     int64_t index_offset_;
-    HashTable<IndexEntry>* indexs_;
-    char* internal_buf_;
+    // ids of objects whose deletes are reserved but not published yet, protected by
+    // write_lock_ too
+    std::set<int64_t> deleting_ids_;
+
+    // writes are published in sequence order
+    MutexLock publish_lock_;
+    CondVar publish_cond_;
+    int64_t publish_sequence_number_;
+    bool write_failed_;
+    // end of index & data of the writes up to max_sequence_number_
+    int64_t published_index_offset_;
+    int64_t published_data_offset_;
+    // async puts which are written but waiting for earlier writes to be published
+    std::map<int64_t, AsyncPutContext*> pending_puts_;
+    AsyncIO* io_;
+
+    // serialize Sync & StartWriteback; protect synced_*_offset_, writeback_*_offset_ &
+    // checkpoint_index_offset_
+    MutexLock sync_lock_;
+    int64_t synced_data_offset_;
+    int64_t synced_index_offset_;
+    int64_t writeback_data_offset_;
+    int64_t writeback_index_offset_;
+    volatile int64_t last_sync_time_;
+    int64_t checkpoint_index_offset_;
+    // live_bytes_ & dead_bytes_ at synced_sequence_number_, stored in manifest
+    int64_t synced_live_bytes_;
+    int64_t synced_dead_bytes_;
+    // waiters of WaitForSync; sync_failures_ is increased once a sync failed, so that
+    // waiters return the error rather than waiting forever
+    MutexLock sync_wait_lock_;
+    CondVar sync_wait_cond_;
+    volatile int sync_waiters_;
+    int64_t sync_failures_;
+    Status last_sync_status_;
+    // following are related with group sync, protected by sync_wait_lock_ too
+    volatile int64_t durable_sequence_number_;
+    bool group_syncing_;
+    // sequence number synced by the last failed group sync
+    int64_t failed_sync_sequence_number_;
+    SyncScheduler* sync_scheduler_;
+
+    BlockOptions options_;
+    // key of objects of this block in options_.object_cache
+    uint64_t cache_id_;
+    // NULL if options_.tail_buffer_size is 0
+    TailBuffer* tail_buffer_;
+    // readers of indexs_ should be in a read section of index_epoch_, since it is replaced
+    // by Seal; writers need not, Seal waits for pending writes
+    BlockIndex* indexs_;
+    Epoch index_epoch_;
+    bool sealed_;
+    // record of the sealed table stored in manifest, see Manifest; protected by sync_lock_
+    int64_t table_offset_;
+    int64_t table_index_offset_;
+    // set & cleared with write_lock_ held, see compacting()
+    bool compacting_;
 
     int64_t num_objects_;
+    // updated with publish_lock_ held, and read without it; they are rebuilt by replaying
+    // indexes on open, or taken from manifest for a sealed block
+    volatile int64_t live_bytes_;
+    volatile int64_t dead_bytes_;
 
     Log* log_;
 };
 
+struct AsyncPutContext {
+    EagleBlock* block;
+    ObjectHeader header;
+    IndexEntry entry;
+    int64_t index_offset;
+    // header, content & index entry
+    struct iovec iovs[3];
+    int pending_writes;
+    // set by the first failed write, which alone sets status
+    int failed;
+    Status status;
+    ObjectCallback callback;
+    void* arg;
+};
+
 }
 
 #endif  //_EAGLEFS_EAGLEBLOCK_H_
@@ -12,7 +12,9 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <algorithm>
 #include <vector>
+#include "eagleengine/concurrent/epoch.h"
 #include "eagleengine/concurrent/scoped_locker.h"
 
 namespace eagleengine {
@@ -27,19 +29,53 @@ struct HashNode {
     }
 };
 
+template <typename T>
+struct HashSlots {
+    int slot_num;
+    HashNode<T>** heads;
+    // slots being migrated to these ones, NULL if not resizing
+    HashSlots* old;
+    // number of slots migrated to the new slots, set on old slots only
+    int migrated;
+
+    explicit HashSlots(int num) : slot_num(num), old(NULL), migrated(0) {
+        heads = new HashNode<T>*[slot_num];
+        memset(heads, 0, sizeof(heads[0]) * slot_num);
+    }
+
+    ~HashSlots() {
+        delete[] heads;
+    }
+};
+
 static const int kDefaultPoolSize = 1024;
+// the table starts to grow once it has more values than kMaxLoadFactor * slots, and to
+// shrink once it has less than slots / kMinLoadDivisor values; kMigrateSlotsPerOp slots are
+// migrated to the new slots by every write until resizing is done
+static const int kMaxLoadFactor = 2;
+static const int kMinLoadDivisor = 8;
+static const int kMigrateSlotsPerOp = 8;
+static const int kMaxSlotNum = 1 << 30;
 
+// Note:
+// 1. slot_num given to constructor is the initial & minimum number of slots; the table is
+//    resized incrementally by writes: while resizing, slots of the old slots before migrated
+//    have been copied to the new slots, so a key is looked up in the old slots if its old
+//    slot is not migrated yet, otherwise in the new slots;
+// 2. chains are sorted by key;
+// 3. writers are serialized by a mutex; readers take no lock: nodes & slots are published
+//    with release stores, and those unlinked by writers are retired, then reused or freed
+//    only after all readers which may see them are gone, see Epoch;
+//
 template <typename T>
 class HashTable {
 public:
     HashTable(int slot_num) {
         if (slot_num <= 0) {
-            slot_num_ = 9973;
-        } else {
-            slot_num_ = slot_num;
+            slot_num = 9973;
         }
-        slots_ = new HashNode<T>*[slot_num_];
-        memset(slots_, 0, sizeof(slots_[0]) * slot_num_);
+        min_slot_num_ = slot_num;
+        slots_ = new HashSlots<T>(slot_num);
 
         size_ = 0;
         pool_head_ = NULL;
@@ -52,120 +88,372 @@ public:
         for (; it != lists_.end(); ++it) {
             delete[] (*it);
         }
-        delete[] slots_;
+        for (size_t i = 0; i < retired_slots_.size(); ++i) {
+            delete retired_slots_[i];
+        }
+        delete slots_->old;
+        delete slots_;
     }
 
     bool Insert(const T& new_value, T* old_value) {
-        ScopedWriteLocker lock(lock_);
-        int64_t key = new_value.key();
-        int slot = (key < 0 ? -key : key) % slot_num_;
-        HashNode<T>* current_node = slots_[slot];
-        HashNode<T>* pre_node = NULL;
-        while (current_node != NULL) {
-            if ((current_node->value).key() == key) {
-                *old_value = current_node->value;
-                return false;
-            }
+        ScopedLocker<MutexLock> lock(write_lock_);
+        return InsertInternal(new_value, old_value);
+    }
 
-            if ((current_node->value).key() > key) {
-                break;
+    // insert all values under one write lock; stop at the first duplicated key
+    // and return its index, or -1 if every value is inserted
+    int InsertBatch(const std::vector<T>& new_values, T* old_value) {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        int num = (int)new_values.size();
+        for (int i = 0; i < num; ++i) {
+            if (!InsertInternal(new_values[i], old_value)) {
+                return i;
             }
+        }
+        return -1;
+    }
 
-            pre_node = current_node;
-            current_node = current_node->next;
+    // insert lots of values in one pass, eg. when loading a block: values are sorted by key
+    // in place, nodes are allocated at once, and each chain is walked at most once to merge
+    // values into it; stop at the first duplicated key and return its index in sorted values,
+    // or -1 if every value is inserted
+    int BulkInsert(std::vector<T>* values, T* old_value) {
+        if (!std::is_sorted(values->begin(), values->end(), KeyLess)) {
+            std::sort(values->begin(), values->end(), KeyLess);
         }
 
-        // no duplicate value, try to all a new one
-        if (pool_size_ <= 0) {
-            HashNode<T>* new_pool = new HashNode<T>[kDefaultPoolSize];
-            lists_.push_back(new_pool);
-            pool_size_ += kDefaultPoolSize;
-
-            // add new memory to pool
-            for (int i = 0; i < kDefaultPoolSize; ++i) {
-                (new_pool[i]).next = pool_head_;
-                pool_head_ = new_pool + i;
-            }
+        ScopedLocker<MutexLock> lock(write_lock_);
+        int num = (int)values->size();
+        // grow to the final size at once, and finish resizing so that values go to slots_
+        Migrate(kMaxSlotNum);
+        if (size_ + num > (int64_t)slots_->slot_num * kMaxLoadFactor) {
+            StartResize(SlotNumFor(size_ + num));
+            Migrate(kMaxSlotNum);
+        }
+        if (pool_size_ < num) {
+            Reclaim();
+        }
+        if (pool_size_ < num) {
+            AllocatePool(num - pool_size_);
         }
 
-        // get a node for new value
-        HashNode<T>* new_node = pool_head_;
-        pool_head_ = pool_head_->next;
-        new_node->next = current_node;
-        new_node->value = new_value;
-        pool_size_--;
+        // last node inserted into each slot; later values are larger, so the walk of
+        // a chain goes on from it
+        HashSlots<T>* slots = slots_;
+        std::vector<HashNode<T>*> last_nodes(slots->slot_num, NULL);
+        for (int i = 0; i < num; ++i) {
+            const T& new_value = (*values)[i];
+            int64_t key = new_value.key();
+            int slot = Slot(key, slots->slot_num);
+            HashNode<T>* pre_node = last_nodes[slot];
+            HashNode<T>** link = pre_node == NULL ? slots->heads + slot : &(pre_node->next);
+            HashNode<T>* current_node = *link;
+            while (current_node != NULL && (current_node->value).key() < key) {
+                pre_node = current_node;
+                link = &(current_node->next);
+                current_node = current_node->next;
+            }
+            if (current_node != NULL && (current_node->value).key() == key) {
+                *old_value = current_node->value;
+                return i;
+            }
 
-        if (pre_node == NULL) {
-            slots_[slot] = new_node;
-        } else {
-            pre_node->next = new_node;
+            HashNode<T>* new_node = AllocNode();
+            new_node->next = current_node;
+            new_node->value = new_value;
+            Publish(link, new_node);
+            last_nodes[slot] = new_node;
+            AddSize(1);
         }
-        size_++;
-
-        return true;
+        return -1;
     }
 
     bool Get(int64_t key, T* value) {
-        ScopedReadLocker lock(lock_);
-        int slot = (key < 0 ? -key : key) % slot_num_;
-        HashNode<T>* current_node = slots_[slot];
+        ScopedEpoch epoch(epoch_);
+        HashNode<T>* current_node = Load(Bucket(key));
         while (current_node != NULL) {
             if ((current_node->value).key() == key) {
                 *value = current_node->value;
                 return true;
             }
 
-            current_node = current_node->next;
+            current_node = Load(&(current_node->next));
         }
 
         return false;
     }
 
-    void Delete(int64_t key) {
-        ScopedWriteLocker lock(lock_);
-        int slot = (key < 0 ? -key : key) % slot_num_;
-        HashNode<T>* current_node = slots_[slot];
-        if (current_node == NULL) {
-            return;
+    // look up all keys in one read section; return the number of keys found
+    int GetBatch(const std::vector<int64_t>& keys, std::vector<T>* values,
+                 std::vector<bool>* found) {
+        ScopedEpoch epoch(epoch_);
+        int num = (int)keys.size();
+        int found_num = 0;
+        values->resize(num);
+        found->assign(num, false);
+        for (int i = 0; i < num; ++i) {
+            int64_t key = keys[i];
+            HashNode<T>* current_node = Load(Bucket(key));
+            while (current_node != NULL) {
+                if ((current_node->value).key() == key) {
+                    (*values)[i] = current_node->value;
+                    (*found)[i] = true;
+                    found_num++;
+                    break;
+                }
+
+                current_node = Load(&(current_node->next));
+            }
         }
 
-        HashNode<T>* pre_node = NULL;
+        return found_num;
+    }
+
+    void Delete(int64_t key) {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        HashNode<T>** link = Bucket(key);
+        HashNode<T>* current_node = *link;
         while (current_node != NULL) {
             int64_t tmp_key = (current_node->value).key();
             if (tmp_key == key) {
-                if (pre_node == NULL) {
-                    // target node is head
-                    slots_[slot] = current_node->next;
-                } else {
-                    pre_node->next = current_node->next;
-                }
-                current_node->next = pool_head_;
-                pool_head_ = current_node;
-                pool_size_++;
-                size_--;
+                // readers on the node can still go on to its next node
+                Publish(link, current_node->next);
+                retired_nodes_.push_back(current_node);
+                AddSize(-1);
+                AfterWrite();
                 return;
             } else if (tmp_key > key) {
                 break;
             }
 
-            pre_node = current_node;
+            link = &(current_node->next);
             current_node = current_node->next;
         }
     }
 
+    // copy all values under the write lock, in no particular order
+    void Dump(std::vector<T>* values) {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        values->clear();
+        values->reserve(size_);
+        HashSlots<T>* slots = slots_;
+        for (int i = 0; i < slots->slot_num; ++i) {
+            HashNode<T>* current_node = slots->heads[i];
+            while (current_node != NULL) {
+                values->push_back(current_node->value);
+                current_node = current_node->next;
+            }
+        }
+        HashSlots<T>* old_slots = slots->old;
+        for (int i = old_slots == NULL ? 0 : old_slots->migrated;
+                old_slots != NULL && i < old_slots->slot_num; ++i) {
+            HashNode<T>* current_node = old_slots->heads[i];
+            while (current_node != NULL) {
+                values->push_back(current_node->value);
+                current_node = current_node->next;
+            }
+        }
+    }
+
     int64_t size() {
-        ScopedReadLocker lock(lock_);
-        return size_;
+        return __atomic_load_n(&size_, __ATOMIC_RELAXED);
     }
 
+    // free nodes, including those waiting for readers
     int64_t free_pool_size() {
-        ScopedReadLocker lock(lock_);
-        return pool_size_;
+        ScopedLocker<MutexLock> lock(write_lock_);
+        return pool_size_ + retired_nodes_.size();
+    }
+
+    // number of slots values are migrating to, or the current ones if not resizing
+    int slot_num() {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        return slots_->slot_num;
+    }
+
+    bool resizing() {
+        ScopedLocker<MutexLock> lock(write_lock_);
+        return slots_->old != NULL;
     }
 
 private:
-    int slot_num_;
-    HashNode<T>** slots_;
+    static bool KeyLess(const T& left, const T& right) {
+        return left.key() < right.key();
+    }
+
+    static int Slot(int64_t key, int slot_num) {
+        return (key < 0 ? -key : key) % slot_num;
+    }
+
+    template <typename P>
+    static P Load(P* ptr) {
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    }
+
+    template <typename P>
+    static void Publish(P* ptr, P value) {
+        __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+    }
+
+    void AddSize(int64_t num) {
+        __atomic_store_n(&size_, size_ + num, __ATOMIC_RELAXED);
+    }
+
+    // the smallest doubled slot number which holds num values
+    int SlotNumFor(int64_t num) const {
+        int64_t slot_num = slots_->slot_num;
+        while (slot_num * kMaxLoadFactor < num && slot_num < kMaxSlotNum) {
+            slot_num *= 2;
+        }
+        return (int)slot_num;
+    }
+
+    // head of the chain where key is; safe for readers
+    HashNode<T>** Bucket(int64_t key) const {
+        HashSlots<T>* slots = Load(&slots_);
+        HashSlots<T>* old_slots = Load(&(slots->old));
+        if (old_slots != NULL) {
+            int old_slot = Slot(key, old_slots->slot_num);
+            if (old_slot >= Load(&(old_slots->migrated))) {
+                return old_slots->heads + old_slot;
+            }
+        }
+        return slots->heads + Slot(key, slots->slot_num);
+    }
+
+    // following are called with the write lock held
+
+    void AllocatePool(int num) {
+        HashNode<T>* new_pool = new HashNode<T>[num];
+        lists_.push_back(new_pool);
+        pool_size_ += num;
+        for (int i = 0; i < num; ++i) {
+            (new_pool[i]).next = pool_head_;
+            pool_head_ = new_pool + i;
+        }
+    }
+
+    HashNode<T>* AllocNode() {
+        if (pool_size_ <= 0) {
+            Reclaim();
+        }
+        if (pool_size_ <= 0) {
+            AllocatePool(kDefaultPoolSize);
+        }
+        HashNode<T>* node = pool_head_;
+        pool_head_ = pool_head_->next;
+        pool_size_--;
+        return node;
+    }
+
+    // wait for readers, then reuse retired nodes and free retired slots
+    void Reclaim() {
+        if (retired_nodes_.empty() && retired_slots_.empty()) {
+            return;
+        }
+        epoch_.Synchronize();
+        for (size_t i = 0; i < retired_nodes_.size(); ++i) {
+            retired_nodes_[i]->next = pool_head_;
+            pool_head_ = retired_nodes_[i];
+        }
+        pool_size_ += retired_nodes_.size();
+        retired_nodes_.clear();
+        for (size_t i = 0; i < retired_slots_.size(); ++i) {
+            delete retired_slots_[i];
+        }
+        retired_slots_.clear();
+    }
+
+    void StartResize(int new_slot_num) {
+        HashSlots<T>* new_slots = new HashSlots<T>(new_slot_num);
+        new_slots->old = slots_;
+        Publish(&slots_, new_slots);
+    }
+
+    // copy chains of at most num old slots into the new slots, keeping new chains sorted;
+    // old chains are left for readers until they are reclaimed
+    void Migrate(int num) {
+        HashSlots<T>* old_slots = slots_->old;
+        if (old_slots == NULL) {
+            return;
+        }
+        int pos = old_slots->migrated;
+        int end = std::min(old_slots->slot_num, pos + num);
+        for (; pos < end; ++pos) {
+            HashNode<T>* node = old_slots->heads[pos];
+            while (node != NULL) {
+                int64_t key = (node->value).key();
+                HashNode<T>** link = slots_->heads + Slot(key, slots_->slot_num);
+                while (*link != NULL && ((*link)->value).key() < key) {
+                    link = &((*link)->next);
+                }
+                HashNode<T>* new_node = AllocNode();
+                new_node->value = node->value;
+                new_node->next = *link;
+                Publish(link, new_node);
+                node = node->next;
+            }
+            Publish(&(old_slots->migrated), pos + 1);
+            // retire the old chain only after readers are sent to the new slots
+            for (node = old_slots->heads[pos]; node != NULL; node = node->next) {
+                retired_nodes_.push_back(node);
+            }
+        }
+        if (pos >= old_slots->slot_num) {
+            Publish(&(slots_->old), (HashSlots<T>*)NULL);
+            retired_slots_.push_back(old_slots);
+        }
+    }
+
+    // go on resizing, or start it if load factor is out of range
+    void AfterWrite() {
+        int slot_num = slots_->slot_num;
+        if (slots_->old != NULL) {
+            Migrate(kMigrateSlotsPerOp);
+        } else if (size_ > (int64_t)slot_num * kMaxLoadFactor && slot_num < kMaxSlotNum) {
+            StartResize(std::min((int64_t)slot_num * 2, (int64_t)kMaxSlotNum));
+        } else if (size_ < slot_num / kMinLoadDivisor && slot_num > min_slot_num_) {
+            StartResize(std::max(slot_num / 2, min_slot_num_));
+        }
+        // bound memory held for readers
+        if ((int)retired_nodes_.size() >= kDefaultPoolSize) {
+            Reclaim();
+        }
+    }
+
+    bool InsertInternal(const T& new_value, T* old_value) {
+        int64_t key = new_value.key();
+        HashNode<T>** link = Bucket(key);
+        HashNode<T>* current_node = *link;
+        while (current_node != NULL) {
+            if ((current_node->value).key() == key) {
+                *old_value = current_node->value;
+                return false;
+            }
+
+            if ((current_node->value).key() > key) {
+                break;
+            }
+
+            link = &(current_node->next);
+            current_node = current_node->next;
+        }
+
+        // no duplicate value, get a node for new value
+        HashNode<T>* new_node = AllocNode();
+        new_node->next = current_node;
+        new_node->value = new_value;
+        Publish(link, new_node);
+        AddSize(1);
+        AfterWrite();
+
+        return true;
+    }
+
+private:
+    int min_slot_num_;
+    // current slots, replaced when resizing starts
+    HashSlots<T>* slots_;
     std::vector<HashNode<T>*> lists_;
 
     int64_t size_;
@@ -173,7 +461,12 @@ private:
     HashNode<T>* pool_head_;
     int64_t pool_size_;
 
-    RWLock lock_;
+    // unlinked nodes & slots which readers may still see
+    std::vector<HashNode<T>*> retired_nodes_;
+    std::vector<HashSlots<T>*> retired_slots_;
+
+    MutexLock write_lock_;
+    Epoch epoch_;
 };
 
 }
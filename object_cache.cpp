@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file object_cache.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/16 15:02:37
+ * @brief
+ *
+*/
+#include "eagleengine/object_cache.h"
+#include <string.h>
+
+namespace eagleengine {
+
+struct CacheEntry {
+    uint64_t block_id;
+    int64_t object_id;
+    uint64_t hash;
+    char* data;
+    int size;
+    // one for the cache while it is in a list, and one for each handle
+    int refs;
+    int segment;
+    CacheEntry* prev;
+    CacheEntry* next;
+};
+
+// murmur3 finalizer
+static uint64_t Mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdul;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ul;
+    key ^= key >> 33;
+    return key;
+}
+
+FrequencySketch::FrequencySketch(int64_t width) : additions_(0) {
+    int64_t real_width = 64;
+    while (real_width < width && real_width < (1 << 24)) {
+        real_width <<= 1;
+    }
+    mask_ = real_width - 1;
+    sample_size_ = real_width * 10;
+    counters_.assign(real_width * kDepth, 0);
+}
+
+int64_t FrequencySketch::Index(uint64_t hash, int row) const {
+    return row * (mask_ + 1) + (Mix(hash + row * 0x9e3779b97f4a7c15ul) & mask_);
+}
+
+void FrequencySketch::Increment(uint64_t hash) {
+    for (int i = 0; i < kDepth; ++i) {
+        uint8_t& counter = counters_[Index(hash, i)];
+        if (counter < 15) {
+            counter++;
+        }
+    }
+    if (++additions_ >= sample_size_) {
+        Reset();
+    }
+}
+
+int FrequencySketch::Estimate(uint64_t hash) const {
+    int frequency = 15;
+    for (int i = 0; i < kDepth; ++i) {
+        int counter = counters_[Index(hash, i)];
+        if (counter < frequency) {
+            frequency = counter;
+        }
+    }
+    return frequency;
+}
+
+void FrequencySketch::Reset() {
+    for (size_t i = 0; i < counters_.size(); ++i) {
+        counters_[i] >>= 1;
+    }
+    additions_ /= 2;
+}
+
+ObjectCache::ObjectCache(int64_t capacity) : capacity_(capacity), last_id_(0) {
+    const int shard_num = 1 << kCacheShardBits;
+    for (int i = 0; i < shard_num; ++i) {
+        Shard* shard = &shards_[i];
+        for (int j = 0; j < kSegmentNum; ++j) {
+            CacheEntry* head = new CacheEntry();
+            head->prev = head;
+            head->next = head;
+            shard->lists[j] = head;
+            shard->usages[j] = 0;
+        }
+        shard->capacity = capacity / shard_num;
+        shard->window_capacity = shard->capacity * kCacheWindowPercent / 100;
+        shard->protected_capacity = (shard->capacity - shard->window_capacity) *
+                kCacheProtectedPercent / 100;
+        // one counter for every 4KB
+        shard->sketch = new FrequencySketch(shard->capacity / 4096);
+    }
+}
+
+ObjectCache::~ObjectCache() {
+    const int shard_num = 1 << kCacheShardBits;
+    for (int i = 0; i < shard_num; ++i) {
+        Shard* shard = &shards_[i];
+        for (int j = 0; j < kSegmentNum; ++j) {
+            CacheEntry* head = shard->lists[j];
+            while (head->next != head) {
+                // all handles should be released before
+                Remove(shard, head->next);
+            }
+            delete head;
+        }
+        delete shard->sketch;
+    }
+}
+
+uint64_t ObjectCache::Hash(const CacheKey& key) {
+    return Mix(key.object_id ^ Mix(key.block_id));
+}
+
+void ObjectCache::Insert(uint64_t block_id, int64_t object_id, const Slice& value) {
+    CacheKey key;
+    key.block_id = block_id;
+    key.object_id = object_id;
+    uint64_t hash = Hash(key);
+    Shard* shard = GetShard(hash);
+    if ((int64_t)value.size() > shard->capacity - shard->window_capacity) {
+        return;
+    }
+    // copy out of lock
+    CacheEntry* entry = new CacheEntry();
+    entry->block_id = block_id;
+    entry->object_id = object_id;
+    entry->hash = hash;
+    entry->size = value.size();
+    entry->data = new char[value.size() + 1];
+    memcpy(entry->data, value.data(), value.size());
+    entry->refs = 1;
+
+    ScopedLocker<MutexLock> lock(shard->lock);
+    if (!shard->table.insert(std::make_pair(key, entry)).second) {
+        // contents of an object never change
+        delete[] entry->data;
+        delete entry;
+        return;
+    }
+    PushFront(shard, kWindow, entry);
+    CacheEntry* window = shard->lists[kWindow];
+    while (shard->usages[kWindow] > shard->window_capacity) {
+        CacheEntry* candidate = window->prev;
+        Unlink(shard, candidate);
+        Admit(shard, candidate);
+    }
+}
+
+ObjectCache::Handle* ObjectCache::Lookup(uint64_t block_id, int64_t object_id) {
+    CacheKey key;
+    key.block_id = block_id;
+    key.object_id = object_id;
+    uint64_t hash = Hash(key);
+    Shard* shard = GetShard(hash);
+    ScopedLocker<MutexLock> lock(shard->lock);
+    // misses are counted too, so that an object read again is admitted once cached
+    shard->sketch->Increment(hash);
+    std::unordered_map<CacheKey, CacheEntry*, CacheKeyHash>::iterator it = shard->table.find(key);
+    if (it == shard->table.end()) {
+        return NULL;
+    }
+
+    CacheEntry* entry = it->second;
+    Segment segment = (Segment)entry->segment;
+    Unlink(shard, entry);
+    if (segment == kWindow) {
+        PushFront(shard, kWindow, entry);
+    } else {
+        // a hit in main area is protected, the least recently used protected objects are
+        // moved back to probation
+        PushFront(shard, kProtected, entry);
+        CacheEntry* protected_list = shard->lists[kProtected];
+        while (shard->usages[kProtected] > shard->protected_capacity &&
+                protected_list->prev != entry) {
+            CacheEntry* demoted = protected_list->prev;
+            Unlink(shard, demoted);
+            PushFront(shard, kProbation, demoted);
+        }
+    }
+    entry->refs++;
+    return entry;
+}
+
+Slice ObjectCache::Value(Handle* handle) {
+    return Slice(handle->data, handle->size);
+}
+
+void ObjectCache::Release(Handle* handle) {
+    Shard* shard = GetShard(handle->hash);
+    ScopedLocker<MutexLock> lock(shard->lock);
+    Unref(handle);
+}
+
+void ObjectCache::Erase(uint64_t block_id, int64_t object_id) {
+    CacheKey key;
+    key.block_id = block_id;
+    key.object_id = object_id;
+    Shard* shard = GetShard(Hash(key));
+    ScopedLocker<MutexLock> lock(shard->lock);
+    std::unordered_map<CacheKey, CacheEntry*, CacheKeyHash>::iterator it = shard->table.find(key);
+    if (it != shard->table.end()) {
+        Remove(shard, it->second);
+    }
+}
+
+void ObjectCache::EraseBlock(uint64_t block_id) {
+    const int shard_num = 1 << kCacheShardBits;
+    for (int i = 0; i < shard_num; ++i) {
+        Shard* shard = &shards_[i];
+        ScopedLocker<MutexLock> lock(shard->lock);
+        std::vector<CacheEntry*> entries;
+        std::unordered_map<CacheKey, CacheEntry*, CacheKeyHash>::iterator it =
+                shard->table.begin();
+        for (; it != shard->table.end(); ++it) {
+            if (it->first.block_id == block_id) {
+                entries.push_back(it->second);
+            }
+        }
+        for (size_t j = 0; j < entries.size(); ++j) {
+            Remove(shard, entries[j]);
+        }
+    }
+}
+
+int64_t ObjectCache::usage() {
+    int64_t usage = 0;
+    const int shard_num = 1 << kCacheShardBits;
+    for (int i = 0; i < shard_num; ++i) {
+        Shard* shard = &shards_[i];
+        ScopedLocker<MutexLock> lock(shard->lock);
+        for (int j = 0; j < kSegmentNum; ++j) {
+            usage += shard->usages[j];
+        }
+    }
+    return usage;
+}
+
+void ObjectCache::PushFront(Shard* shard, Segment segment, CacheEntry* entry) {
+    CacheEntry* head = shard->lists[segment];
+    entry->segment = segment;
+    entry->prev = head;
+    entry->next = head->next;
+    head->next->prev = entry;
+    head->next = entry;
+    shard->usages[segment] += entry->size;
+}
+
+void ObjectCache::Unlink(Shard* shard, CacheEntry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+    shard->usages[entry->segment] -= entry->size;
+}
+
+void ObjectCache::Remove(Shard* shard, CacheEntry* entry) {
+    if (entry->prev != NULL) {
+        Unlink(shard, entry);
+    }
+    CacheKey key;
+    key.block_id = entry->block_id;
+    key.object_id = entry->object_id;
+    shard->table.erase(key);
+    Unref(entry);
+}
+
+void ObjectCache::Unref(CacheEntry* entry) {
+    if (--entry->refs == 0) {
+        delete[] entry->data;
+        delete entry;
+    }
+}
+
+void ObjectCache::Admit(Shard* shard, CacheEntry* candidate) {
+    const int64_t main_capacity = shard->capacity - shard->window_capacity;
+    int frequency = shard->sketch->Estimate(candidate->hash);
+    while (shard->usages[kProbation] + shard->usages[kProtected] + candidate->size >
+            main_capacity) {
+        CacheEntry* probation = shard->lists[kProbation];
+        CacheEntry* victim = probation->prev != probation ? probation->prev :
+                shard->lists[kProtected]->prev;
+        if (frequency <= shard->sketch->Estimate(victim->hash)) {
+            Remove(shard, candidate);
+            return;
+        }
+        Remove(shard, victim);
+    }
+    PushFront(shard, kProbation, candidate);
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file object_cache.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/16 15:02:37
+ * @brief cache of object contents shared by blocks, with W-TinyLFU admission
+ *
+*/
+#ifndef _EAGLEFS_OBJECT_CACHE_H_
+#define _EAGLEFS_OBJECT_CACHE_H_
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include "eagleengine/common.h"
+#include "eagleengine/slice.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// the cache is split into 1 << kCacheShardBits shards by object id
+static const int kCacheShardBits = 4;
+// percent of a shard for the admission window, and percent of the main area for protected
+// objects
+static const int kCacheWindowPercent = 1;
+static const int kCacheProtectedPercent = 80;
+
+// approximate access frequency of recent keys, counters are halved once there are 10
+// increments per counter, so that old popularity fades
+class FrequencySketch {
+public:
+    explicit FrequencySketch(int64_t width);
+
+    void Increment(uint64_t hash);
+    // at most 15
+    int Estimate(uint64_t hash) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(FrequencySketch);
+    static const int kDepth = 4;
+
+    int64_t Index(uint64_t hash, int row) const;
+    void Reset();
+
+    int64_t mask_;
+    int64_t additions_;
+    int64_t sample_size_;
+    std::vector<uint8_t> counters_;
+};
+
+struct CacheEntry;
+
+// Note:
+// 1. objects are keyed by (block id, object id); a block takes a unique id by NewId(), so
+//    that one cache is shared by all blocks of a process and the byte budget is global;
+// 2. each shard is a W-TinyLFU: new objects enter a small LRU window; objects evicted from
+//    the window are admitted into the main segmented LRU only if they are accessed more often
+//    than its victims, by a frequency sketch of lookups; thus a scan of objects read once
+//    cannot flush objects which are read again and again;
+// 3. Lookup returns a handle which keeps the object alive even if it is evicted, it should
+//    be released by Release(); all methods are thread safe
+//
+class ObjectCache {
+public:
+    typedef CacheEntry Handle;
+
+    explicit ObjectCache(int64_t capacity);
+    ~ObjectCache();
+
+    uint64_t NewId() {
+        return __atomic_add_fetch(&last_id_, 1, __ATOMIC_RELAXED);
+    }
+
+    // value is copied; it is not cached if it is larger than a shard
+    void Insert(uint64_t block_id, int64_t object_id, const Slice& value);
+    // NULL if not cached
+    Handle* Lookup(uint64_t block_id, int64_t object_id);
+    Slice Value(Handle* handle);
+    void Release(Handle* handle);
+    void Erase(uint64_t block_id, int64_t object_id);
+    // erase all objects of a block
+    void EraseBlock(uint64_t block_id);
+
+    int64_t capacity() {
+        return capacity_;
+    }
+    // bytes of cached objects
+    int64_t usage();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ObjectCache);
+
+    struct CacheKey {
+        uint64_t block_id;
+        int64_t object_id;
+        bool operator==(const CacheKey& other) const {
+            return block_id == other.block_id && object_id == other.object_id;
+        }
+    };
+    struct CacheKeyHash {
+        size_t operator()(const CacheKey& key) const {
+            return Hash(key);
+        }
+    };
+    enum Segment {
+        kWindow = 0,
+        kProbation = 1,
+        kProtected = 2,
+        kSegmentNum = 3
+    };
+    struct Shard {
+        MutexLock lock;
+        std::unordered_map<CacheKey, CacheEntry*, CacheKeyHash> table;
+        // circular lists with dummy heads, most recently used first
+        CacheEntry* lists[kSegmentNum];
+        int64_t usages[kSegmentNum];
+        int64_t capacity;
+        int64_t window_capacity;
+        int64_t protected_capacity;
+        FrequencySketch* sketch;
+    };
+
+    static uint64_t Hash(const CacheKey& key);
+    Shard* GetShard(uint64_t hash) {
+        return &shards_[hash >> (64 - kCacheShardBits)];
+    }
+    // following are called with shard lock held
+    void PushFront(Shard* shard, Segment segment, CacheEntry* entry);
+    void Unlink(Shard* shard, CacheEntry* entry);
+    void Remove(Shard* shard, CacheEntry* entry);
+    void Unref(CacheEntry* entry);
+    // move an object evicted from window into main area, or drop it
+    void Admit(Shard* shard, CacheEntry* candidate);
+
+    int64_t capacity_;
+    uint64_t last_id_;
+    Shard shards_[1 << kCacheShardBits];
+};
+
+}
+
+#endif  //_EAGLEFS_OBJECT_CACHE_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
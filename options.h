@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file options.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/06 09:45:12
+ * @brief options of block operations
+ *
+*/
+#ifndef _EAGLEFS_OPTIONS_H_
+#define _EAGLEFS_OPTIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace eagleengine {
+
+class ObjectCache;
+class RateLimiter;
+
+enum IndexType {
+    // chained hash table, see hash_table.h
+    kHashIndex = 0,
+    // open addressing hash table probed by groups of slots, see swiss_table.h
+    kSwissIndex = 1,
+    // array indexed by object id, about 8 bytes per object, see dense_index.h
+    kDenseIndex = 2
+};
+
+struct BlockOptions {
+    // implementation of the memory index; it is not persisted, a block can be opened
+    // with any type
+    IndexType index_type;
+    // check crc of the whole sealed table when a sealed block is opened, rather than only its
+    // footer; it takes a read of the table
+    bool verify_sealed_table;
+    // cache of objects read by GetObject, it is usually shared by all blocks of a process
+    // and not owned by the block; NULL means no cache
+    ObjectCache* object_cache;
+    // bytes of recently put objects kept in memory; they are read from memory, and written to
+    // data file in large chunks rather than one write per object; their index entries are
+    // written after them; they are flushed before syncing, thus durability is the same; 0
+    // means no buffer
+    int64_t tail_buffer_size;
+    // check header & crc of every object copied by Compact; without it, live objects are
+    // moved by copy_file_range without being read into user space, see blockcompact.h
+    bool verify_compaction;
+    // limiter of compaction io, usually one for each disk shared by its blocks and not owned
+    // by the block; data reads & writes report their latencies to it for the adaptive
+    // mode, see rate_limiter.h; NULL means no limit
+    RateLimiter* rate_limiter;
+
+    BlockOptions() : index_type(kHashIndex), verify_sealed_table(false), object_cache(NULL),
+                     tail_buffer_size(0), verify_compaction(true), rate_limiter(NULL) {
+    }
+};
+
+struct ReadOptions {
+    // read object header together with the object by one preadv, and check its crc; objects
+    // found in object cache or tail buffer are in memory, they are not verified
+    bool verify_checksums;
+    // verify only one of every verify_sample_rate reads of a thread, so that verification can
+    // be turned on everywhere at a small cost; 1 means every read
+    int verify_sample_rate;
+
+    ReadOptions() : verify_checksums(false), verify_sample_rate(1) {
+    }
+};
+
+struct WriteOptions {
+    // return only when the write is durable; concurrent sync writes of a block are
+    // merged into one fdatasync of data & index files
+    bool sync;
+
+    WriteOptions() : sync(false) {
+    }
+};
+
+}
+
+#endif  //_EAGLEFS_OPTIONS_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file rate_limiter.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/10/14 20:16:43
+ * @brief
+ *
+*/
+#include "eagleengine/rate_limiter.h"
+#include <unistd.h>
+#include <algorithm>
+#include "eagleengine/util.h"
+
+namespace eagleengine {
+
+RateLimiter::RateLimiter(const RateLimiterOptions& options)
+        : options_(options), byte_tokens_(0), io_tokens_(0), rate_percent_(100) {
+    for (int i = 0; i < kLatencyBuckets; ++i) {
+        latencies_[i] = 0;
+    }
+    last_refill_us_ = NowMicros();
+    last_adjust_us_ = last_refill_us_;
+}
+
+void RateLimiter::Request(int64_t bytes) {
+    if (options_.bytes_per_sec <= 0 && options_.ios_per_sec <= 0) {
+        return;
+    }
+    int64_t wait_us = 0;
+    {
+        ScopedLocker<MutexLock> lock(lock_);
+        int64_t now = NowMicros();
+        Refill(now);
+        Adjust(now);
+        byte_tokens_ -= bytes;
+        io_tokens_ -= 1;
+        // sleep until both debts are paid off
+        if (options_.bytes_per_sec > 0 && byte_tokens_ < 0) {
+            double rate = options_.bytes_per_sec * rate_percent_ / 100.0;
+            wait_us = std::max(wait_us, (int64_t)(-byte_tokens_ * 1000000 / rate));
+        }
+        if (options_.ios_per_sec > 0 && io_tokens_ < 0) {
+            double rate = options_.ios_per_sec * rate_percent_ / 100.0;
+            wait_us = std::max(wait_us, (int64_t)(-io_tokens_ * 1000000 / rate));
+        }
+    }
+    if (wait_us > 0) {
+        usleep(wait_us);
+    }
+}
+
+void RateLimiter::RecordLatency(int64_t micros) {
+    if (options_.target_latency_us > 0) {
+        __atomic_add_fetch(&latencies_[LatencyBucket(micros)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+int RateLimiter::rate_percent() {
+    ScopedLocker<MutexLock> lock(lock_);
+    return rate_percent_;
+}
+
+int RateLimiter::LatencyBucket(int64_t micros) {
+    if (micros < 4) {
+        return micros < 0 ? 0 : micros;
+    }
+    // the highest 3 bits of micros
+    int log = 63 - __builtin_clzll(micros);
+    return (log - 1) * 4 + ((micros >> (log - 2)) & 3);
+}
+
+int64_t RateLimiter::BucketLatency(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int log = bucket / 4 + 1;
+    return (int64_t)(4 + bucket % 4) << (log - 2);
+}
+
+void RateLimiter::Refill(int64_t now) {
+    double elapsed = now - last_refill_us_;
+    last_refill_us_ = now;
+    if (options_.bytes_per_sec > 0) {
+        double rate = options_.bytes_per_sec * rate_percent_ / 100.0;
+        byte_tokens_ = std::min(byte_tokens_ + rate * elapsed / 1000000,
+                                rate * kRateLimiterBurstMs / 1000);
+    }
+    if (options_.ios_per_sec > 0) {
+        double rate = options_.ios_per_sec * rate_percent_ / 100.0;
+        io_tokens_ = std::min(io_tokens_ + rate * elapsed / 1000000,
+                              rate * kRateLimiterBurstMs / 1000);
+    }
+}
+
+void RateLimiter::Adjust(int64_t now) {
+    int64_t interval_us = options_.adjust_interval_ms * 1000;
+    if (options_.target_latency_us <= 0 || now - last_adjust_us_ < interval_us) {
+        return;
+    }
+    int64_t counts[kLatencyBuckets];
+    int64_t total = 0;
+    for (int i = 0; i < kLatencyBuckets; ++i) {
+        counts[i] = __atomic_exchange_n(&latencies_[i], 0, __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+    bool stale = now - last_adjust_us_ > 2 * interval_us;
+    last_adjust_us_ = now;
+    if (stale) {
+        // nobody requested for a while, latencies are not caused by background io
+        return;
+    }
+
+    bool slow = false;
+    if (total >= kRateLimiterMinSamples) {
+        int64_t rank = (int64_t)(total * options_.latency_percentile / 100);
+        int64_t seen = 0;
+        for (int i = 0; i < kLatencyBuckets; ++i) {
+            seen += counts[i];
+            if (seen > rank || seen == total) {
+                // upper bound of the bucket, a bit pessimistic
+                slow = BucketLatency(i + 1) > options_.target_latency_us;
+                break;
+            }
+        }
+    }
+    if (slow) {
+        rate_percent_ = std::max(options_.min_rate_percent, rate_percent_ * 7 / 10);
+    } else {
+        rate_percent_ = std::min(100, rate_percent_ + 10);
+    }
+}
+
+ScopedLatency::ScopedLatency(RateLimiter* limiter) : limiter_(limiter), start_us_(0) {
+    if (limiter_ != NULL) {
+        start_us_ = NowMicros();
+    }
+}
+
+ScopedLatency::~ScopedLatency() {
+    if (limiter_ != NULL) {
+        limiter_->RecordLatency(NowMicros() - start_us_);
+    }
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file rate_limiter.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/10/14 20:16:43
+ * @brief token buckets of bytes & ios for background io, which back off when foreground
+ *        latency rises
+ *
+*/
+#ifndef _EAGLEFS_RATE_LIMITER_H_
+#define _EAGLEFS_RATE_LIMITER_H_
+
+#include <stdint.h>
+#include "eagleengine/common.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// tokens are accumulated for at most kRateLimiterBurstMs while the limiter is idle
+static const int64_t kRateLimiterBurstMs = 100;
+// latencies are counted by 4 buckets per power of 2, see LatencyBucket()
+static const int kLatencyBuckets = 256;
+// a window with less foreground requests has no say on the rate
+static const int64_t kRateLimiterMinSamples = 32;
+
+struct RateLimiterOptions {
+    // bytes & ios per second of background io, eg. compaction; 0 means no limit
+    int64_t bytes_per_sec;
+    int64_t ios_per_sec;
+    // adaptive mode: rates are cut by 30% in a window whose foreground latency at
+    // latency_percentile exceeds target_latency_us, and raised by 10% of the configured ones
+    // otherwise; 0 means fixed rates
+    int64_t target_latency_us;
+    double latency_percentile;
+    int64_t adjust_interval_ms;
+    // rates are not cut below this percent of the configured ones, so that background io
+    // always makes progress
+    int min_rate_percent;
+
+    RateLimiterOptions() : bytes_per_sec(0), ios_per_sec(0), target_latency_us(0),
+                           latency_percentile(99), adjust_interval_ms(100),
+                           min_rate_percent(10) {
+    }
+};
+
+// Note:
+// 1. a limiter is usually shared by all blocks on a disk, so that the budget is per disk no
+//    matter how many blocks are compacted, scrubbed or backed up at the same time; it is not
+//    owned by blocks;
+// 2. Request() takes tokens for one io even if there are not enough, and sleeps until the
+//    debt is paid off; thus a large io is never starved, and concurrent callers are spaced
+//    by the rates;
+// 3. foreground requests report latencies by RecordLatency(), which only increments a
+//    counter; the rates are adjusted by background callers of Request(), once every
+//    adjust_interval_ms; latencies recorded while nobody requests are dropped
+//
+class RateLimiter {
+public:
+    explicit RateLimiter(const RateLimiterOptions& options);
+
+    // wait until an io of bytes can be issued
+    void Request(int64_t bytes);
+    void RecordLatency(int64_t micros);
+
+    // current rates in percent of the configured ones
+    int rate_percent();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RateLimiter);
+
+    static int LatencyBucket(int64_t micros);
+    // the least latency of bucket
+    static int64_t BucketLatency(int bucket);
+    // following are called with lock_ held
+    void Refill(int64_t now);
+    void Adjust(int64_t now);
+
+    RateLimiterOptions options_;
+    // foreground latencies since last adjustment
+    int64_t latencies_[kLatencyBuckets];
+
+    MutexLock lock_;
+    // negative if in debt
+    double byte_tokens_;
+    double io_tokens_;
+    int64_t last_refill_us_;
+    int64_t last_adjust_us_;
+    int rate_percent_;
+};
+
+// record latency of a foreground request to limiter on destruction, limiter can be NULL
+class ScopedLatency {
+public:
+    explicit ScopedLatency(RateLimiter* limiter);
+    ~ScopedLatency();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ScopedLatency);
+
+    RateLimiter* limiter_;
+    int64_t start_us_;
+};
+
+}
+
+#endif  //_EAGLEFS_RATE_LIMITER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file sealed_index.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/02 14:27:51
+ * @brief
+ *
+*/
+#include "eagleengine/sealed_index.h"
+#include <string.h>
+#include <algorithm>
+
+namespace eagleengine {
+
+// EliasFano samples the position of every kSelectSample-th set bit
+static const int kSelectSample = 256;
+// RankBitVector keeps the rank of every kRankBlockWords words
+static const int kRankBlockWords = 8;
+
+static bool ObjectIdLess(const IndexEntry& left, const IndexEntry& right) {
+    return left.object_id < right.object_id;
+}
+
+EliasFano::EliasFano() : size_(0), lower_bit_num_(0) {
+}
+
+void EliasFano::Build(const std::vector<uint64_t>& values, uint64_t universe) {
+    size_ = values.size();
+    lower_bit_num_ = 0;
+    if (size_ > 0 && universe > (uint64_t)size_) {
+        lower_bit_num_ = 63 - __builtin_clzll(universe / size_);
+    }
+    const uint64_t lower_mask = (1ul << lower_bit_num_) - 1;
+
+    // one more word, so that reading bits across words never goes out of range
+    lower_bits_.assign((size_ * lower_bit_num_ + 63) / 64 + 1, 0);
+    upper_bits_.assign((size_ + (universe >> lower_bit_num_) + 1) / 64 + 1, 0);
+    select_samples_.clear();
+    for (int64_t i = 0; i < size_; ++i) {
+        uint64_t value = values[i];
+        if (lower_bit_num_ > 0) {
+            int64_t bit_pos = i * lower_bit_num_;
+            int offset = bit_pos & 63;
+            uint64_t low = value & lower_mask;
+            lower_bits_[bit_pos >> 6] |= low << offset;
+            if (offset + lower_bit_num_ > 64) {
+                lower_bits_[(bit_pos >> 6) + 1] |= low >> (64 - offset);
+            }
+        }
+        int64_t pos = (int64_t)(value >> lower_bit_num_) + i;
+        upper_bits_[pos >> 6] |= 1ul << (pos & 63);
+        if (i % kSelectSample == 0) {
+            select_samples_.push_back(pos);
+        }
+    }
+}
+
+uint64_t EliasFano::Get(int64_t i) const {
+    uint64_t high = Select(i) - i;
+    uint64_t low = 0;
+    if (lower_bit_num_ > 0) {
+        int64_t bit_pos = i * lower_bit_num_;
+        int offset = bit_pos & 63;
+        low = lower_bits_[bit_pos >> 6] >> offset;
+        if (offset + lower_bit_num_ > 64) {
+            low |= lower_bits_[(bit_pos >> 6) + 1] << (64 - offset);
+        }
+        low &= (1ul << lower_bit_num_) - 1;
+    }
+    return (high << lower_bit_num_) | low;
+}
+
+int64_t EliasFano::Select(int64_t i) const {
+    int64_t pos = select_samples_[i / kSelectSample];
+    int64_t remaining = i % kSelectSample;
+    int64_t word = pos >> 6;
+    uint64_t bits = upper_bits_[word] & (~0ul << (pos & 63));
+    while (true) {
+        int count = __builtin_popcountll(bits);
+        if (remaining < count) {
+            for (; remaining > 0; --remaining) {
+                bits &= bits - 1;
+            }
+            return word * 64 + __builtin_ctzll(bits);
+        }
+        remaining -= count;
+        bits = upper_bits_[++word];
+    }
+}
+
+int64_t EliasFano::memory_usage() const {
+    return (lower_bits_.capacity() + upper_bits_.capacity() + select_samples_.capacity()) * 8;
+}
+
+void RankBitVector::Build(const std::vector<uint64_t>& words, int64_t bit_num) {
+    bit_num_ = bit_num;
+    words_.assign(words.begin(), words.begin() + (bit_num + 63) / 64);
+    block_ranks_.clear();
+    int64_t rank = 0;
+    for (size_t i = 0; i < words_.size(); ++i) {
+        if (i % kRankBlockWords == 0) {
+            block_ranks_.push_back(rank);
+        }
+        rank += __builtin_popcountll(words_[i]);
+    }
+}
+
+int64_t RankBitVector::Rank(int64_t pos) const {
+    int64_t word = pos >> 6;
+    int64_t rank = block_ranks_[word / kRankBlockWords];
+    for (int64_t i = word - word % kRankBlockWords; i < word; ++i) {
+        rank += __builtin_popcountll(words_[i]);
+    }
+    if ((pos & 63) != 0) {
+        rank += __builtin_popcountll(words_[word] & ((1ul << (pos & 63)) - 1));
+    }
+    return rank;
+}
+
+int64_t RankBitVector::memory_usage() const {
+    return (words_.capacity() + block_ranks_.capacity()) * 8;
+}
+
+SealedIndex::SealedIndex() : base_id_(0), deleted_(NULL), has_overflow_(false), size_(0) {
+}
+
+SealedIndex::~SealedIndex() {
+    delete[] deleted_;
+}
+
+void SealedIndex::Build(std::vector<IndexEntry>* entries) {
+    if (!std::is_sorted(entries->begin(), entries->end(), ObjectIdLess)) {
+        std::sort(entries->begin(), entries->end(), ObjectIdLess);
+    }
+
+    // ids far beyond the number of entries would make the bitvector sparse
+    const int64_t max_bit_num = 64 * (int64_t)entries->size() + 64;
+    std::vector<uint64_t> live_words;
+    std::vector<uint64_t> values;
+    int64_t last_end = 0;
+    int64_t bit_num = 0;
+    base_id_ = -1;
+    overflow_.clear();
+    for (size_t i = 0; i < entries->size(); ++i) {
+        const IndexEntry& entry = (*entries)[i];
+        if (base_id_ < 0 && entry.object_id >= 0) {
+            base_id_ = entry.object_id;
+        }
+        int64_t pos = entry.object_id - base_id_;
+        if (base_id_ >= 0 && pos >= 0 && pos < max_bit_num &&
+                entry.sequence_number == entry.object_id && entry.offset >= last_end &&
+                entry.size >= 0) {
+            live_words.resize(pos / 64 + 1, 0);
+            live_words[pos >> 6] |= 1ul << (pos & 63);
+            values.push_back(entry.offset);
+            values.push_back(entry.offset + entry.size);
+            last_end = entry.offset + entry.size;
+            bit_num = pos + 1;
+        } else {
+            overflow_[entry.object_id] = entry;
+        }
+    }
+    if (base_id_ < 0) {
+        base_id_ = 0;
+    }
+
+    live_.Build(live_words, bit_num);
+    offsets_.Build(values, last_end + 1);
+    delete[] deleted_;
+    int64_t deleted_words = (bit_num + 63) / 64 + 1;
+    deleted_ = new uint64_t[deleted_words];
+    memset(deleted_, 0, deleted_words * sizeof(deleted_[0]));
+    has_overflow_ = !overflow_.empty();
+    size_ = entries->size();
+}
+
+bool SealedIndex::Insert(const IndexEntry& new_entry, IndexEntry* old_entry) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    return InsertInternal(new_entry, old_entry);
+}
+
+int SealedIndex::InsertBatch(const std::vector<IndexEntry>& new_entries,
+                             IndexEntry* old_entry) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    int num = (int)new_entries.size();
+    for (int i = 0; i < num; ++i) {
+        if (!InsertInternal(new_entries[i], old_entry)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SealedIndex::BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry) {
+    return InsertBatch(*entries, old_entry);
+}
+
+bool SealedIndex::Get(int64_t object_id, IndexEntry* entry) {
+    return Find(object_id, entry);
+}
+
+int SealedIndex::GetBatch(const std::vector<int64_t>& object_ids,
+                          std::vector<IndexEntry>* entries, std::vector<bool>* found) {
+    int num = (int)object_ids.size();
+    int found_num = 0;
+    entries->resize(num);
+    found->assign(num, false);
+    for (int i = 0; i < num; ++i) {
+        if (Find(object_ids[i], &(*entries)[i])) {
+            (*found)[i] = true;
+            found_num++;
+        }
+    }
+    return found_num;
+}
+
+void SealedIndex::Delete(int64_t object_id) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    if (IsEncoded(object_id)) {
+        int64_t pos = object_id - base_id_;
+        __atomic_fetch_or(&deleted_[pos >> 6], 1ul << (pos & 63), __ATOMIC_RELEASE);
+        __atomic_store_n(&size_, size_ - 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!has_overflow_) {
+        return;
+    }
+    ScopedWriteLocker overflow_lock(overflow_lock_);
+    if (overflow_.erase(object_id) > 0) {
+        __atomic_store_n(&size_, size_ - 1, __ATOMIC_RELAXED);
+    }
+}
+
+void SealedIndex::Dump(std::vector<IndexEntry>* entries) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    entries->clear();
+    entries->reserve(size_);
+    int64_t rank = 0;
+    for (int64_t pos = 0; pos < live_.bit_num(); ++pos) {
+        if (!live_.Test(pos)) {
+            continue;
+        }
+        if ((deleted_[pos >> 6] & (1ul << (pos & 63))) == 0) {
+            IndexEntry entry;
+            entry.object_id = base_id_ + pos;
+            entry.sequence_number = entry.object_id;
+            entry.offset = offsets_.Get(2 * rank);
+            entry.size = offsets_.Get(2 * rank + 1) - entry.offset;
+            entries->push_back(entry);
+        }
+        rank++;
+    }
+    ScopedReadLocker overflow_lock(overflow_lock_);
+    std::map<int64_t, IndexEntry>::const_iterator it = overflow_.begin();
+    for (; it != overflow_.end(); ++it) {
+        entries->push_back(it->second);
+    }
+}
+
+int64_t SealedIndex::size() {
+    return __atomic_load_n(&size_, __ATOMIC_RELAXED);
+}
+
+int64_t SealedIndex::memory_usage() {
+    ScopedReadLocker overflow_lock(overflow_lock_);
+    // a map node holds an entry besides 3 pointers & color
+    return live_.memory_usage() + offsets_.memory_usage() + (live_.bit_num() / 64 + 1) * 8 +
+            overflow_.size() * (sizeof(std::pair<int64_t, IndexEntry>) + 32);
+}
+
+bool SealedIndex::Find(int64_t object_id, IndexEntry* entry) {
+    if (IsEncoded(object_id)) {
+        int64_t rank = live_.Rank(object_id - base_id_);
+        entry->sequence_number = object_id;
+        entry->object_id = object_id;
+        entry->offset = offsets_.Get(2 * rank);
+        entry->size = offsets_.Get(2 * rank + 1) - entry->offset;
+        return true;
+    }
+    if (!__atomic_load_n(&has_overflow_, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    ScopedReadLocker overflow_lock(overflow_lock_);
+    std::map<int64_t, IndexEntry>::const_iterator it = overflow_.find(object_id);
+    if (it == overflow_.end()) {
+        return false;
+    }
+    *entry = it->second;
+    return true;
+}
+
+bool SealedIndex::IsEncoded(int64_t object_id) {
+    int64_t pos = object_id - base_id_;
+    if (pos < 0 || pos >= live_.bit_num() || !live_.Test(pos)) {
+        return false;
+    }
+    uint64_t deleted = __atomic_load_n(&deleted_[pos >> 6], __ATOMIC_ACQUIRE);
+    return (deleted & (1ul << (pos & 63))) == 0;
+}
+
+bool SealedIndex::InsertInternal(const IndexEntry& new_entry, IndexEntry* old_entry) {
+    if (Find(new_entry.object_id, old_entry)) {
+        return false;
+    }
+    ScopedWriteLocker overflow_lock(overflow_lock_);
+    overflow_[new_entry.object_id] = new_entry;
+    __atomic_store_n(&has_overflow_, true, __ATOMIC_RELEASE);
+    __atomic_store_n(&size_, size_ + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file sealed_index.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/02 14:27:51
+ * @brief immutable compressed index of a sealed block: elias-fano coded offsets, and a
+ *        rank/select bitvector of live objects
+ *
+*/
+#ifndef _EAGLEFS_SEALED_INDEX_H_
+#define _EAGLEFS_SEALED_INDEX_H_
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "eagleengine/block_index.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// a non-decreasing sequence of integers, each in 2 + log(universe / size) bits
+class EliasFano {
+public:
+    EliasFano();
+
+    // values should be non-decreasing and less than universe
+    void Build(const std::vector<uint64_t>& values, uint64_t universe);
+    // the i-th value
+    uint64_t Get(int64_t i) const;
+    int64_t size() const {
+        return size_;
+    }
+    int64_t memory_usage() const;
+
+private:
+    // position of the i-th set bit of upper_bits_
+    int64_t Select(int64_t i) const;
+
+    int64_t size_;
+    int lower_bit_num_;
+    std::vector<uint64_t> lower_bits_;
+    // value >> lower_bit_num_ in unary: bit (value_i >> lower_bit_num_) + i is set
+    std::vector<uint64_t> upper_bits_;
+    // position of every kSelectSample-th set bit
+    std::vector<int64_t> select_samples_;
+};
+
+// bitvector supporting rank in constant time
+class RankBitVector {
+public:
+    RankBitVector() : bit_num_(0) {
+    }
+
+    void Build(const std::vector<uint64_t>& words, int64_t bit_num);
+    bool Test(int64_t pos) const {
+        return (words_[pos >> 6] & (1ul << (pos & 63))) != 0;
+    }
+    // number of set bits before pos
+    int64_t Rank(int64_t pos) const;
+    int64_t bit_num() const {
+        return bit_num_;
+    }
+    int64_t memory_usage() const;
+
+private:
+    int64_t bit_num_;
+    std::vector<uint64_t> words_;
+    // number of set bits before each block of kRankBlockWords words
+    std::vector<int64_t> block_ranks_;
+};
+
+// Note:
+// 1. object ids of the index are [base_id_, base_id_ + live_.bit_num()); live_ marks ids
+//    which are objects when the index is built; start & end offsets of the i-th live object
+//    are the 2i-th & (2i+1)-th values of offsets_, thus a lookup is a rank and a select;
+// 2. it takes about 2 * (2 + log(block size / objects)) bits per object, eg. 4 bytes per
+//    object for a 16GB block of 16KB objects;
+// 3. entries which cannot be encoded, eg. offsets not increasing with object ids, are kept
+//    in an overflow map; so are entries inserted later; deleted objects are marked in
+//    deleted_; thus it is still a complete BlockIndex, though meant to be read only
+//
+class SealedIndex : public BlockIndex {
+public:
+    SealedIndex();
+    virtual ~SealedIndex();
+
+    // build from entries of a block, entries are sorted by object id in place
+    void Build(std::vector<IndexEntry>* entries);
+
+    virtual bool Insert(const IndexEntry& new_entry, IndexEntry* old_entry);
+    virtual int InsertBatch(const std::vector<IndexEntry>& new_entries, IndexEntry* old_entry);
+    virtual int BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry);
+    virtual bool Get(int64_t object_id, IndexEntry* entry);
+    virtual int GetBatch(const std::vector<int64_t>& object_ids,
+                         std::vector<IndexEntry>* entries, std::vector<bool>* found);
+    virtual void Delete(int64_t object_id);
+    virtual void Dump(std::vector<IndexEntry>* entries);
+    virtual int64_t size();
+
+    int64_t memory_usage();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SealedIndex);
+
+    bool Find(int64_t object_id, IndexEntry* entry);
+    // whether object_id is live in the encoded part
+    bool IsEncoded(int64_t object_id);
+    // following are called with write_lock_ held
+    bool InsertInternal(const IndexEntry& new_entry, IndexEntry* old_entry);
+
+    int64_t base_id_;
+    RankBitVector live_;
+    EliasFano offsets_;
+    // bits of encoded objects deleted after building
+    uint64_t* deleted_;
+
+    // overflow_ is rarely used, readers lock it only if it is not empty
+    volatile bool has_overflow_;
+    std::map<int64_t, IndexEntry> overflow_;
+    RWLock overflow_lock_;
+
+    // serialize writers
+    MutexLock write_lock_;
+    int64_t size_;
+};
+
+}
+
+#endif  //_EAGLEFS_SEALED_INDEX_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
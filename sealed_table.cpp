@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file sealed_table.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/09 10:16:32
+ * @brief
+ *
+*/
+#include "eagleengine/sealed_table.h"
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include "eagleengine/crc32c.h"
+
+namespace eagleengine {
+
+static bool ObjectIdLess(const IndexEntry& left, const IndexEntry& right) {
+    return left.object_id < right.object_id;
+}
+
+static uint32_t FooterCrc(const SealedFooter& footer) {
+    return Extend(0, (const char*)&footer, offsetof(SealedFooter, footer_crc));
+}
+
+// pwrite all bytes, return false and keep errno on failure
+static bool PwriteFully(int fd, const char* buf, int64_t size, int64_t offset) {
+    while (size > 0) {
+        errno = 0;
+        ssize_t written_size = pwrite(fd, buf, size, offset);
+        if (written_size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written_size <= 0) {
+            return false;
+        }
+        buf += written_size;
+        size -= written_size;
+        offset += written_size;
+    }
+    return true;
+}
+
+SealedTable::SealedTable(void* map_addr, int64_t map_size, const IndexEntry* entries,
+                         int64_t num_entries)
+        : map_addr_(map_addr), map_size_(map_size), entries_(entries),
+          num_entries_(num_entries), has_changes_(false), size_(num_entries) {
+}
+
+SealedTable::~SealedTable() {
+    if (map_addr_ != NULL) {
+        munmap(map_addr_, map_size_);
+    }
+}
+
+Status SealedTable::Write(int fd, const std::vector<IndexEntry>& entries,
+                          SealedFooter* footer) {
+    footer->num_entries = 0;
+    footer->table_crc = 0;
+    Status status = WriteEntries(fd, entries.empty() ? NULL : &entries[0], entries.size(),
+                                 footer);
+    if (status.code() != kOk) {
+        return status;
+    }
+    return WriteFooter(fd, footer);
+}
+
+Status SealedTable::WriteEntries(int fd, const IndexEntry* entries, int64_t num,
+                                 SealedFooter* footer) {
+    Status status;
+    const char* data = (const char*)entries;
+    const int64_t data_size = num * sizeof(IndexEntry);
+    int64_t offset = footer->table_offset + footer->num_entries * sizeof(IndexEntry);
+    if (!PwriteFully(fd, data, data_size, offset)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to write sealed table at offset %ld, %m", offset);
+        return status;
+    }
+    footer->num_entries += num;
+    footer->table_crc = Extend(footer->table_crc, data, data_size);
+    return status;
+}
+
+Status SealedTable::WriteFooter(int fd, SealedFooter* footer) {
+    Status status;
+    footer->magic_number = kSealedMagicNumber;
+    footer->footer_crc = FooterCrc(*footer);
+    int64_t offset = footer->table_offset + footer->num_entries * sizeof(IndexEntry);
+    if (!PwriteFully(fd, (const char*)footer, sizeof(*footer), offset)) {
+        status.set_code(kIOError);
+        status.set_msg("failed to write sealed footer at offset %ld, %m", offset);
+    }
+    return status;
+}
+
+Status SealedTable::Load(int fd, int64_t file_size, bool verify, SealedTable** result,
+                         SealedFooter* footer) {
+    Status status;
+    *result = NULL;
+    const int footer_size = sizeof(*footer);
+    if (file_size < footer_size) {
+        return status;
+    }
+    errno = 0;
+    if (pread(fd, footer, footer_size, file_size - footer_size) != footer_size) {
+        status.set_code(kIOError);
+        status.set_msg("failed to read sealed footer, %m");
+        return status;
+    }
+    if (footer->magic_number != (int64_t)kSealedMagicNumber) {
+        return status;
+    }
+
+    const int64_t table_size = footer->num_entries * (int64_t)sizeof(IndexEntry);
+    if (footer->footer_crc != FooterCrc(*footer) || footer->num_entries < 0 ||
+            footer->table_offset < 0 || footer->table_offset + table_size + footer_size !=
+            file_size) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("invalid sealed footer, table offset %ld, %ld entries, file size %ld",
+                       footer->table_offset, footer->num_entries, file_size);
+        return status;
+    }
+
+    // map from the page holding the first entry
+    void* map_addr = NULL;
+    int64_t map_size = 0;
+    const IndexEntry* entries = NULL;
+    if (table_size > 0) {
+        const int64_t page_size = sysconf(_SC_PAGESIZE);
+        int64_t map_offset = footer->table_offset - footer->table_offset % page_size;
+        map_size = footer->table_offset + table_size - map_offset;
+        errno = 0;
+        map_addr = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, map_offset);
+        if (map_addr == MAP_FAILED) {
+            status.set_code(kIOError);
+            status.set_msg("failed to mmap sealed table, %m");
+            return status;
+        }
+        entries = (const IndexEntry*)((char*)map_addr + footer->table_offset - map_offset);
+    }
+
+    if (verify && Extend(0, (const char*)entries, table_size) != footer->table_crc) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("sealed table crc check error");
+    } else if (verify && !std::is_sorted(entries, entries + footer->num_entries,
+                                         ObjectIdLess)) {
+        status.set_code(kDataCorrupted);
+        status.set_msg("sealed table is not sorted by object id");
+    }
+    if (status.code() != kOk) {
+        if (map_addr != NULL) {
+            munmap(map_addr, map_size);
+        }
+        return status;
+    }
+    *result = new SealedTable(map_addr, map_size, entries, footer->num_entries);
+    return status;
+}
+
+bool SealedTable::Insert(const IndexEntry& new_entry, IndexEntry* old_entry) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    return InsertInternal(new_entry, old_entry);
+}
+
+int SealedTable::InsertBatch(const std::vector<IndexEntry>& new_entries,
+                             IndexEntry* old_entry) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    int num = (int)new_entries.size();
+    for (int i = 0; i < num; ++i) {
+        if (!InsertInternal(new_entries[i], old_entry)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SealedTable::BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry) {
+    return InsertBatch(*entries, old_entry);
+}
+
+bool SealedTable::Get(int64_t object_id, IndexEntry* entry) {
+    return Find(object_id, entry);
+}
+
+int SealedTable::GetBatch(const std::vector<int64_t>& object_ids,
+                          std::vector<IndexEntry>* entries, std::vector<bool>* found) {
+    int num = (int)object_ids.size();
+    int found_num = 0;
+    entries->resize(num);
+    found->assign(num, false);
+    for (int i = 0; i < num; ++i) {
+        if (Find(object_ids[i], &(*entries)[i])) {
+            (*found)[i] = true;
+            found_num++;
+        }
+    }
+    return found_num;
+}
+
+void SealedTable::Delete(int64_t object_id) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    IndexEntry entry;
+    if (!Find(object_id, &entry)) {
+        return;
+    }
+    entry.size = -1;
+    ScopedWriteLocker changes_lock(changes_lock_);
+    changes_[object_id] = entry;
+    __atomic_store_n(&has_changes_, true, __ATOMIC_RELEASE);
+    __atomic_store_n(&size_, size_ - 1, __ATOMIC_RELAXED);
+}
+
+void SealedTable::Dump(std::vector<IndexEntry>* entries) {
+    ScopedLocker<MutexLock> lock(write_lock_);
+    entries->clear();
+    entries->reserve(size_);
+    for (int64_t i = 0; i < num_entries_; ++i) {
+        if (!has_changes_ || changes_.count(entries_[i].object_id) == 0) {
+            entries->push_back(entries_[i]);
+        }
+    }
+    std::map<int64_t, IndexEntry>::const_iterator it = changes_.begin();
+    for (; it != changes_.end(); ++it) {
+        if (it->second.size >= 0) {
+            entries->push_back(it->second);
+        }
+    }
+}
+
+int64_t SealedTable::size() {
+    return __atomic_load_n(&size_, __ATOMIC_RELAXED);
+}
+
+bool SealedTable::Find(int64_t object_id, IndexEntry* entry) {
+    if (__atomic_load_n(&has_changes_, __ATOMIC_ACQUIRE)) {
+        ScopedReadLocker changes_lock(changes_lock_);
+        std::map<int64_t, IndexEntry>::const_iterator it = changes_.find(object_id);
+        if (it != changes_.end()) {
+            if (it->second.size < 0) {
+                return false;
+            }
+            *entry = it->second;
+            return true;
+        }
+    }
+    return FindInTable(object_id, entry);
+}
+
+bool SealedTable::FindInTable(int64_t object_id, IndexEntry* entry) {
+    IndexEntry key;
+    key.object_id = object_id;
+    const IndexEntry* end = entries_ + num_entries_;
+    const IndexEntry* it = std::lower_bound(entries_, end, key, ObjectIdLess);
+    if (it == end || it->object_id != object_id) {
+        return false;
+    }
+    *entry = *it;
+    return true;
+}
+
+bool SealedTable::InsertInternal(const IndexEntry& new_entry, IndexEntry* old_entry) {
+    if (Find(new_entry.object_id, old_entry)) {
+        return false;
+    }
+    ScopedWriteLocker changes_lock(changes_lock_);
+    changes_[new_entry.object_id] = new_entry;
+    __atomic_store_n(&has_changes_, true, __ATOMIC_RELEASE);
+    __atomic_store_n(&size_, size_ + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file sealed_table.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/09 10:16:32
+ * @brief on-disk index of a sealed block: a table of index entries sorted by object id and
+ *        a footer, appended to the data file
+ *
+*/
+#ifndef _EAGLEFS_SEALED_TABLE_H_
+#define _EAGLEFS_SEALED_TABLE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "eagleengine/block_index.h"
+#include "eagleengine/status.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+static const uint64_t kSealedMagicNumber = 0x5e5e5e5e5e5e5e5eul;
+
+// the last bytes of data file of a sealed block; magic_number is the last field, so that
+// a sealed block is recognized by the tail of data file
+struct SealedFooter {
+    // num_entries entries sorted by object id start at table_offset, which is also the end
+    // of objects; the table is followed by the footer
+    int64_t table_offset;
+    int64_t num_entries;
+    int64_t max_sequence_number;
+    // objects ever put into the block, including deleted ones
+    int64_t num_objects;
+    uint32_t table_crc;
+    // covers the fields before it
+    uint32_t footer_crc;
+    char reserved[8];
+    int64_t magic_number;
+
+    SealedFooter() : table_offset(0), num_entries(0), max_sequence_number(-1), num_objects(0),
+                     table_crc(0), footer_crc(0), magic_number(kSealedMagicNumber) {
+        memset(reserved, 0, sizeof(reserved));
+    }
+};
+
+// Note:
+// 1. Load maps the table of a sealed block rather than reading it, so opening a sealed block
+//    takes a read of the footer whatever the number of objects; a lookup is a binary search
+//    of the table, which is paged in on demand;
+// 2. a sealed block rejects puts but not deletes; entries inserted or deleted after loading
+//    are kept in a map of changes, thus it is still a complete BlockIndex
+//
+class SealedTable : public BlockIndex {
+public:
+    virtual ~SealedTable();
+
+    // write entries, which should be sorted by object id, and the footer to fd at
+    // footer->table_offset; crcs of footer are set
+    static Status Write(int fd, const std::vector<IndexEntry>& entries, SealedFooter* footer);
+    // the same as Write, but the table is written by batches so that it needn't be in memory
+    // as a whole: each WriteEntries appends num entries after the ones written before, which
+    // are counted by the footer, and WriteFooter follows the last batch
+    static Status WriteEntries(int fd, const IndexEntry* entries, int64_t num,
+                               SealedFooter* footer);
+    static Status WriteFooter(int fd, SealedFooter* footer);
+    // load the table from data file of file_size bytes; *result is NULL if it is not sealed;
+    // table crc is checked only if verify is set, the footer is always checked
+    static Status Load(int fd, int64_t file_size, bool verify, SealedTable** result,
+                       SealedFooter* footer);
+
+    virtual bool Insert(const IndexEntry& new_entry, IndexEntry* old_entry);
+    virtual int InsertBatch(const std::vector<IndexEntry>& new_entries, IndexEntry* old_entry);
+    virtual int BulkInsert(std::vector<IndexEntry>* entries, IndexEntry* old_entry);
+    virtual bool Get(int64_t object_id, IndexEntry* entry);
+    virtual int GetBatch(const std::vector<int64_t>& object_ids,
+                         std::vector<IndexEntry>* entries, std::vector<bool>* found);
+    virtual void Delete(int64_t object_id);
+    virtual void Dump(std::vector<IndexEntry>* entries);
+    virtual int64_t size();
+
+private:
+    SealedTable(void* map_addr, int64_t map_size, const IndexEntry* entries,
+                int64_t num_entries);
+    DISALLOW_COPY_AND_ASSIGN(SealedTable);
+
+    bool Find(int64_t object_id, IndexEntry* entry);
+    bool FindInTable(int64_t object_id, IndexEntry* entry);
+    // following are called with write_lock_ held
+    bool InsertInternal(const IndexEntry& new_entry, IndexEntry* old_entry);
+
+    void* map_addr_;
+    int64_t map_size_;
+    const IndexEntry* entries_;
+    int64_t num_entries_;
+
+    // changes after loading, a deleted entry is marked by size -1; readers lock it only if
+    // there are changes
+    volatile bool has_changes_;
+    std::map<int64_t, IndexEntry> changes_;
+    RWLock changes_lock_;
+
+    // serialize writers
+    MutexLock write_lock_;
+    int64_t size_;
+};
+
+}
+
+#endif  //_EAGLEFS_SEALED_TABLE_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
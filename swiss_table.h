@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file swiss_table.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/12 15:03:41
+ * @brief open addressing hash table, probing groups of 16 control bytes with SSE2
+ *
+*/
+#ifndef _EAGLEFS_SWISS_TABLE_H_
+#define _EAGLEFS_SWISS_TABLE_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "eagleengine/common.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// Note:
+// 1. values are stored inline in a power of two array, one control byte per slot: the
+//    low 7 bits of hash for a full slot, or kCtrlEmpty/kCtrlDeleted;
+// 2. slots are probed by aligned groups of 16, matching control bytes of a whole group
+//    at once; probing stops at the first group with an empty slot;
+// 3. the table grows when more than 7/8 slots are used, including deleted ones;
+// 4. it has the same interface & locking with HashTable;
+//
+template <typename T>
+class SwissTable {
+public:
+    explicit SwissTable(int64_t expected_num) {
+        size_ = 0;
+        deleted_ = 0;
+        ctrl_ = NULL;
+        slots_ = NULL;
+        capacity_ = 0;
+        Resize(CapacityFor(expected_num));
+    }
+
+    virtual ~SwissTable() {
+        delete[] ctrl_;
+        delete[] slots_;
+    }
+
+    bool Insert(const T& new_value, T* old_value) {
+        ScopedWriteLocker lock(lock_);
+        return InsertInternal(new_value, old_value);
+    }
+
+    int InsertBatch(const std::vector<T>& new_values, T* old_value) {
+        ScopedWriteLocker lock(lock_);
+        int num = (int)new_values.size();
+        Reserve(size_ + num);
+        for (int i = 0; i < num; ++i) {
+            if (!InsertInternal(new_values[i], old_value)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // same as InsertBatch, except that values maybe reordered by other tables
+    int BulkInsert(std::vector<T>* values, T* old_value) {
+        return InsertBatch(*values, old_value);
+    }
+
+    bool Get(int64_t key, T* value) {
+        ScopedReadLocker lock(lock_);
+        int64_t pos = Find(key);
+        if (pos < 0) {
+            return false;
+        }
+        *value = slots_[pos];
+        return true;
+    }
+
+    int GetBatch(const std::vector<int64_t>& keys, std::vector<T>* values,
+                 std::vector<bool>* found) {
+        ScopedReadLocker lock(lock_);
+        int num = (int)keys.size();
+        int found_num = 0;
+        values->resize(num);
+        found->assign(num, false);
+        for (int i = 0; i < num; ++i) {
+            int64_t pos = Find(keys[i]);
+            if (pos >= 0) {
+                (*values)[i] = slots_[pos];
+                (*found)[i] = true;
+                found_num++;
+            }
+        }
+        return found_num;
+    }
+
+    void Delete(int64_t key) {
+        ScopedWriteLocker lock(lock_);
+        int64_t pos = Find(key);
+        if (pos < 0) {
+            return;
+        }
+        // a probe never passes a group with an empty slot, so the slot can be reused as
+        // empty if its group has one; otherwise it is a tombstone
+        int64_t group = pos & ~(int64_t)(kGroupSize - 1);
+        if (MatchEmpty(group) != 0) {
+            ctrl_[pos] = kCtrlEmpty;
+        } else {
+            ctrl_[pos] = kCtrlDeleted;
+            deleted_++;
+        }
+        size_--;
+    }
+
+    void Dump(std::vector<T>* values) {
+        ScopedReadLocker lock(lock_);
+        values->clear();
+        values->reserve(size_);
+        for (int64_t i = 0; i < capacity_; ++i) {
+            if (IsFull(ctrl_[i])) {
+                values->push_back(slots_[i]);
+            }
+        }
+    }
+
+    int64_t size() {
+        ScopedReadLocker lock(lock_);
+        return size_;
+    }
+
+    int64_t capacity() {
+        ScopedReadLocker lock(lock_);
+        return capacity_;
+    }
+
+private:
+    static const int kGroupSize = 16;
+    static const int8_t kCtrlEmpty = -128;
+    static const int8_t kCtrlDeleted = -2;
+
+    DISALLOW_COPY_AND_ASSIGN(SwissTable);
+
+    static bool IsFull(int8_t ctrl) {
+        return ctrl >= 0;
+    }
+
+    // murmur3 finalizer, keys are sequence numbers which are far from random
+    static uint64_t Hash(int64_t key) {
+        uint64_t h = (uint64_t)key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdul;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ul;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static int64_t CapacityFor(int64_t num) {
+        int64_t capacity = kGroupSize;
+        while (capacity * 7 / 8 < num) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    // bit i is set if ctrl byte i of the group equals to ctrl
+    uint32_t Match(int64_t group, int8_t ctrl) const {
+#ifdef __SSE2__
+        __m128i ctrls = _mm_loadu_si128((const __m128i*)(ctrl_ + group));
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrls, _mm_set1_epi8(ctrl)));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < kGroupSize; ++i) {
+            if (ctrl_[group + i] == ctrl) {
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    uint32_t MatchEmpty(int64_t group) const {
+        return Match(group, kCtrlEmpty);
+    }
+
+    // bit i is set if slot i of the group is empty or deleted
+    uint32_t MatchEmptyOrDeleted(int64_t group) const {
+#ifdef __SSE2__
+        __m128i ctrls = _mm_loadu_si128((const __m128i*)(ctrl_ + group));
+        return (uint32_t)_mm_movemask_epi8(ctrls);
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < kGroupSize; ++i) {
+            if (!IsFull(ctrl_[group + i])) {
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // return position of key, or -1
+    int64_t Find(int64_t key) const {
+        uint64_t hash = Hash(key);
+        int8_t h2 = (int8_t)(hash & 0x7f);
+        int64_t group_mask = (capacity_ / kGroupSize) - 1;
+        int64_t group_index = (int64_t)(hash >> 7) & group_mask;
+        for (int64_t step = 1; ; ++step) {
+            int64_t group = group_index * kGroupSize;
+            uint32_t mask = Match(group, h2);
+            while (mask != 0) {
+                int64_t pos = group + __builtin_ctz(mask);
+                if (slots_[pos].key() == key) {
+                    return pos;
+                }
+                mask &= mask - 1;
+            }
+            if (MatchEmpty(group) != 0) {
+                return -1;
+            }
+            // triangular probing visits every group once
+            group_index = (group_index + step) & group_mask;
+        }
+    }
+
+    // caller should hold the write lock
+    bool InsertInternal(const T& new_value, T* old_value) {
+        int64_t key = new_value.key();
+        int64_t pos = Find(key);
+        if (pos >= 0) {
+            *old_value = slots_[pos];
+            return false;
+        }
+
+        if ((size_ + deleted_ + 1) > capacity_ * 7 / 8) {
+            // grow if more than half slots are live, otherwise only drop tombstones
+            Resize(size_ + 1 > capacity_ / 2 ? capacity_ * 2 : capacity_);
+        }
+        InsertNew(new_value);
+        return true;
+    }
+
+    // key should not be in table, and there should be free slots
+    void InsertNew(const T& new_value) {
+        uint64_t hash = Hash(new_value.key());
+        int64_t group_mask = (capacity_ / kGroupSize) - 1;
+        int64_t group_index = (int64_t)(hash >> 7) & group_mask;
+        for (int64_t step = 1; ; ++step) {
+            int64_t group = group_index * kGroupSize;
+            uint32_t mask = MatchEmptyOrDeleted(group);
+            if (mask != 0) {
+                int64_t pos = group + __builtin_ctz(mask);
+                if (ctrl_[pos] == kCtrlDeleted) {
+                    deleted_--;
+                }
+                ctrl_[pos] = (int8_t)(hash & 0x7f);
+                slots_[pos] = new_value;
+                size_++;
+                return;
+            }
+            group_index = (group_index + step) & group_mask;
+        }
+    }
+
+    void Reserve(int64_t num) {
+        if (num + deleted_ > capacity_ * 7 / 8) {
+            Resize(CapacityFor(num));
+        }
+    }
+
+    void Resize(int64_t new_capacity) {
+        int8_t* old_ctrl = ctrl_;
+        T* old_slots = slots_;
+        int64_t old_capacity = capacity_;
+
+        ctrl_ = new int8_t[new_capacity];
+        memset(ctrl_, kCtrlEmpty, new_capacity);
+        slots_ = new T[new_capacity];
+        capacity_ = new_capacity;
+        size_ = 0;
+        deleted_ = 0;
+        for (int64_t i = 0; i < old_capacity; ++i) {
+            if (IsFull(old_ctrl[i])) {
+                InsertNew(old_slots[i]);
+            }
+        }
+        delete[] old_ctrl;
+        delete[] old_slots;
+    }
+
+private:
+    int8_t* ctrl_;
+    T* slots_;
+    int64_t capacity_;
+    int64_t size_;
+    int64_t deleted_;
+
+    RWLock lock_;
+};
+
+}
+
+#endif  //_EAGLEFS_SWISS_TABLE_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file sync_scheduler.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/05 10:22:15
+ * @brief
+ *
+*/
+#include <algorithm>
+#include "eagleengine/eagleblock.h"
+#include "eagleengine/sync_scheduler.h"
+
+namespace eagleengine {
+
+SyncScheduler::SyncScheduler(const SyncOptions& options) : options_(options), cond_(&lock_) {
+    notified_ = false;
+    stopping_ = false;
+    started_ = false;
+}
+
+SyncScheduler::~SyncScheduler() {
+    Stop();
+    ScopedLocker<MutexLock> lock(blocks_lock_);
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        blocks_[i]->sync_scheduler_ = NULL;
+    }
+    blocks_.clear();
+}
+
+Status SyncScheduler::Start() {
+    Status status;
+    if (started_) {
+        return status;
+    }
+    if (pthread_create(&thread_, NULL, ThreadFunc, this) != 0) {
+        status.set_code(kInternalError);
+        status.set_msg("failed to create sync thread");
+        return status;
+    }
+    started_ = true;
+    return status;
+}
+
+void SyncScheduler::Stop() {
+    if (!started_) {
+        return;
+    }
+    {
+        ScopedLocker<MutexLock> lock(lock_);
+        stopping_ = true;
+        cond_.SignalAll();
+    }
+    pthread_join(thread_, NULL);
+    started_ = false;
+}
+
+void SyncScheduler::AddBlock(EagleBlock* block) {
+    ScopedLocker<MutexLock> lock(blocks_lock_);
+    if (std::find(blocks_.begin(), blocks_.end(), block) == blocks_.end()) {
+        blocks_.push_back(block);
+        block->sync_scheduler_ = this;
+    }
+}
+
+void SyncScheduler::RemoveBlock(EagleBlock* block) {
+    // wait until the block is not being checked
+    ScopedLocker<MutexLock> lock(blocks_lock_);
+    std::vector<EagleBlock*>::iterator it = std::find(blocks_.begin(), blocks_.end(), block);
+    if (it != blocks_.end()) {
+        blocks_.erase(it);
+        block->sync_scheduler_ = NULL;
+    }
+}
+
+void SyncScheduler::Notify() {
+    ScopedLocker<MutexLock> lock(lock_);
+    notified_ = true;
+    cond_.SignalAll();
+}
+
+void* SyncScheduler::ThreadFunc(void* arg) {
+    SyncScheduler* scheduler = (SyncScheduler*)arg;
+    scheduler->Run();
+    return NULL;
+}
+
+void SyncScheduler::Run() {
+    while (true) {
+        {
+            ScopedLocker<MutexLock> lock(lock_);
+            if (!notified_ && !stopping_) {
+                cond_.TimedWait(options_.check_interval_ms);
+            }
+            notified_ = false;
+            if (stopping_) {
+                break;
+            }
+        }
+        CheckBlocks(false);
+    }
+    // the last chance for waiters
+    CheckBlocks(true);
+}
+
+void SyncScheduler::CheckBlocks(bool force) {
+    ScopedLocker<MutexLock> lock(blocks_lock_);
+    int64_t now = NowMicros();
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        EagleBlock* block = blocks_[i];
+        int64_t unsynced_bytes = block->unsynced_bytes();
+        if (unsynced_bytes <= 0 && block->sync_waiters() <= 0) {
+            continue;
+        }
+
+        if (force || block->sync_waiters() > 0 || unsynced_bytes >= options_.sync_bytes ||
+                now - block->last_sync_time() >= options_.sync_interval_ms * 1000) {
+            // errors are logged by the block and returned to its waiters
+            block->Sync();
+        } else if (options_.writeback_bytes > 0 &&
+                   block->unwritten_back_bytes() >= options_.writeback_bytes) {
+            block->StartWriteback();
+        }
+    }
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
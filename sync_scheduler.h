@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file sync_scheduler.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/08/05 10:21:37
+ * @brief background thread which syncs blocks by dirty bytes, elapsed time or waiters
+ *
+*/
+#ifndef _EAGLEFS_SYNC_SCHEDULER_H_
+#define _EAGLEFS_SYNC_SCHEDULER_H_
+
+#include <pthread.h>
+#include <vector>
+#include "eagleengine/common.h"
+#include "eagleengine/status.h"
+#include "eagleengine/concurrent/cond_var.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+class EagleBlock;
+
+struct SyncOptions {
+    // sync a block once it has so many unsynced bytes
+    int64_t sync_bytes;
+    // sync a block with unsynced writes if it is not synced for so long
+    int64_t sync_interval_ms;
+    // start writeback of a block without waiting once it has so many bytes not written
+    // back, so that the next sync has less to flush; 0 means never
+    int64_t writeback_bytes;
+    // how often blocks are checked if nobody wakes up the scheduler
+    int64_t check_interval_ms;
+
+    SyncOptions() : sync_bytes(4 * 1024 * 1024), sync_interval_ms(1000),
+                    writeback_bytes(1024 * 1024), check_interval_ms(10) {
+    }
+};
+
+// Note:
+// 1. one scheduler can be shared by many blocks, blocks are synced one by one in the
+//    scheduler thread; writers are never blocked by syncing;
+// 2. a block is removed from its scheduler when it is deleted; all blocks are synced once
+//    more when the scheduler is stopped;
+//
+class SyncScheduler {
+public:
+    explicit SyncScheduler(const SyncOptions& options);
+    ~SyncScheduler();
+
+    Status Start();
+    void Stop();
+
+    void AddBlock(EagleBlock* block);
+    void RemoveBlock(EagleBlock* block);
+
+    // wake up the scheduler to check blocks immediately, eg. somebody waits for sync
+    void Notify();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SyncScheduler);
+    static void* ThreadFunc(void* arg);
+    void Run();
+    // force: sync all blocks with unsynced writes
+    void CheckBlocks(bool force);
+
+    SyncOptions options_;
+
+    // protect notified_ & stopping_
+    MutexLock lock_;
+    CondVar cond_;
+    bool notified_;
+    bool stopping_;
+
+    // protect blocks_, it is held while blocks are checked
+    MutexLock blocks_lock_;
+    std::vector<EagleBlock*> blocks_;
+
+    pthread_t thread_;
+    bool started_;
+};
+
+}
+
+#endif  //_EAGLEFS_SYNC_SCHEDULER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
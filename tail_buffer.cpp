@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file tail_buffer.cpp
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/23 10:41:18
+ * @brief
+ *
+*/
+#include "eagleengine/tail_buffer.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace eagleengine {
+
+TailBuffer::TailBuffer(int64_t capacity, int64_t offset, int64_t index_offset)
+        : capacity_(capacity), base_(offset), end_(offset), flushed_(offset), full_(false),
+          index_flushed_(index_offset) {
+    data_ = new char[capacity];
+}
+
+TailBuffer::~TailBuffer() {
+    delete[] data_;
+}
+
+bool TailBuffer::Reserve(int64_t offset, int64_t size) {
+    ScopedLocker<MutexLock> lock(meta_lock_);
+    if (offset == end_ && offset + size <= base_ + capacity_) {
+        __atomic_store_n(&end_, offset + size, __ATOMIC_RELEASE);
+        return true;
+    }
+    if (flushed_ == end_ && size <= capacity_) {
+        // all data in the buffer is flushed, restart from this write
+        ScopedWriteLocker data_lock(data_lock_);
+        base_ = offset;
+        flushed_ = offset;
+        full_ = false;
+        __atomic_store_n(&end_, offset + size, __ATOMIC_RELEASE);
+        return true;
+    }
+    full_ = true;
+    return false;
+}
+
+void TailBuffer::Write(int64_t offset, const struct iovec* iov, int iovcnt) {
+    // the reserved range cannot be moved until it is flushed, no lock is needed
+    char* dest = data_ + (offset - base_);
+    for (int i = 0; i < iovcnt; ++i) {
+        memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+        dest += iov[i].iov_len;
+    }
+}
+
+bool TailBuffer::Read(int64_t offset, int64_t size, char* buf) {
+    ScopedReadLocker data_lock(data_lock_);
+    if (offset < base_ || offset + size > __atomic_load_n(&end_, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    memcpy(buf, data_ + (offset - base_), size);
+    return true;
+}
+
+void TailBuffer::AppendIndex(const void* entries, int64_t size) {
+    ScopedLocker<MutexLock> lock(meta_lock_);
+    index_.append((const char*)entries, size);
+}
+
+bool TailBuffer::NeedFlush(int64_t published_end) {
+    ScopedLocker<MutexLock> lock(meta_lock_);
+    int64_t pending = std::min(published_end, (int64_t)end_) - flushed_;
+    if (pending <= 0) {
+        // entries of writes which bypassed the buffer are written at once, as without it
+        return !index_.empty();
+    }
+    return pending >= capacity_ / 4 || full_ || (int64_t)index_.size() >= capacity_ / 4;
+}
+
+Status TailBuffer::Flush(int fd, int64_t published_end, int index_fd,
+                         int64_t published_index_end) {
+    Status status;
+    ScopedLocker<MutexLock> flush_lock(flush_lock_);
+    int64_t start = 0;
+    int64_t stop = 0;
+    int64_t base = 0;
+    {
+        ScopedLocker<MutexLock> lock(meta_lock_);
+        start = flushed_;
+        stop = std::min(published_end, (int64_t)end_);
+        base = base_;
+    }
+
+    // [start, stop) is copied, and it stays in the buffer until flushed
+    const char* buf = data_ + (start - base);
+    int64_t offset = start;
+    while (offset < stop) {
+        errno = 0;
+        ssize_t written_size = pwrite(fd, buf, stop - offset, offset);
+        if (written_size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written_size <= 0) {
+            status.set_code(kIOError);
+            status.set_msg("failed to flush tail buffer at offset %ld, %m", offset);
+            break;
+        }
+        buf += written_size;
+        offset += written_size;
+    }
+
+    std::string entries;
+    {
+        ScopedLocker<MutexLock> lock(meta_lock_);
+        if (offset > flushed_) {
+            flushed_ = offset;
+        }
+        if (status.code() != kOk) {
+            return status;
+        }
+        // copied out, since entries are appended meanwhile
+        int64_t size = std::min(published_index_end - index_flushed_, (int64_t)index_.size());
+        if (size > 0) {
+            entries.assign(index_, 0, size);
+        }
+        offset = index_flushed_;
+    }
+
+    const char* entries_buf = entries.data();
+    int64_t written = 0;
+    while (written < (int64_t)entries.size()) {
+        errno = 0;
+        ssize_t written_size = pwrite(index_fd, entries_buf + written,
+                                      entries.size() - written, offset + written);
+        if (written_size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written_size <= 0) {
+            status.set_code(kIOError);
+            status.set_msg("failed to flush index entries at offset %ld, %m",
+                           offset + written);
+            break;
+        }
+        written += written_size;
+    }
+
+    ScopedLocker<MutexLock> lock(meta_lock_);
+    // the rest is written by the next flush
+    index_.erase(0, written);
+    index_flushed_ += written;
+    return status;
+}
+
+int64_t TailBuffer::flushed_offset() {
+    ScopedLocker<MutexLock> lock(meta_lock_);
+    return flushed_;
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017 LIHAIBING. All Rights Reserved
+ *
+ * @file tail_buffer.h
+ * @author lihaibing(593255200@qq.com)
+ * @date 2017/09/23 10:41:18
+ * @brief memory copy of the tail of data file, written back in large chunks
+ *
+*/
+#ifndef _EAGLEFS_TAIL_BUFFER_H_
+#define _EAGLEFS_TAIL_BUFFER_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <string>
+#include "eagleengine/common.h"
+#include "eagleengine/status.h"
+#include "eagleengine/concurrent/scoped_locker.h"
+
+namespace eagleengine {
+
+// Note:
+// 1. the buffer holds data file in [base_, end_); writes reserved at end_ are copied into
+//    the buffer instead of written to data file, and Flush writes the copied prefix to data
+//    file with one pwrite; a write which doesn't fit is written to data file directly by the
+//    caller, and the buffer restarts from the next write once all its data is flushed;
+// 2. Read serves published objects in the buffer, flushed or not, until the buffer restarts;
+// 3. Reserve should be called in order of file offsets, ie. with write lock of the block
+//    held; Flush is given the end of published data, all data before it has been copied;
+// 4. index entries are not written to index file by writers, since they may refer to data
+//    in the buffer; they are appended in publish order, and Flush writes those published
+//    before published_index_end after the data, thus index file never refers to data which
+//    is not written after a crash, and it stays a valid prefix to replay
+//
+class TailBuffer {
+public:
+    // data file ends at offset, index file ends at index_offset
+    TailBuffer(int64_t capacity, int64_t offset, int64_t index_offset);
+    ~TailBuffer();
+
+    // whether data of [offset, offset + size) should be copied into the buffer by Write
+    bool Reserve(int64_t offset, int64_t size);
+    void Write(int64_t offset, const struct iovec* iov, int iovcnt);
+    // false if [offset, offset + size) is not in the buffer
+    bool Read(int64_t offset, int64_t size, char* buf);
+
+    // append index entries of size bytes, in the order they are published
+    void AppendIndex(const void* entries, int64_t size);
+
+    // whether copied data before published_end is large enough for a flush, or index
+    // entries can be written without waiting for data
+    bool NeedFlush(int64_t published_end);
+    // data before published_end and index entries before published_index_end are written;
+    // entries are not written if the data failed
+    Status Flush(int fd, int64_t published_end, int index_fd, int64_t published_index_end);
+    // data before it is in data file
+    int64_t flushed_offset();
+    int64_t capacity() {
+        return capacity_;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(TailBuffer);
+
+    char* data_;
+    int64_t capacity_;
+
+    // protect base_, which changes only when the buffer restarts; readers hold it while
+    // copying out of data_
+    RWLock data_lock_;
+    int64_t base_;
+    // protect end_, flushed_ & full_; end_ is read by readers without it
+    MutexLock meta_lock_;
+    volatile int64_t end_;
+    int64_t flushed_;
+    // a write didn't fit since the last restart
+    bool full_;
+    // index entries not written yet, index file ends at index_flushed_ before them; protected
+    // by meta_lock_ too
+    std::string index_;
+    int64_t index_flushed_;
+    // serialize flushes
+    MutexLock flush_lock_;
+};
+
+}
+
+#endif  //_EAGLEFS_TAIL_BUFFER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
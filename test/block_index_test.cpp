@@ -0,0 +1,381 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: gtest for block index
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-8-26
+*
+*/
+
+#define private public
+
+#include <map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include "gperftools/heap-checker.h"
+#include "eagleengine/block_index.h"
+#include "eagleengine/dense_index.h"
+#include "eagleengine/sealed_index.h"
+#include "eagleengine/sealed_table.h"
+#include "gtest/gtest.h"
+
+int main(int argc, char** argv) {
+
+    testing::InitGoogleTest(&argc, argv);
+    int code = RUN_ALL_TESTS();
+
+    return code;
+}
+
+namespace eagleengine {
+
+class BlockIndexTest: public ::testing::TestWithParam<IndexType> {
+public:
+    virtual void SetUp() {
+    }
+    virtual void TearDown() {
+    }
+};
+
+static IndexEntry MakeEntry(int64_t object_id, int64_t offset, int size) {
+    IndexEntry entry;
+    entry.sequence_number = object_id;
+    entry.object_id = object_id;
+    entry.offset = offset;
+    entry.size = size;
+    return entry;
+}
+
+TEST_P(BlockIndexTest, InsertGetDelete)
+{
+    BlockIndex* index = BlockIndex::Create(GetParam(), 97);
+
+    // ids skip sequence numbers used by deletes
+    for (int i = 0; i < 3000; i++)
+    {
+        if (i % 10 == 9) {
+            continue;
+        }
+        IndexEntry old;
+        EXPECT_TRUE(index->Insert(MakeEntry(i, i * 1024L + 32, 1000 + i), &old));
+    }
+    EXPECT_EQ(index->size(), 2700);
+
+    IndexEntry entry;
+    for (int i = 0; i < 3000; i++)
+    {
+        EXPECT_EQ(index->Get(i, &entry), i % 10 != 9);
+        if (i % 10 != 9) {
+            EXPECT_EQ(entry.sequence_number, i);
+            EXPECT_EQ(entry.object_id, i);
+            EXPECT_EQ(entry.offset, i * 1024L + 32);
+            EXPECT_EQ(entry.size, 1000 + i);
+        }
+    }
+    EXPECT_FALSE(index->Get(-1, &entry));
+    EXPECT_FALSE(index->Get(3000, &entry));
+    EXPECT_FALSE(index->Get(1L << 40, &entry));
+
+    // insert exist
+    IndexEntry old;
+    EXPECT_FALSE(index->Insert(MakeEntry(5, 0, 1), &old));
+    EXPECT_EQ(old.offset, 5 * 1024 + 32);
+
+    for (int i = 0; i < 3000; i += 2)
+    {
+        index->Delete(i);
+    }
+    index->Delete(1L << 40);
+    EXPECT_EQ(index->size(), 1200);
+    std::vector<IndexEntry> entries;
+    index->Dump(&entries);
+    EXPECT_EQ(entries.size(), 1200u);
+    std::map<int64_t, IndexEntry> dumped;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        dumped[entries[i].object_id] = entries[i];
+    }
+    for (int i = 0; i < 3000; i++)
+    {
+        bool live = i % 2 == 1 && i % 10 != 9;
+        EXPECT_EQ(index->Get(i, &entry), live);
+        EXPECT_EQ(dumped.count(i), live ? 1u : 0u);
+        if (live) {
+            EXPECT_EQ(dumped[i].offset, i * 1024L + 32);
+            EXPECT_EQ(dumped[i].size, 1000 + i);
+        }
+    }
+
+    // batch
+    std::vector<IndexEntry> new_entries;
+    new_entries.push_back(MakeEntry(5000, 1, 1));
+    new_entries.push_back(MakeEntry(1, 1, 1));
+    new_entries.push_back(MakeEntry(5001, 1, 1));
+    EXPECT_EQ(index->InsertBatch(new_entries, &old), 1);
+    EXPECT_EQ(old.object_id, 1);
+    EXPECT_TRUE(index->Get(5000, &entry));
+    EXPECT_FALSE(index->Get(5001, &entry));
+
+    std::vector<int64_t> ids;
+    ids.push_back(3);
+    ids.push_back(4);
+    ids.push_back(5000);
+    std::vector<bool> found;
+    EXPECT_EQ(index->GetBatch(ids, &entries, &found), 2);
+    EXPECT_TRUE(found[0]);
+    EXPECT_FALSE(found[1]);
+    EXPECT_EQ(entries[0].offset, 3 * 1024 + 32);
+
+    delete index;
+}
+
+TEST_P(BlockIndexTest, BulkInsert)
+{
+    BlockIndex* index = BlockIndex::Create(GetParam(), 97);
+    std::vector<IndexEntry> entries;
+    for (int i = 10000; i >= 100; i--)
+    {
+        entries.push_back(MakeEntry(i, i * 100L, 100));
+    }
+    IndexEntry old;
+    EXPECT_EQ(index->BulkInsert(&entries, &old), -1);
+    EXPECT_EQ(index->size(), 9901);
+    IndexEntry entry;
+    for (int i = 0; i < 10100; i++)
+    {
+        EXPECT_EQ(index->Get(i, &entry), i >= 100 && i <= 10000);
+    }
+    delete index;
+}
+
+INSTANTIATE_TEST_CASE_P(AllTypes, BlockIndexTest,
+                        ::testing::Values(kHashIndex, kSwissIndex, kDenseIndex));
+
+TEST(DenseIndexTest, Overflow)
+{
+    DenseIndex index;
+    IndexEntry old;
+    IndexEntry entry;
+
+    // out of order inserts lower the base offset of a chunk
+    EXPECT_TRUE(index.Insert(MakeEntry(130, 5000, 10), &old));
+    EXPECT_TRUE(index.Insert(MakeEntry(129, 1000, 10), &old));
+    EXPECT_TRUE(index.Insert(MakeEntry(3, 100, 10), &old));
+    EXPECT_EQ(index.base_id_, 0);
+    EXPECT_TRUE(index.overflow_.empty());
+    EXPECT_TRUE(index.Get(130, &entry));
+    EXPECT_EQ(entry.offset, 5000);
+    EXPECT_TRUE(index.Get(129, &entry));
+    EXPECT_EQ(entry.offset, 1000);
+
+    // offsets too far from the chunk, sequence number differs from object id, or the id is
+    // too far from others
+    EXPECT_TRUE(index.Insert(MakeEntry(131, 5000 + (1L << 33), 10), &old));
+    IndexEntry odd = MakeEntry(132, 6000, 10);
+    odd.sequence_number = 7;
+    EXPECT_TRUE(index.Insert(odd, &old));
+    EXPECT_TRUE(index.Insert(MakeEntry(1L << 40, 100, 10), &old));
+    EXPECT_EQ(index.overflow_.size(), 3u);
+    EXPECT_EQ(index.size(), 6);
+    EXPECT_TRUE(index.Get(131, &entry));
+    EXPECT_EQ(entry.offset, 5000 + (1L << 33));
+    EXPECT_TRUE(index.Get(132, &entry));
+    EXPECT_EQ(entry.sequence_number, 7);
+    EXPECT_FALSE(index.Insert(MakeEntry(1L << 40, 100, 10), &old));
+
+    index.Delete(131);
+    index.Delete(132);
+    index.Delete(1L << 40);
+    EXPECT_TRUE(index.overflow_.empty());
+
+    // empty chunks are freed
+    EXPECT_EQ(index.num_chunks_, 2);
+    index.Delete(129);
+    index.Delete(130);
+    EXPECT_EQ(index.num_chunks_, 1);
+    EXPECT_EQ(index.size(), 1);
+}
+
+TEST(DenseIndexTest, MemoryUsage)
+{
+    DenseIndex index;
+    IndexEntry old;
+    int64_t offset = 0;
+    const int num = 100000;
+    for (int i = 0; i < num; i++)
+    {
+        EXPECT_TRUE(index.Insert(MakeEntry(i, offset, 4096 + i % 1000), &old));
+        offset += 4096 + i % 1000 + 32;
+    }
+    EXPECT_TRUE(index.overflow_.empty());
+    EXPECT_LE(index.memory_usage(), num * 9);
+}
+
+TEST(SealedIndexTest, EliasFano)
+{
+    std::vector<uint64_t> values;
+    uint64_t value = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        values.push_back(value);
+        // runs of equal values and large gaps
+        value += (i % 7 == 0) ? 0 : (i % 13 == 0 ? 1000000 : i % 100);
+    }
+    EliasFano ef;
+    ef.Build(values, value + 1);
+    EXPECT_EQ(ef.size(), 10000);
+    for (int i = 0; i < 10000; i++)
+    {
+        EXPECT_EQ(ef.Get(i), values[i]);
+    }
+
+    EliasFano empty;
+    empty.Build(std::vector<uint64_t>(), 1);
+    EXPECT_EQ(empty.size(), 0);
+}
+
+TEST(SealedIndexTest, Build)
+{
+    // objects of 100..5099 with a header before each; every 5th sequence number is a delete,
+    // and every 3rd object is deleted
+    std::vector<IndexEntry> entries;
+    std::map<int64_t, IndexEntry> expected;
+    int64_t offset = 0;
+    for (int i = 100; i < 5100; i++)
+    {
+        if (i % 5 == 0) {
+            continue;
+        }
+        int size = (i * 7919) % 20000;
+        offset += 32;
+        IndexEntry entry = MakeEntry(i, offset, size);
+        offset += size;
+        if (i % 3 == 0) {
+            continue;
+        }
+        entries.push_back(entry);
+        expected[i] = entry;
+    }
+    // an object written out of order, and one whose sequence number is not its id
+    IndexEntry out_of_order = MakeEntry(6000, 100, 10);
+    entries.push_back(out_of_order);
+    expected[6000] = out_of_order;
+    IndexEntry odd = MakeEntry(6001, offset + 32, 10);
+    odd.sequence_number = 1;
+    entries.push_back(odd);
+    expected[6001] = odd;
+    std::random_shuffle(entries.begin(), entries.end());
+
+    SealedIndex index;
+    index.Build(&entries);
+    EXPECT_EQ(index.size(), (int64_t)expected.size());
+    EXPECT_EQ(index.overflow_.size(), 2u);
+    EXPECT_EQ(index.base_id_, 101);
+
+    IndexEntry entry;
+    for (int i = 0; i < 6100; i++)
+    {
+        std::map<int64_t, IndexEntry>::iterator it = expected.find(i);
+        EXPECT_EQ(index.Get(i, &entry), it != expected.end());
+        if (it != expected.end()) {
+            EXPECT_EQ(entry.sequence_number, it->second.sequence_number);
+            EXPECT_EQ(entry.offset, it->second.offset);
+            EXPECT_EQ(entry.size, it->second.size);
+        }
+    }
+    EXPECT_FALSE(index.Get(-5, &entry));
+
+    // a few bytes per object, rather than a hash node of 40 bytes
+    EXPECT_LT(index.memory_usage(), (int64_t)expected.size() * 6);
+
+    // delete & insert still work
+    index.Delete(101);
+    index.Delete(6000);
+    index.Delete(100);
+    EXPECT_FALSE(index.Get(101, &entry));
+    EXPECT_FALSE(index.Get(6000, &entry));
+    IndexEntry old;
+    EXPECT_FALSE(index.Insert(MakeEntry(103, 0, 1), &old));
+    EXPECT_TRUE(index.Insert(MakeEntry(101, 5, 5), &old));
+    EXPECT_TRUE(index.Get(101, &entry));
+    EXPECT_EQ(entry.offset, 5);
+    EXPECT_EQ(index.size(), (int64_t)expected.size() - 1);
+
+    std::vector<IndexEntry> dumped;
+    index.Dump(&dumped);
+    EXPECT_EQ((int64_t)dumped.size(), index.size());
+    expected.erase(6000);
+    expected[101] = MakeEntry(101, 5, 5);
+    for (size_t i = 0; i < dumped.size(); i++)
+    {
+        std::map<int64_t, IndexEntry>::iterator it = expected.find(dumped[i].object_id);
+        ASSERT_TRUE(it != expected.end());
+        EXPECT_EQ(dumped[i].offset, it->second.offset);
+        EXPECT_EQ(dumped[i].size, it->second.size);
+    }
+}
+
+
+TEST(SealedTableTest, WriteLoad)
+{
+    int fd = open("./testsealtable/dat", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    std::vector<IndexEntry> entries;
+    for (int i = 0; i < 1000; i++)
+    {
+        entries.push_back(MakeEntry(i * 2, 4096 + i * 100L, 100));
+    }
+    SealedFooter footer;
+    footer.table_offset = 4096 + 1000 * 100;
+    footer.max_sequence_number = 2000;
+    footer.num_objects = 1200;
+    EXPECT_EQ(SealedTable::Write(fd, entries, &footer).code(), kOk);
+    const int64_t file_size = footer.table_offset + 1000 * sizeof(IndexEntry) + sizeof(footer);
+
+    // not sealed if there is no footer
+    SealedTable* table = NULL;
+    SealedFooter loaded;
+    EXPECT_EQ(SealedTable::Load(fd, footer.table_offset, true, &table, &loaded).code(), kOk);
+    EXPECT_TRUE(table == NULL);
+
+    ASSERT_EQ(SealedTable::Load(fd, file_size, true, &table, &loaded).code(), kOk);
+    ASSERT_TRUE(table != NULL);
+    EXPECT_EQ(loaded.num_objects, 1200);
+    EXPECT_EQ(loaded.max_sequence_number, 2000);
+    EXPECT_EQ(table->size(), 1000);
+    IndexEntry entry;
+    for (int i = 0; i < 2000; i++)
+    {
+        EXPECT_EQ(table->Get(i, &entry), i % 2 == 0);
+        if (i % 2 == 0) {
+            EXPECT_EQ(entry.offset, 4096 + i / 2 * 100L);
+        }
+    }
+
+    // changes after loading
+    IndexEntry old;
+    EXPECT_FALSE(table->Insert(MakeEntry(10, 0, 1), &old));
+    EXPECT_TRUE(table->Insert(MakeEntry(11, 7, 7), &old));
+    table->Delete(20);
+    table->Delete(21);
+    EXPECT_FALSE(table->Get(20, &entry));
+    EXPECT_TRUE(table->Get(11, &entry));
+    EXPECT_EQ(entry.offset, 7);
+    EXPECT_EQ(table->size(), 1000);
+    std::vector<IndexEntry> dumped;
+    table->Dump(&dumped);
+    EXPECT_EQ(dumped.size(), 1000u);
+    delete table;
+
+    // corrupted table is detected only if verified
+    int64_t bad_offset = 12345;
+    EXPECT_EQ(pwrite(fd, &bad_offset, sizeof(bad_offset), footer.table_offset + 16), 8);
+    EXPECT_EQ(SealedTable::Load(fd, file_size, true, &table, &loaded).code(), kDataCorrupted);
+    EXPECT_EQ(SealedTable::Load(fd, file_size, false, &table, &loaded).code(), kOk);
+    delete table;
+    close(fd);
+}
+}
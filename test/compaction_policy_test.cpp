@@ -0,0 +1,156 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: gtest for compaction policy
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-10-21
+*
+*/
+
+#define private public
+
+#include <algorithm>
+#include "gperftools/heap-checker.h"
+#include "eagleengine/compaction_policy.h"
+#include "eagleengine/eagleblock.h"
+#include "gtest/gtest.h"
+
+int main(int argc, char** argv) {
+
+    testing::InitGoogleTest(&argc, argv);
+    int code = RUN_ALL_TESTS();
+
+    return code;
+}
+
+namespace eagleengine {
+
+class CompactionPolicyTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        // blocks are created again by each test
+        system("rm -rf testpolicy0 testpolicy1 testpolicy2 testpolicy3; "
+               "mkdir testpolicy0 testpolicy1 testpolicy2 testpolicy3");
+        // percent of objects deleted in each block
+        const int deleted[] = {50, 80, 10, 35};
+        for (int i = 0; i < 4; i++) {
+            char path[32];
+            snprintf(path, sizeof(path), "./testpolicy%d/", i);
+            EagleBlock* block = NULL;
+            Status status = EagleBlock::CreateBlock(path, &block);
+            EXPECT_EQ(status.code(), kOk);
+            ASSERT_TRUE(block != NULL);
+            for (int j = 0; j < 100; j++) {
+                int64_t object_id = -1;
+                status = block->PutObject(std::string(10000, 'a' + i), &object_id);
+                EXPECT_EQ(status.code(), kOk);
+                if (j < deleted[i]) {
+                    status = block->DeleteObject(object_id);
+                    EXPECT_EQ(status.code(), kOk);
+                }
+            }
+            blocks_.push_back(block);
+        }
+        // sealed blocks are compacted too
+        EXPECT_EQ(blocks_[3]->Seal().code(), kOk);
+    }
+
+    virtual void TearDown() {
+        for (size_t i = 0; i < blocks_.size(); i++) {
+            delete blocks_[i];
+        }
+        blocks_.clear();
+    }
+
+    // indexes of picked blocks
+    std::vector<int> Pick(const CompactionPolicyOptions& options) {
+        CompactionPolicy policy(options);
+        std::vector<EagleBlock*> picked;
+        Status status = policy.PickBlocks(blocks_, &picked);
+        EXPECT_EQ(status.code(), kOk);
+        std::vector<int> indexes;
+        for (size_t i = 0; i < picked.size(); i++) {
+            indexes.push_back(std::find(blocks_.begin(), blocks_.end(), picked[i]) -
+                              blocks_.begin());
+        }
+        return indexes;
+    }
+
+    std::vector<EagleBlock*> blocks_;
+};
+
+static std::vector<int> Indexes(int a, int b = -1, int c = -1, int d = -1) {
+    std::vector<int> indexes;
+    const int all[] = {a, b, c, d};
+    for (int i = 0; i < 4 && all[i] >= 0; i++) {
+        indexes.push_back(all[i]);
+    }
+    return indexes;
+}
+
+TEST_F(CompactionPolicyTest, GarbageRatio)
+{
+    const int64_t object_bytes = 10000 + sizeof(ObjectHeader);
+    EXPECT_EQ(blocks_[1]->live_bytes(), 20 * object_bytes);
+    EXPECT_EQ(blocks_[1]->dead_bytes(), 80 * object_bytes);
+
+    CompactionPolicyOptions options;
+    options.min_dead_bytes = 0;
+    options.low_free_percent = 0;
+    options.max_blocks_per_disk = 0;
+    options.io_budget_bytes = 0;
+    // all blocks are on the same disk, the most garbage first
+    EXPECT_EQ(Pick(options), Indexes(1, 0, 3));
+
+    options.max_blocks_per_disk = 1;
+    EXPECT_EQ(Pick(options), Indexes(1));
+    options.max_blocks_per_disk = 0;
+
+    // not worth a compaction
+    options.min_dead_bytes = 40 * object_bytes;
+    EXPECT_EQ(Pick(options), Indexes(1, 0));
+    options.min_dead_bytes = 0;
+
+    // a block being compacted is skipped
+    blocks_[1]->SetStatus(kCompacting);
+    EXPECT_EQ(Pick(options), Indexes(0, 3));
+    blocks_[1]->SetStatus(kNormal);
+    // so is a block whose live objects are being copied
+    blocks_[1]->compacting_ = true;
+    EXPECT_EQ(Pick(options), Indexes(0, 3));
+    blocks_[1]->compacting_ = false;
+}
+
+TEST_F(CompactionPolicyTest, IOBudget)
+{
+    const int64_t object_bytes = 10000 + sizeof(ObjectHeader);
+    CompactionPolicyOptions options;
+    options.min_dead_bytes = 0;
+    options.low_free_percent = 0;
+    options.max_blocks_per_disk = 0;
+
+    // live bytes of block 1 & 0 fit, block 3 doesn't after them
+    options.io_budget_bytes = 90 * object_bytes;
+    EXPECT_EQ(Pick(options), Indexes(1, 0));
+    options.io_budget_bytes = 60 * object_bytes;
+    EXPECT_EQ(Pick(options), Indexes(1));
+    // the first block is picked even if it is larger than the budget
+    options.io_budget_bytes = object_bytes;
+    EXPECT_EQ(Pick(options), Indexes(1));
+}
+
+TEST_F(CompactionPolicyTest, LowFreeSpace)
+{
+    CompactionPolicyOptions options;
+    options.min_dead_bytes = 0;
+    options.max_blocks_per_disk = 0;
+    options.io_budget_bytes = 0;
+    // any disk is short of space, blocks with less garbage are compacted, most dead first
+    options.low_free_percent = 100;
+    options.urgent_garbage_percent = 5;
+    EXPECT_EQ(Pick(options), Indexes(1, 0, 3, 2));
+}
+
+}
@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: benchmark of object checksums, adler32 vs crc32c implementations
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-9-30
+*
+* Usage: crc32c_bench [total_mb]
+*   each function checksums total_mb of data, with buffers of several object sizes
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include "eagleengine/crc32c.h"
+
+using namespace eagleengine;
+
+typedef uint32_t (*ChecksumFunc)(const char* data, size_t n);
+
+static int64_t NowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static uint32_t Adler32(const char* data, size_t n) {
+    return Adler32_Value(data, n);
+}
+
+static uint32_t Portable(const char* data, size_t n) {
+    return ExtendPortable(0, data, n);
+}
+
+static uint32_t Sse42(const char* data, size_t n) {
+    return ExtendSse42(0, data, n);
+}
+
+static uint32_t Sse42Pclmul(const char* data, size_t n) {
+    return ExtendSse42Pclmul(0, data, n);
+}
+
+static void Bench(const char* name, ChecksumFunc func, const std::string& data,
+                  size_t object_size, int64_t total) {
+    int64_t rounds = total / object_size;
+    uint32_t sum = 0;
+    int64_t begin = NowNanos();
+    for (int64_t i = 0; i < rounds; ++i) {
+        // walk through the buffer, so that large objects are not always in l1 cache
+        size_t offset = (i * object_size) % (data.size() - object_size + 1);
+        sum += func(data.data() + offset, object_size);
+    }
+    int64_t elapsed = NowNanos() - begin;
+    printf("%-14s %10lu bytes %10.1f MB/s (%08x)\n", name, object_size,
+           (double)rounds * object_size * 1000 / elapsed, sum);
+}
+
+int main(int argc, char** argv) {
+    int64_t total = (argc > 1 ? atol(argv[1]) : 1024) * 1024 * 1024;
+    std::string data(16 * 1024 * 1024, 0);
+    unsigned int seed = 1;
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = rand_r(&seed);
+    }
+
+    printf("Extend() uses %s\n", Crc32cImplementation());
+    const size_t object_sizes[] = {64, 1024, 4096, 64 * 1024, 1024 * 1024};
+    for (size_t i = 0; i < sizeof(object_sizes) / sizeof(object_sizes[0]); ++i) {
+        Bench("adler32", Adler32, data, object_sizes[i], total);
+        Bench("portable", Portable, data, object_sizes[i], total);
+        if (Sse42Supported()) {
+            Bench("sse4.2", Sse42, data, object_sizes[i], total);
+        }
+        if (PclmulSupported()) {
+            Bench("sse4.2+pclmul", Sse42Pclmul, data, object_sizes[i], total);
+        }
+    }
+    return 0;
+}
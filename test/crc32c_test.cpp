@@ -0,0 +1,110 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: gtest for crc32c implementations
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-9-30
+*
+*/
+
+#include <string.h>
+#include <string>
+#include "gperftools/heap-checker.h"
+#include "eagleengine/crc32c.h"
+#include "gtest/gtest.h"
+
+int main(int argc, char** argv) {
+
+    testing::InitGoogleTest(&argc, argv);
+    int code = RUN_ALL_TESTS();
+
+    return code;
+}
+
+namespace eagleengine {
+
+typedef uint32_t (*ExtendFunc)(uint32_t crc, const char* buf, size_t size);
+
+static void CheckStandardResults(ExtendFunc extend) {
+    // from rfc3720 section B.4
+    char buf[32];
+    memset(buf, 0, sizeof(buf));
+    EXPECT_EQ(0x8a9136aau, extend(0, buf, sizeof(buf)));
+    memset(buf, 0xff, sizeof(buf));
+    EXPECT_EQ(0x62a8ab43u, extend(0, buf, sizeof(buf)));
+    for (int i = 0; i < 32; i++) {
+        buf[i] = i;
+    }
+    EXPECT_EQ(0x46dd794eu, extend(0, buf, sizeof(buf)));
+    for (int i = 0; i < 32; i++) {
+        buf[i] = 31 - i;
+    }
+    EXPECT_EQ(0x113fdb5cu, extend(0, buf, sizeof(buf)));
+    EXPECT_EQ(0xe3069283u, extend(0, "123456789", 9));
+}
+
+TEST(Crc32cTest, StandardResults)
+{
+    CheckStandardResults(ExtendPortable);
+    CheckStandardResults(Extend);
+    if (Sse42Supported()) {
+        CheckStandardResults(ExtendSse42);
+    }
+    if (PclmulSupported()) {
+        CheckStandardResults(ExtendSse42Pclmul);
+    }
+}
+
+TEST(Crc32cTest, Implementations)
+{
+    // longer than three long streams, at every alignment, so that all the loops are run
+    std::string data(3 * 8192 * 2 + 3 * 256 + 100, 0);
+    unsigned int seed = 1;
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = rand_r(&seed);
+    }
+    const size_t sizes[] = {0, 1, 7, 8, 9, 255, 767, 768, 769, 1000, 8191, 24575, 24576,
+                            24577, 30000, data.size() - 8};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int align = 0; align < 8; align++) {
+            const char* buf = data.data() + align;
+            uint32_t expected = ExtendPortable(0, buf, sizes[i]);
+            EXPECT_EQ(expected, Extend(0, buf, sizes[i]));
+            if (Sse42Supported()) {
+                EXPECT_EQ(expected, ExtendSse42(0, buf, sizes[i]));
+            }
+            if (PclmulSupported()) {
+                EXPECT_EQ(expected, ExtendSse42Pclmul(0, buf, sizes[i]));
+            }
+        }
+    }
+}
+
+TEST(Crc32cTest, Extend)
+{
+    std::string data(50000, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i * 7;
+    }
+    uint32_t whole = Value(data.data(), data.size());
+    EXPECT_NE(whole, Value(data.data(), data.size() - 1));
+    for (size_t split = 0; split < data.size(); split += 4099) {
+        uint32_t crc = Value(data.data(), split);
+        EXPECT_EQ(whole, Extend(crc, data.data() + split, data.size() - split));
+    }
+    EXPECT_EQ(Value("hello world", 11), Extend(Value("hello ", 6), "world", 5));
+}
+
+TEST(Crc32cTest, ObjectChecksum)
+{
+    const char* data = "object content";
+    EXPECT_EQ(ObjectChecksum(kChecksumCrc32c, data, strlen(data)), Value(data, strlen(data)));
+    EXPECT_EQ(ObjectChecksum(kChecksumAdler32, data, strlen(data)),
+              Adler32_Value(data, strlen(data)));
+    EXPECT_NE(ObjectChecksum(kChecksumCrc32c, data, strlen(data)),
+              ObjectChecksum(kChecksumAdler32, data, strlen(data)));
+}
+
+}
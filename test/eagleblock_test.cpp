@@ -12,8 +12,18 @@
 #define private public
 
 #include <map>
+#include <set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "gperftools/heap-checker.h"
+#include "eagleengine/crc32c.h"
 #include "eagleengine/eagleblock.h"
+#include "eagleengine/object_cache.h"
+#include "eagleengine/rate_limiter.h"
+#include "eagleengine/sealed_index.h"
+#include "eagleengine/sealed_table.h"
+#include "eagleengine/util.h"
 #include "gtest/gtest.h"
 
 int main(int argc, char** argv) {
@@ -70,6 +80,62 @@ TEST_F(EagleBlockTest, PutObject)
     delete block;
 }
 
+TEST_F(EagleBlockTest, PutObjects)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testputobjects/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    std::vector<std::string> contents;
+    for (int i = 0; i < 1000; i++) {
+        std::string test_str = "this is for test";
+        char tmp[32];
+        snprintf(tmp, 32, "%d", i);
+        test_str.append(tmp);
+        contents.push_back(test_str);
+    }
+
+    // put in batches of 100 objects
+    std::vector<int64_t> ids;
+    for (int i = 0; i < 1000; i += 100) {
+        std::vector<Slice> batch(contents.begin() + i, contents.begin() + i + 100);
+        status = block->PutObjects(batch, &ids);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ((int)ids.size(), 100);
+        for (int j = 0; j < 100; j++) {
+            EXPECT_EQ(ids[j], i + j);
+        }
+        EXPECT_EQ(block->max_sequence_number(), i + 99);
+    }
+    EXPECT_EQ(block->num_objects(), 1000);
+
+    std::vector<Slice> empty_batch;
+    status = block->PutObjects(empty_batch, &ids);
+    EXPECT_EQ(status.code(), kInvalidArg);
+
+    std::string result;
+    for (int i = 0; i < 1000; i++) {
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, contents[i]);
+    }
+    delete block;
+
+    // batched objects should be recovered as well
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testputobjects", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    for (int i = 0; i < 1000; i++) {
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, contents[i]);
+    }
+    EXPECT_EQ(block->max_sequence_number(), 999);
+    delete block;
+}
+
 TEST_F(EagleBlockTest, DeleteObject)
 {
     EagleBlock* block = NULL;
@@ -141,17 +207,1274 @@ TEST_F(EagleBlockTest, DeleteObject)
         EXPECT_EQ(block->max_sequence_number(), real_id);
     }
 
-    for (int i = current_max_seq; i < 1000 + current_max_seq; i++) {
-        status = block->GetObject(i, &result);
+    for (int i = current_max_seq; i < 1000 + current_max_seq; i++) {
+        status = block->GetObject(i, &result);
+
+        std::string test_str = "this is for test";
+        char tmp[32];
+        snprintf(tmp, 32, "%d", i);
+        test_str.append(tmp);
+
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result.compare(test_str), 0);
+    }
+    delete block;
+}
+
+struct WriterArg {
+    EagleBlock* block;
+    int num;
+    WriteOptions options;
+    std::vector<int64_t> ids;
+};
+
+static void* PutObjectsThread(void* arg) {
+    WriterArg* writer = (WriterArg*)arg;
+    for (int i = 0; i < writer->num; i++) {
+        int64_t object_id = -1;
+        Status status = writer->block->PutObject(writer->options, "this is for concurrent test",
+                                                 &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        if (writer->options.sync) {
+            EXPECT_GE(writer->block->durable_sequence_number(), object_id);
+        }
+        writer->ids.push_back(object_id);
+        if (i % 4 == 0) {
+            status = writer->block->DeleteObject(writer->options, object_id);
+            EXPECT_EQ(status.code(), kOk);
+        }
+    }
+    return NULL;
+}
+
+TEST_F(EagleBlockTest, ConcurrentWriters)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testconcurrent/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    WriterArg args[thread_num];
+    for (int i = 0; i < thread_num; i++) {
+        args[i].block = block;
+        args[i].num = 500;
+        pthread_create(&threads[i], NULL, PutObjectsThread, &args[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    std::set<int64_t> ids;
+    for (int i = 0; i < thread_num; i++) {
+        ids.insert(args[i].ids.begin(), args[i].ids.end());
+    }
+    EXPECT_EQ((int)ids.size(), 2000);
+    EXPECT_EQ(block->num_objects(), 2000);
+    EXPECT_EQ(block->deleted_num_objects(), 500);
+    EXPECT_EQ(block->max_sequence_number(), 2499);
+    delete block;
+
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testconcurrent", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    EXPECT_EQ(block->num_objects(), 2000);
+    EXPECT_EQ(block->deleted_num_objects(), 500);
+    EXPECT_EQ(block->max_sequence_number(), 2499);
+    std::string result;
+    for (int i = 0; i < thread_num; i++) {
+        for (int j = 0; j < 500; j++) {
+            status = block->GetObject(args[i].ids[j], &result);
+            if (j % 4 == 0) {
+                EXPECT_EQ(status.code(), kObjectNotFound);
+            } else {
+                EXPECT_EQ(status.code(), kOk);
+                EXPECT_EQ(result, "this is for concurrent test");
+            }
+        }
+    }
+    delete block;
+}
+
+TEST_F(EagleBlockTest, DurableWriters)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testdurable/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    const int thread_num = 8;
+    pthread_t threads[thread_num];
+    WriterArg args[thread_num];
+    for (int i = 0; i < thread_num; i++) {
+        args[i].block = block;
+        args[i].num = 100;
+        args[i].options.sync = true;
+        pthread_create(&threads[i], NULL, PutObjectsThread, &args[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    EXPECT_EQ(block->num_objects(), 800);
+    EXPECT_EQ(block->deleted_num_objects(), 200);
+    EXPECT_EQ(block->durable_sequence_number(), 999);
+    // durable writes don't rewrite manifest
+    EXPECT_EQ(block->synced_sequence_number(), -1);
+
+    // a batch is durable as a whole
+    std::vector<Slice> contents(10, Slice("this is for durable batch"));
+    std::vector<int64_t> ids;
+    WriteOptions options;
+    options.sync = true;
+    status = block->PutObjects(options, contents, &ids);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->durable_sequence_number(), 1009);
+    delete block;
+
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testdurable", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->num_objects(), 810);
+    EXPECT_EQ(block->deleted_num_objects(), 200);
+    EXPECT_EQ(block->max_sequence_number(), 1009);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, OpenWithIndexHole)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testindexhole/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    for (int i = 0; i < 10; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject("this is for test", &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    delete block;
+
+    // simulate a crash of concurrent writers: entry 10 is never written but entry 11 is
+    IndexEntry entry;
+    int fd = open("./testindexhole/0/idx", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(pread(fd, &entry, sizeof(entry), 9 * sizeof(entry)), (ssize_t)sizeof(entry));
+    char hole[sizeof(IndexEntry)] = {0};
+    EXPECT_EQ(pwrite(fd, hole, sizeof(hole), 10 * sizeof(entry)), (ssize_t)sizeof(hole));
+    entry.sequence_number = 11;
+    entry.object_id = 11;
+    EXPECT_EQ(pwrite(fd, &entry, sizeof(entry), 11 * sizeof(entry)), (ssize_t)sizeof(entry));
+    close(fd);
+
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testindexhole", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    EXPECT_EQ(block->max_sequence_number(), 9);
+    EXPECT_EQ(block->num_objects(), 10);
+
+    // the dropped tail is truncated, new objects reuse its sequence numbers
+    int64_t object_id = -1;
+    status = block->PutObject("this is for test final", &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(object_id, 10);
+    delete block;
+
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testindexhole", &block);
+    EXPECT_EQ(status.code(), kOk);
+    std::string result;
+    status = block->GetObject(10, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "this is for test final");
+    status = block->GetObject(11, &result);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+    delete block;
+}
+
+struct ReaderArg {
+    EagleBlock* block;
+    int num;
+    int failed;
+};
+
+static void* GetObjectsThread(void* arg) {
+    ReaderArg* reader = (ReaderArg*)arg;
+    char buf[64];
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < reader->num; i++) {
+            char expected[32];
+            snprintf(expected, 32, "this is for test%d", i);
+            int size = 0;
+            Status status = reader->block->GetObject(i, buf, sizeof(buf), &size);
+            if (status.code() != kOk || size != (int)strlen(expected) ||
+                    memcmp(buf, expected, size) != 0) {
+                reader->failed++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void CheckCheckpointBlock(EagleBlock* block, const std::map<int64_t, bool>& ids) {
+    EXPECT_EQ(block->num_objects(), 1100);
+    EXPECT_EQ(block->deleted_num_objects(), 400);
+    EXPECT_EQ(block->max_sequence_number(), 1499);
+    std::map<int64_t, bool>::const_iterator it = ids.begin();
+    for (; it != ids.end(); ++it) {
+        std::string result;
+        Status status = block->GetObject(it->first, &result);
+        EXPECT_EQ(status.code(), it->second ? kOk : kObjectNotFound);
+    }
+}
+
+TEST_F(EagleBlockTest, Checkpoint)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testcheckpoint/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    // 1000 objects & 334 deletes covered by checkpoint; id -> live or not
+    std::map<int64_t, bool> ids;
+    for (int i = 0; i < 1000; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject("this is for checkpoint test", &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        ids[object_id] = true;
+        if (i % 3 == 0) {
+            status = block->DeleteObject(object_id);
+            EXPECT_EQ(status.code(), kOk);
+            ids[object_id] = false;
+        }
+    }
+    status = block->Checkpoint();
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->checkpoint_index_offset_, 1334 * (int64_t)sizeof(IndexEntry));
+
+    // 100 objects & 66 deletes after checkpoint
+    for (int i = 0; i < 100; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject("this is for checkpoint tail", &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        ids[object_id] = true;
+        if (i % 3 != 0) {
+            status = block->DeleteObject(object_id);
+            EXPECT_EQ(status.code(), kOk);
+            ids[object_id] = false;
+        }
+    }
+    delete block;
+
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testcheckpoint", &block);
+    EXPECT_EQ(status.code(), kOk);
+    CheckCheckpointBlock(block, ids);
+    delete block;
+
+    // index entries covered by checkpoint are not replayed
+    int fd = open("./testcheckpoint/0/idx", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    IndexEntry first_entry;
+    EXPECT_EQ(pread(fd, &first_entry, sizeof(first_entry), 0), (ssize_t)sizeof(first_entry));
+    char garbage[sizeof(IndexEntry)];
+    memset(garbage, 0xff, sizeof(garbage));
+    EXPECT_EQ(pwrite(fd, garbage, sizeof(garbage), 0), (ssize_t)sizeof(garbage));
+    close(fd);
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testcheckpoint", &block);
+    EXPECT_EQ(status.code(), kOk);
+    CheckCheckpointBlock(block, ids);
+    delete block;
+
+    // a corrupted checkpoint is ignored, and the whole index file is replayed
+    fd = open("./testcheckpoint/0/idx", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(pwrite(fd, &first_entry, sizeof(first_entry), 0), (ssize_t)sizeof(first_entry));
+    close(fd);
+    fd = open("./testcheckpoint/0/checkpoint", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(pwrite(fd, garbage, 1, sizeof(CheckpointHeader) + 10), 1);
+    close(fd);
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testcheckpoint", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    CheckCheckpointBlock(block, ids);
+    EXPECT_EQ(block->checkpoint_index_offset_, 0);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, Seal)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testseal/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    std::map<int64_t, std::string> objects;
+    for (int i = 0; i < 1000; i++) {
+        std::string content(i % 100 + 1, 'a' + i % 26);
+        int64_t object_id = -1;
+        status = block->PutObject(content, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        objects[object_id] = content;
+        if (i % 4 == 0) {
+            status = block->DeleteObject(object_id);
+            EXPECT_EQ(status.code(), kOk);
+            objects.erase(object_id);
+        }
+    }
+
+    status = block->Seal();
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block->sealed());
+    EXPECT_EQ(block->GetStatus(), kFull);
+    EXPECT_TRUE(dynamic_cast<SealedIndex*>(block->indexs_) != NULL);
+    status = block->Seal();
+    EXPECT_EQ(status.code(), kOk);
+
+    std::string result;
+    std::vector<int64_t> object_ids;
+    for (int64_t id = 0; id <= block->max_sequence_number(); id++) {
+        status = block->GetObject(id, &result);
+        if (objects.count(id) > 0) {
+            EXPECT_EQ(status.code(), kOk);
+            EXPECT_EQ(result, objects[id]);
+        } else {
+            EXPECT_EQ(status.code(), kObjectNotFound);
+        }
+        object_ids.push_back(id);
+    }
+    std::vector<std::string> results;
+    std::vector<Status> statuses;
+    block->MultiGet(object_ids, &results, &statuses);
+    for (size_t i = 0; i < object_ids.size(); i++) {
+        EXPECT_EQ(statuses[i].code(), objects.count(object_ids[i]) > 0 ? kOk : kObjectNotFound);
+    }
+    EXPECT_EQ(block->deleted_num_objects(), 250);
+
+    // puts are rejected, deletes & sync & checkpoint still work
+    int64_t object_id = -1;
+    status = block->PutObject("after seal", &object_id);
+    EXPECT_EQ(status.code(), kInternalError);
+    int64_t dead_bytes = block->dead_bytes();
+    int64_t deleted_id = objects.begin()->first;
+    status = block->DeleteObject(deleted_id);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->dead_bytes(), dead_bytes + (int64_t)(sizeof(ObjectHeader) +
+                                                          objects[deleted_id].size()));
+    dead_bytes = block->dead_bytes();
+    objects.erase(deleted_id);
+    status = block->GetObject(deleted_id, &result);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+    EXPECT_EQ(block->deleted_num_objects(), 251);
+    status = block->Checkpoint();
+    EXPECT_EQ(status.code(), kOk);
+    int64_t table_index_offset = block->table_index_offset_;
+    EXPECT_EQ(block->index_offset_, table_index_offset + (int64_t)sizeof(IndexEntry));
+    delete block;
+
+    // reopened from the sealed table, without replaying index file
+    block = NULL;
+    BlockOptions options;
+    options.verify_sealed_table = true;
+    status = EagleBlock::OpenBlock("./testseal", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block->sealed());
+    EXPECT_EQ(block->GetStatus(), kFull);
+    EXPECT_TRUE(dynamic_cast<SealedTable*>(block->indexs_) != NULL);
+    // only the delete after the table is replayed
+    EXPECT_EQ(block->index_offset_, table_index_offset + (int64_t)sizeof(IndexEntry));
+    EXPECT_EQ(block->deleted_num_objects(), 251);
+    EXPECT_EQ(block->dead_bytes(), dead_bytes);
+    EXPECT_EQ(block->max_sequence_number(), block->synced_sequence_number());
+    for (int64_t id = 0; id <= block->max_sequence_number(); id++) {
+        status = block->GetObject(id, &result);
+        EXPECT_EQ(status.code(), objects.count(id) > 0 ? kOk : kObjectNotFound);
+        if (objects.count(id) > 0) {
+            EXPECT_EQ(result, objects[id]);
+        }
+    }
+    status = block->PutObject("after reopen", &object_id);
+    EXPECT_EQ(status.code(), kInternalError);
+
+    // an unsynced delete is validated on open, and accounted as dead bytes
+    deleted_id = objects.begin()->first;
+    status = block->DeleteObject(deleted_id);
+    EXPECT_EQ(status.code(), kOk);
+    objects.erase(deleted_id);
+    dead_bytes = block->dead_bytes();
+    int64_t synced_seq = block->synced_sequence_number();
+    EXPECT_LT(synced_seq, block->max_sequence_number());
+    int64_t index_offset = block->index_offset_;
+    delete block;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testseal", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block->sealed());
+    EXPECT_EQ(block->synced_sequence_number(), synced_seq);
+    EXPECT_EQ(block->index_offset_, index_offset);
+    EXPECT_EQ(block->deleted_num_objects(), 252);
+    EXPECT_EQ(block->dead_bytes(), dead_bytes);
+    status = block->GetObject(deleted_id, &result);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+
+    // a sealed block is compacted into a sealed one; the two deletes after the table are
+    // compacted away, the last entry left is the last put
+    int64_t max_seq = block->max_sequence_number();
+    EagleBlock* new_block = NULL;
+    status = block->Compact(max_seq, &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
+    max_seq -= 2;
+    EXPECT_TRUE(new_block->sealed());
+    EXPECT_EQ(new_block->max_sequence_number(), max_seq);
+    EXPECT_EQ(new_block->num_objects(), 748);
+    EXPECT_EQ(new_block->deleted_num_objects(), 0);
+    for (std::map<int64_t, std::string>::iterator it = objects.begin(); it != objects.end();
+            ++it) {
+        status = new_block->GetObject(it->first, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, it->second);
+    }
+    std::string data_file = new_block->GetFilePath(new_block->current_subdir(), kDataFile);
+    delete new_block;
+
+    // a corrupted footer is ignored, index file is replayed then
+    int fd = open(data_file.c_str(), O_RDWR);
+    EXPECT_GE(fd, 0);
+    struct stat data_buf;
+    EXPECT_EQ(fstat(fd, &data_buf), 0);
+    char byte = 0x7f;
+    EXPECT_EQ(pwrite(fd, &byte, 1, data_buf.st_size - sizeof(SealedFooter)), 1);
+    close(fd);
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testseal", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_FALSE(block->sealed());
+    EXPECT_EQ(block->GetStatus(), kNormal);
+    EXPECT_EQ(block->max_sequence_number(), max_seq);
+    for (std::map<int64_t, std::string>::iterator it = objects.begin(); it != objects.end();
+            ++it) {
+        status = block->GetObject(it->first, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, it->second);
+    }
+    delete block;
+}
+
+TEST_F(EagleBlockTest, SealFailure)
+{
+    const std::string path = "./testsealfailure/";
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    for (int i = 0; i < 100; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject("seal failure", &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+
+    // a table which is written but fails to be synced is dropped
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+    int64_t table_offset = block->data_offset_;
+    std::vector<IndexEntry> entries;
+    block->indexs_->Dump(&entries);
+    status = block->WriteSealedTable(entries);
+    EXPECT_EQ(status.code(), kOk);
+    status = block->DropSealedTable(table_offset);
+    EXPECT_EQ(status.code(), kOk);
+    std::string data_file = path + "0/" + kDataFile;
+    struct stat buf;
+    EXPECT_EQ(stat(data_file.c_str(), &buf), 0);
+    EXPECT_EQ(buf.st_size, table_offset);
+
+    // the table cannot be written nor dropped, the block is read only
+    int data_fd = block->data_fd_;
+    block->data_fd_ = open(data_file.c_str(), O_RDONLY);
+    EXPECT_TRUE(block->data_fd_ >= 0);
+    status = block->Seal();
+    EXPECT_NE(status.code(), kOk);
+    EXPECT_FALSE(block->sealed());
+    EXPECT_EQ(block->GetStatus(), kReadOnly);
+    int64_t object_id = -1;
+    status = block->PutObject("seal failure", &object_id);
+    EXPECT_NE(status.code(), kOk);
+    close(block->data_fd_);
+    block->data_fd_ = data_fd;
+    delete block;
+
+    // not sealed once reopened, and writable
+    block = NULL;
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    EXPECT_FALSE(block->sealed());
+    EXPECT_TRUE(block->IsNormal());
+    std::string result;
+    for (int64_t id = 0; id < 100; id++) {
+        status = block->GetObject(id, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, "seal failure");
+    }
+    status = block->PutObject("seal failure", &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, OpenWithFakeFooter)
+{
+    const std::string path = "./testfakefooter/";
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    int64_t object_id = -1;
+    status = block->PutObject("fake footer", &object_id);
+    EXPECT_EQ(status.code(), kOk);
+
+    // an object ending with a valid table & footer, which claim object 0 as object 7
+    int64_t table_offset = block->data_offset_ + sizeof(ObjectHeader);
+    std::vector<IndexEntry> entries(1);
+    EXPECT_TRUE(block->indexs_->Get(0, &entries[0]));
+    entries[0].object_id = 7;
+    std::string fake_file = path + "fake";
+    int fd = open(fake_file.c_str(), O_RDWR | O_CREAT, 0644);
+    EXPECT_GE(fd, 0);
+    SealedFooter footer;
+    footer.table_offset = table_offset;
+    footer.max_sequence_number = 7;
+    footer.num_objects = 1;
+    status = SealedTable::Write(fd, entries, &footer);
+    EXPECT_EQ(status.code(), kOk);
+    std::string payload(sizeof(IndexEntry) + sizeof(SealedFooter), '\0');
+    EXPECT_EQ(pread(fd, &payload[0], payload.size(), table_offset), (ssize_t)payload.size());
+    close(fd);
+    status = block->PutObject(payload, &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(object_id, 1);
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
+
+    // not sealed by manifest, index file is replayed
+    block = NULL;
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    EXPECT_FALSE(block->sealed());
+    EXPECT_TRUE(block->IsNormal());
+    std::string result;
+    status = block->GetObject(1, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, payload);
+    status = block->GetObject(7, &result);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+    status = block->PutObject("fake footer", &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(object_id, 2);
+
+    // a real table is recorded by manifest
+    status = block->Seal();
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
+    block = NULL;
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block->sealed());
+    Manifest manifest;
+    EXPECT_EQ(block->GetManifest(&manifest).code(), kOk);
+    EXPECT_EQ(manifest.table_offset, block->data_offset_);
+    status = block->GetObject(1, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, payload);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, ObjectCache)
+{
+    ObjectCache cache(64 * 1024 * 1024);
+    BlockOptions options;
+    options.object_cache = &cache;
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testobjectcache/", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+
+    std::vector<std::string> contents;
+    for (int i = 0; i < 100; i++) {
+        contents.push_back(std::string(1000 + i, 'a' + i % 26));
+        int64_t object_id = -1;
+        status = block->PutObject(contents[i], &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    EXPECT_EQ(cache.usage(), 0);
+
+    // objects are cached once read, then they are read from cache rather than data file
+    std::string result;
+    for (int i = 0; i < 100; i++) {
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        ObjectCache::Handle* handle = cache.Lookup(block->cache_id_, i);
+        ASSERT_TRUE(handle != NULL);
+        EXPECT_EQ(cache.Value(handle).ToString(), contents[i]);
+        cache.Release(handle);
+    }
+    cache.Erase(block->cache_id_, 7);
+    cache.Insert(block->cache_id_, 7, "from cache");
+    status = block->GetObject(7, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "from cache");
+    char buf[16];
+    int size = 0;
+    status = block->GetObject(7, buf, sizeof(buf), &size);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(std::string(buf, size), "from cache");
+    status = block->GetObject(8, buf, sizeof(buf), &size);
+    EXPECT_EQ(status.code(), kInvalidArg);
+    EXPECT_EQ(size, 1008);
+
+    // deletes invalidate cached objects
+    for (int i = 0; i < 100; i += 2) {
+        status = block->DeleteObject(i);
+        EXPECT_EQ(status.code(), kOk);
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kObjectNotFound);
+    }
+
+    // so does compaction, the new block is cached by its own id
+    block->Sync();
+    EagleBlock* new_block = NULL;
+    status = block->Compact(block->synced_sequence_number(), &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(cache.usage(), 0);
+    for (int i = 0; i < 100; i++) {
+        status = new_block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), i % 2 == 0 ? kObjectNotFound : kOk);
+        if (i % 2 == 1) {
+            EXPECT_EQ(result, contents[i]);
+        }
+    }
+    EXPECT_GT(cache.usage(), 0);
+    delete block;
+    delete new_block;
+    EXPECT_EQ(cache.usage(), 0);
+}
+
+TEST_F(EagleBlockTest, TailBuffer)
+{
+    BlockOptions options;
+    options.tail_buffer_size = 64 * 1024;
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testtailbuffer/", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block->tail_buffer_ != NULL);
+
+    // recent objects are in memory only, until the buffer is large enough to flush
+    std::vector<std::string> contents;
+    int64_t object_id = -1;
+    for (int i = 0; i < 4; i++) {
+        contents.push_back(std::string(1000 + i, 'a' + i));
+        status = block->PutObject(contents[i], &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    struct stat data_buf;
+    std::string data_file = block->GetFilePath(block->current_subdir(), kDataFile);
+    EXPECT_EQ(stat(data_file.c_str(), &data_buf), 0);
+    EXPECT_EQ(data_buf.st_size, 0);
+    // so are their index entries
+    struct stat index_buf;
+    std::string index_file = block->GetFilePath(block->current_subdir(), kIndexFile);
+    EXPECT_EQ(stat(index_file.c_str(), &index_buf), 0);
+    EXPECT_EQ(index_buf.st_size, 0);
+    std::string result;
+    for (int i = 0; i < 4; i++) {
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, contents[i]);
+    }
+
+    // reads from data file flush the buffer first
+    std::vector<int64_t> object_ids;
+    object_ids.push_back(1);
+    object_ids.push_back(3);
+    std::vector<std::string> results;
+    std::vector<Status> statuses;
+    status = block->MultiGet(object_ids, &results, &statuses);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(results[1], contents[3]);
+    EXPECT_EQ(stat(data_file.c_str(), &data_buf), 0);
+    EXPECT_EQ(data_buf.st_size, block->data_offset_);
+    EXPECT_EQ(stat(index_file.c_str(), &index_buf), 0);
+    EXPECT_EQ(index_buf.st_size, block->index_offset_);
+
+    // objects larger than the buffer, and batches which don't fit, are written directly
+    std::vector<int64_t> ids;
+    for (int i = 0; i < 4; i++) {
+        ids.push_back(i);
+    }
+    for (int i = 4; i < 200; i++) {
+        contents.push_back(std::string(i % 50 == 0 ? 100 * 1024 : 100 + i * 37, 'a' + i % 26));
+        if (i % 3 == 0) {
+            std::vector<Slice> batch;
+            batch.push_back(contents[i]);
+            std::vector<int64_t> batch_ids;
+            status = block->PutObjects(batch, &batch_ids);
+            object_id = batch_ids.empty() ? -1 : batch_ids[0];
+        } else {
+            status = block->PutObject(contents[i], &object_id);
+        }
+        EXPECT_EQ(status.code(), kOk);
+        ids.push_back(object_id);
+        status = block->GetObject(object_id, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, contents[i]);
+        if (i % 7 == 0) {
+            status = block->DeleteObject(object_id);
+            EXPECT_EQ(status.code(), kOk);
+        }
+    }
+    // the buffer restarted after direct writes
+    EXPECT_GT(block->tail_buffer_->base_, 64 * 1024);
+
+    // files left by a crash now: index file refers to flushed data only, so all entries in it
+    // are replayed
+    status = block->PutObject(contents[0], &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_LT(block->tail_buffer_->flushed_offset(), block->data_offset_);
+    EXPECT_EQ(system("rm -rf testtailbuffercrash; cp -r testtailbuffer testtailbuffercrash"), 0);
+    EXPECT_EQ(stat(index_file.c_str(), &index_buf), 0);
+    EXPECT_LT(index_buf.st_size, block->index_offset_);
+    EagleBlock* crashed_block = NULL;
+    status = EagleBlock::OpenBlock("./testtailbuffercrash", options, &crashed_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(crashed_block != NULL);
+    EXPECT_EQ(crashed_block->index_offset_, index_buf.st_size);
+    EXPECT_LE(crashed_block->data_offset_, block->tail_buffer_->flushed_offset());
+    EXPECT_LT(crashed_block->max_sequence_number(), object_id);
+    delete crashed_block;
+
+    // sync flushes the buffer, so the block can be reopened
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(stat(data_file.c_str(), &data_buf), 0);
+    EXPECT_EQ(data_buf.st_size, block->data_offset_);
+    int64_t max_seq = block->max_sequence_number();
+    delete block;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testtailbuffer", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->max_sequence_number(), max_seq);
+    for (int i = 0; i < 200; i++) {
+        status = block->GetObject(ids[i], &result);
+        if (i >= 4 && i % 7 == 0) {
+            EXPECT_EQ(status.code(), kObjectNotFound);
+        } else {
+            EXPECT_EQ(status.code(), kOk);
+            EXPECT_EQ(result, contents[i]);
+        }
+    }
+
+    // concurrent writers, some of them durable
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    WriterArg args[thread_num];
+    for (int i = 0; i < thread_num; i++) {
+        args[i].block = block;
+        args[i].num = 500;
+        args[i].options.sync = i % 2 == 0;
+        pthread_create(&threads[i], NULL, PutObjectsThread, &args[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        for (int j = 0; j < 500; j++) {
+            status = block->GetObject(args[i].ids[j], &result);
+            EXPECT_EQ(status.code(), j % 4 == 0 ? kObjectNotFound : kOk);
+            if (j % 4 != 0) {
+                EXPECT_EQ(result, "this is for concurrent test");
+            }
+        }
+    }
+    // unsynced data is flushed when the block is deleted
+    delete block;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testtailbuffer", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->max_sequence_number(), max_seq + 2500);
+    EXPECT_EQ(block->deleted_num_objects(), 28 + 500);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, OpenWithCorruptedTail)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testcorruptedtail/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    // a large unsynced tail, validated by several threads on open
+    for (int i = 0; i < 3000; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        int64_t object_id = -1;
+        status = block->PutObject(tmp, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        if (i == 999) {
+            block->Sync();
+        }
+    }
+    IndexEntry entry_2000;
+    IndexEntry entry_2500;
+    EXPECT_TRUE(block->indexs_->Get(2000, &entry_2000));
+    EXPECT_TRUE(block->indexs_->Get(2500, &entry_2500));
+    delete block;
+
+    // corrupt object 2500 first, then 2000; objects after the first corrupted one are
+    // dropped even if they are valid
+    int fd = open("./testcorruptedtail/0/dat", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(pwrite(fd, "#", 1, entry_2500.offset), 1);
+    EXPECT_EQ(pwrite(fd, "#", 1, entry_2000.offset), 1);
+    close(fd);
+
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testcorruptedtail", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    EXPECT_EQ(block->max_sequence_number(), 1999);
+    EXPECT_EQ(block->num_objects(), 2000);
+    for (int i = 0; i < 2000; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        std::string result;
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, tmp);
+    }
+    std::string result;
+    status = block->GetObject(2001, &result);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+    delete block;
+
+    // the dropped tail is truncated
+    struct stat index_stat;
+    EXPECT_EQ(stat("./testcorruptedtail/0/idx", &index_stat), 0);
+    EXPECT_EQ(index_stat.st_size, 2000 * (int64_t)sizeof(IndexEntry));
+}
+
+TEST_F(EagleBlockTest, OpenWithAdler32Objects)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testadler32/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    std::vector<IndexEntry> entries;
+    for (int i = 0; i < 100; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        int64_t object_id = -1;
+        status = block->PutObject(tmp, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        IndexEntry entry;
+        EXPECT_TRUE(block->indexs_->Get(object_id, &entry));
+        entries.push_back(entry);
+        if (i == 49) {
+            block->Sync();
+        }
+    }
+    delete block;
+
+    // rewrite headers as blocks written before crc32c, with a zero checksum type
+    int fd = open("./testadler32/0/dat", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    for (int i = 0; i < 100; i++) {
+        ObjectHeader header;
+        int64_t header_offset = entries[i].offset - sizeof(header);
+        EXPECT_EQ(pread(fd, &header, sizeof(header), header_offset), (ssize_t)sizeof(header));
+        EXPECT_EQ(header.checksum_type, kChecksumCrc32c);
+        std::string content(entries[i].size, 0);
+        EXPECT_EQ(pread(fd, &content[0], content.size(), entries[i].offset),
+                  (ssize_t)content.size());
+        EXPECT_EQ(header.crc, Value(content.data(), content.size()));
+        header.checksum_type = kChecksumAdler32;
+        header.crc = Adler32_Value(content.data(), content.size());
+        EXPECT_EQ(pwrite(fd, &header, sizeof(header), header_offset), (ssize_t)sizeof(header));
+    }
+    close(fd);
+
+    // unsynced objects are validated by adler32, and the block is compacted as is
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testadler32", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->max_sequence_number(), 99);
+    int64_t object_id = -1;
+    status = block->PutObject("this is a crc32c object", &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    block->Sync();
+    EagleBlock* new_block = NULL;
+    status = block->Compact(100, &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    std::string result;
+    for (int i = 0; i < 100; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        status = new_block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, tmp);
+    }
+    status = new_block->GetObject(100, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "this is a crc32c object");
+    delete block;
+    delete new_block;
+}
+
+TEST_F(EagleBlockTest, GetObjectIntoBuffer)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testgetobject/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    for (int i = 0; i < 1000; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        int64_t object_id = -1;
+        status = block->PutObject(tmp, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+
+    char small_buf[4];
+    int size = 0;
+    status = block->GetObject(10, small_buf, sizeof(small_buf), &size);
+    EXPECT_EQ(status.code(), kInvalidArg);
+    EXPECT_EQ(size, 18);
+    status = block->GetObject(99999, small_buf, sizeof(small_buf), &size);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+
+    // readers share nothing but the block
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    ReaderArg args[thread_num];
+    for (int i = 0; i < thread_num; i++) {
+        args[i].block = block;
+        args[i].num = 1000;
+        args[i].failed = 0;
+        pthread_create(&threads[i], NULL, GetObjectsThread, &args[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(args[i].failed, 0);
+    }
+    delete block;
+}
+
+TEST_F(EagleBlockTest, VerifyChecksums)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testverify/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    for (int i = 0; i < 4; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        int64_t object_id = -1;
+        status = block->PutObject(tmp, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+
+    // corrupt content of object 1, and header of object 2
+    IndexEntry entry_1;
+    IndexEntry entry_2;
+    EXPECT_TRUE(block->indexs_->Get(1, &entry_1));
+    EXPECT_TRUE(block->indexs_->Get(2, &entry_2));
+    int fd = open("./testverify/0/dat", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(pwrite(fd, "#", 1, entry_1.offset), 1);
+    int64_t wrong_id = 3;
+    EXPECT_EQ(pwrite(fd, &wrong_id, sizeof(wrong_id),
+                     entry_2.offset - sizeof(ObjectHeader) + offsetof(ObjectHeader, object_id)),
+              (ssize_t)sizeof(wrong_id));
+    close(fd);
+
+    std::string result;
+    status = block->GetObject(1, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "#his is for test1");
+
+    ReadOptions options;
+    options.verify_checksums = true;
+    status = block->GetObject(options, 0, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "this is for test0");
+    status = block->GetObject(options, 1, &result);
+    EXPECT_EQ(status.code(), kDataCorrupted);
+    EXPECT_TRUE(result.empty());
+    status = block->GetObject(options, 2, &result);
+    EXPECT_EQ(status.code(), kDataCorrupted);
+    char buf[64];
+    int size = 0;
+    status = block->GetObject(options, 3, buf, sizeof(buf), &size);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(std::string(buf, size), "this is for test3");
+    status = block->GetObject(options, 1, buf, sizeof(buf), &size);
+    EXPECT_EQ(status.code(), kDataCorrupted);
+
+    // one of every 4 reads is verified
+    options.verify_sample_rate = 4;
+    int corrupted = 0;
+    for (int i = 0; i < 8; i++) {
+        status = block->GetObject(options, 1, &result);
+        if (status.code() == kDataCorrupted) {
+            corrupted++;
+        } else {
+            EXPECT_EQ(status.code(), kOk);
+        }
+    }
+    EXPECT_EQ(corrupted, 2);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, MultiGet)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testmultiget/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    std::vector<std::string> contents;
+    for (int i = 0; i < 1000; i++) {
+        std::string test_str = "this is for test";
+        char tmp[32];
+        snprintf(tmp, 32, "%d", i);
+        test_str.append(tmp);
+        // some big objects, so that not all objects are merged into one read
+        if (i % 100 == 0) {
+            test_str.append(100 * 1024, 'x');
+        }
+        contents.push_back(test_str);
+        int64_t object_id = -1;
+        status = block->PutObject(test_str, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        status = block->DeleteObject(i);
+        EXPECT_EQ(status.code(), kOk);
+    }
+
+    // unordered ids, with duplicated and not existed ones
+    std::vector<int64_t> ids;
+    for (int i = 999; i >= 0; i -= 2) {
+        ids.push_back(i);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        ids.push_back(i);
+    }
+    ids.push_back(500);
+    ids.push_back(501);
+    ids.push_back(99999);
+
+    std::vector<std::string> results;
+    std::vector<Status> statuses;
+    status = block->MultiGet(ids, &results, &statuses);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(results.size(), ids.size());
+    EXPECT_EQ(statuses.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        int64_t id = ids[i];
+        if (id >= 1000 || id % 3 == 0) {
+            EXPECT_EQ(statuses[i].code(), kObjectNotFound);
+        } else {
+            EXPECT_EQ(statuses[i].code(), kOk);
+            EXPECT_EQ(results[i], contents[id]);
+        }
+    }
+    delete block;
+}
+
+struct AsyncArg {
+    MutexLock lock;
+    CondVar cond;
+    int done;
+    int failed;
+    std::set<int64_t> ids;
+
+    AsyncArg() : cond(&lock), done(0), failed(0) {
+    }
+};
+
+static void OnAsyncDone(void* arg, const Status& status, int64_t value) {
+    AsyncArg* async_arg = (AsyncArg*)arg;
+    ScopedLocker<MutexLock> lock(async_arg->lock);
+    if (status.code() != kOk) {
+        async_arg->failed++;
+    }
+    async_arg->ids.insert(value);
+    async_arg->done++;
+    async_arg->cond.SignalAll();
+}
+
+static void WaitAsyncDone(AsyncArg* async_arg, int num) {
+    ScopedLocker<MutexLock> lock(async_arg->lock);
+    while (async_arg->done < num) {
+        async_arg->cond.Wait();
+    }
+}
+
+static void TestAsyncPutGet(const std::string& path, AsyncIO* io,
+                            int64_t tail_buffer_size = 0) {
+    BlockOptions options;
+    options.tail_buffer_size = tail_buffer_size;
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock(path, options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    block->set_async_io(io);
+
+    const int num = 1000;
+    std::vector<std::string> contents;
+    for (int i = 0; i < num; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        contents.push_back(tmp);
+    }
+
+    // async puts mixed with sync puts
+    AsyncArg put_arg;
+    for (int i = 0; i < num; i++) {
+        if (i % 10 == 0) {
+            int64_t object_id = -1;
+            status = block->PutObject(contents[i], &object_id);
+            EXPECT_EQ(object_id, i);
+            put_arg.lock.Lock();
+            put_arg.ids.insert(object_id);
+            put_arg.done++;
+            put_arg.lock.Unlock();
+        } else {
+            status = block->AsyncPutObject(contents[i], OnAsyncDone, &put_arg);
+        }
+        EXPECT_EQ(status.code(), kOk);
+    }
+    WaitAsyncDone(&put_arg, num);
+    EXPECT_EQ(put_arg.failed, 0);
+    EXPECT_EQ((int)put_arg.ids.size(), num);
+    EXPECT_EQ(block->max_sequence_number(), num - 1);
+    EXPECT_EQ(block->num_objects(), num);
+
+    std::vector<std::string> results(num, std::string(64, '\0'));
+    AsyncArg get_arg;
+    for (int i = 0; i < num; i++) {
+        status = block->AsyncGetObject(i, &results[i][0], results[i].size(), OnAsyncDone,
+                                       &get_arg);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    WaitAsyncDone(&get_arg, num);
+    EXPECT_EQ(get_arg.failed, 0);
+    for (int i = 0; i < num; i++) {
+        EXPECT_EQ(results[i].substr(0, contents[i].size()), contents[i]);
+    }
+    status = block->AsyncGetObject(99999, &results[0][0], results[0].size(), OnAsyncDone,
+                                   &get_arg);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+
+    // sync through the backend and reopen
+    block->Sync();
+    EXPECT_EQ(block->synced_sequence_number(), num - 1);
+    delete block;
+    block = NULL;
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    for (int i = 0; i < num; i++) {
+        std::string result;
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_EQ(result, contents[i]);
+    }
+    delete block;
+}
+
+TEST_F(EagleBlockTest, AsyncPutGet)
+{
+    // synchronous fallback
+    TestAsyncPutGet("./testasync/", AsyncIO::Default());
 
-        std::string test_str = "this is for test";
-        char tmp[32];
-        snprintf(tmp, 32, "%d", i);
-        test_str.append(tmp);
+    // io_uring, or synchronous fallback if io_uring is not supported
+    AsyncIO* io = AsyncIO::Create(16);
+    EXPECT_TRUE(io != NULL);
+    TestAsyncPutGet("./testasyncuring/", io);
+    // buffered puts are completed once copied, others only write data
+    TestAsyncPutGet("./testasynctail/", io, 4096);
+    delete io;
+}
 
-        EXPECT_EQ(status.code(), kOk);
-        EXPECT_EQ(result.compare(test_str), 0);
+// a backend which is stopping, nothing is submitted
+class StoppedIO : public AsyncIO {
+public:
+    virtual Status Submit(const IORequest*, int, int* submitted) {
+        *submitted = 0;
+        return Status(kInternalError, "io backend is stopping");
+    }
+
+    virtual bool IsAsync() {
+        return true;
     }
+};
+
+TEST_F(EagleBlockTest, AsyncSubmitFailure)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testasyncfailure/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    int64_t object_id = -1;
+    status = block->PutObject("async submit failure", &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    StoppedIO io;
+    block->set_async_io(&io);
+
+    // the read is not started, callback is not invoked
+    AsyncArg get_arg;
+    char buf[64];
+    status = block->AsyncGetObject(object_id, buf, sizeof(buf), OnAsyncDone, &get_arg);
+    EXPECT_EQ(status.code(), kInternalError);
+    EXPECT_EQ(get_arg.done, 0);
+
+    // the reserved sequence number fails through callback, later writes are rejected
+    AsyncArg put_arg;
+    status = block->AsyncPutObject("async submit failure", OnAsyncDone, &put_arg);
+    EXPECT_EQ(status.code(), kOk);
+    WaitAsyncDone(&put_arg, 1);
+    EXPECT_EQ(put_arg.failed, 1);
+    EXPECT_EQ(block->GetStatus(), kReadOnly);
+    EXPECT_EQ(block->max_sequence_number(), object_id);
+    status = block->PutObject("async submit failure", &object_id);
+    EXPECT_NE(status.code(), kOk);
+
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kInternalError);
+    block->set_async_io(AsyncIO::Default());
+    delete block;
+
+    // the failed put is dropped by open
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testasyncfailure/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    EXPECT_EQ(block->max_sequence_number(), 0);
+    std::string result;
+    status = block->GetObject(0, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "async submit failure");
     delete block;
 }
 
@@ -217,6 +1540,47 @@ TEST_F(EagleBlockTest, OpenBlock)
     EXPECT_EQ(status.code(), kOk);
     EXPECT_EQ(object_id, 1334);
     EXPECT_EQ(block->max_sequence_number(), 1334);
+    delete block;
+
+    // the same block with another index type
+    BlockOptions options;
+    options.index_type = kSwissIndex;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testpath2", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    for (int i = 0; i < 1000; i++) {
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), i % 3 == 0 ? kObjectNotFound : kOk);
+    }
+    status = block->GetObject(1334, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, test_str);
+    EXPECT_EQ(block->deleted_num_objects(), 334);
+    status = block->DeleteObject(1);
+    EXPECT_EQ(status.code(), kOk);
+    status = block->GetObject(1, &result);
+    EXPECT_EQ(status.code(), kObjectNotFound);
+    delete block;
+
+    options.index_type = kDenseIndex;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testpath2", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+    for (int i = 0; i < 1000; i++) {
+        status = block->GetObject(i, &result);
+        EXPECT_EQ(status.code(), i % 3 == 0 || i == 1 ? kObjectNotFound : kOk);
+    }
+    status = block->GetObject(1334, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, test_str);
+    EXPECT_EQ(block->deleted_num_objects(), 335);
+    status = block->PutObject(test_str, &object_id);
+    EXPECT_EQ(status.code(), kOk);
+    status = block->GetObject(object_id, &result);
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
 }
 
 TEST_F(EagleBlockTest, Sync)
@@ -333,6 +1697,504 @@ TEST_F(EagleBlockTest, Compact)
     delete new_block;
 }
 
+static void CompactWithOptions(const std::string& path, const BlockOptions& options,
+                               AsyncIO* io) {
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock(path, options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    block->set_async_io(io);
+
+    // small objects in runs broken by deletes, and a few objects larger than a chunk
+    std::map<int64_t, std::string> objects;
+    for (int i = 0; i < 3000; i++) {
+        int size = i % 1000 == 500 ? 5 * 1024 * 1024 : 100 + i % 3000;
+        std::string content(size, 'a' + i % 26);
+        int64_t object_id = -1;
+        status = block->PutObject(content, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        objects[object_id] = content;
+    }
+    for (int i = 0; i < 3000; i++) {
+        if (i % 3 == 0 || (i > 1000 && i < 1100)) {
+            status = block->DeleteObject(i);
+            EXPECT_EQ(status.code(), kOk);
+            objects.erase(i);
+        }
+    }
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+
+    EagleBlock* new_block = NULL;
+    status = block->Compact(block->synced_sequence_number(), &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    int64_t data_size = 0;
+    std::string result;
+    for (std::map<int64_t, std::string>::iterator it = objects.begin(); it != objects.end();
+            ++it) {
+        status = new_block->GetObject(it->first, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_TRUE(result == it->second);
+        data_size += sizeof(ObjectHeader) + it->second.size();
+    }
+    EXPECT_EQ(new_block->num_objects(), (int64_t)objects.size());
+    EXPECT_EQ(new_block->data_offset_, data_size);
+    delete block;
+    delete new_block;
+
+    // objects are checked again once the new block is reopened
+    new_block = NULL;
+    status = EagleBlock::OpenBlock(path, options, &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ReadOptions read_options;
+    read_options.verify_checksums = true;
+    for (std::map<int64_t, std::string>::iterator it = objects.begin(); it != objects.end();
+            ++it) {
+        status = new_block->GetObject(read_options, it->first, &result);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    delete new_block;
+}
+
+TEST_F(EagleBlockTest, CompactByChunks)
+{
+    BlockOptions options;
+    // copied by buffers, and written by io_uring if it is available
+    AsyncIO* io = AsyncIO::Create(16);
+    CompactWithOptions("./testcompacturing/", options, io);
+    CompactWithOptions("./testcompactsync/", options, AsyncIO::Default());
+    delete io;
+
+    // copied by copy_file_range
+    options.verify_compaction = false;
+    CompactWithOptions("./testcompactrange/", options, AsyncIO::Default());
+}
+
+TEST_F(EagleBlockTest, CompactCorruptedObject)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testcompactcorrupted/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    for (int i = 0; i < 100; i++) {
+        char tmp[32];
+        snprintf(tmp, 32, "this is for test%d", i);
+        int64_t object_id = -1;
+        status = block->PutObject(tmp, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    block->Sync();
+    IndexEntry entry;
+    EXPECT_TRUE(block->indexs_->Get(50, &entry));
+    int fd = open("./testcompactcorrupted/0/dat", O_RDWR);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(pwrite(fd, "#", 1, entry.offset), 1);
+    close(fd);
+
+    // crc is checked by default, the block is still writable after the failure
+    EagleBlock* new_block = NULL;
+    status = block->Compact(99, &new_block);
+    EXPECT_EQ(status.code(), kDataCorrupted);
+    EXPECT_TRUE(new_block == NULL);
+    EXPECT_TRUE(block->IsNormal());
+    EXPECT_FALSE(block->compacting());
+
+    // while live objects are copied, the block can be neither compacted again nor sealed
+    block->compacting_ = true;
+    status = block->Compact(99, &new_block);
+    EXPECT_EQ(status.code(), kInternalError);
+    status = block->Seal();
+    EXPECT_EQ(status.code(), kInternalError);
+    EXPECT_TRUE(block->IsNormal());
+    EXPECT_FALSE(block->sealed());
+    block->compacting_ = false;
+    delete block;
+
+    // without verification, the object is copied as is
+    BlockOptions options;
+    options.verify_compaction = false;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testcompactcorrupted", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    status = block->Compact(99, &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    std::string result;
+    status = new_block->GetObject(50, &result);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(result, "#his is for test50");
+    delete block;
+    delete new_block;
+}
+
+struct DeleteArg {
+    EagleBlock* block;
+    int num;
+};
+
+static void* DeleteThread(void* arg) {
+    DeleteArg* deleter = (DeleteArg*)arg;
+    for (int64_t id = 0; id < deleter->num; id++) {
+        Status status = deleter->block->DeleteObject(id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    return NULL;
+}
+
+TEST_F(EagleBlockTest, ConcurrentDeleteAndCompact)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testconcurrentdelete/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    const int num = 2000;
+    for (int i = 0; i < num; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject("concurrent delete", &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+
+    // every object is deleted by all threads, only one tombstone is written for it
+    const int thread_num = 8;
+    pthread_t threads[thread_num];
+    DeleteArg arg;
+    arg.block = block;
+    arg.num = num;
+    for (int i = 0; i < thread_num; i++) {
+        pthread_create(&threads[i], NULL, DeleteThread, &arg);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    EXPECT_EQ(block->max_sequence_number(), 2 * num - 1);
+    EXPECT_EQ(block->index_offset_, (int64_t)(2 * num * sizeof(IndexEntry)));
+    EXPECT_EQ(block->live_bytes(), 0);
+
+    // tombstones are copied after synced objects
+    EagleBlock* new_block = NULL;
+    status = block->Compact(num - 1, &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    EXPECT_EQ(new_block->deleted_num_objects(), num);
+    delete block;
+    delete new_block;
+}
+
+TEST_F(EagleBlockTest, CompactDuplicatedTombstones)
+{
+    const std::string path = "./testduptombstone/";
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    for (int i = 0; i < 10; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject("duplicated tombstones", &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+    status = block->DeleteObject(3);
+    EXPECT_EQ(status.code(), kOk);
+    IndexEntry tombstone;
+    ASSERT_EQ(pread(block->index_fd_, &tombstone, sizeof(tombstone), block->index_offset_ -
+                    sizeof(tombstone)), (ssize_t)sizeof(tombstone));
+    delete block;
+
+    // concurrent deletes of old versions could write another tombstone of the object
+    tombstone.sequence_number++;
+    std::string index_file = path + "0/" + kIndexFile;
+    int fd = open(index_file.c_str(), O_WRONLY | O_APPEND);
+    EXPECT_TRUE(fd >= 0);
+    EXPECT_EQ(write(fd, &tombstone, sizeof(tombstone)), (ssize_t)sizeof(tombstone));
+    close(fd);
+
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EagleBlock* new_block = NULL;
+    status = block->Compact(9, &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    std::string result;
+    for (int64_t id = 0; id < 10; id++) {
+        status = new_block->GetObject(id, &result);
+        EXPECT_EQ(status.code(), id == 3 ? kObjectNotFound : kOk);
+    }
+    EXPECT_EQ(new_block->num_objects(), 10);
+    EXPECT_EQ(new_block->deleted_num_objects(), 1);
+    delete block;
+    delete new_block;
+}
+
+static void ExpectUsage(const std::string& path, int64_t live_bytes, int64_t dead_bytes) {
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+    EXPECT_EQ(block->live_bytes(), live_bytes);
+    EXPECT_EQ(block->dead_bytes(), dead_bytes);
+    delete block;
+}
+
+TEST_F(EagleBlockTest, GarbageAccounting)
+{
+    const std::string path = "./testgarbage/";
+    const int64_t header_size = sizeof(ObjectHeader);
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+
+    std::vector<int64_t> ids;
+    for (int i = 0; i < 100; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject(std::string(1000, 'a'), &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        ids.push_back(object_id);
+    }
+    std::string batch_content(500, 'b');
+    std::vector<Slice> contents(10, Slice(batch_content));
+    std::vector<int64_t> batch_ids;
+    status = block->PutObjects(contents, &batch_ids);
+    EXPECT_EQ(status.code(), kOk);
+    for (int i = 0; i < 30; i++) {
+        status = block->DeleteObject(ids[i * 3]);
+        EXPECT_EQ(status.code(), kOk);
+    }
+    // deleted again, nothing changes
+    status = block->DeleteObject(ids[0]);
+    EXPECT_EQ(status.code(), kOk);
+    const int64_t live_bytes = 70 * (header_size + 1000) + 10 * (header_size + 500);
+    const int64_t dead_bytes = 30 * (header_size + 1000);
+    EXPECT_EQ(block->live_bytes(), live_bytes);
+    EXPECT_EQ(block->dead_bytes(), dead_bytes);
+
+    // persisted in manifest by sync
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+    Manifest manifest;
+    status = block->GetManifest(&manifest);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(manifest.live_bytes, live_bytes);
+    EXPECT_EQ(manifest.dead_bytes, dead_bytes);
+    delete block;
+
+    // rebuilt by replaying index file, and by loading checkpoint
+    ExpectUsage(path, live_bytes, dead_bytes);
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    status = block->Checkpoint();
+    EXPECT_EQ(status.code(), kOk);
+    status = block->DeleteObject(ids[1]);
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
+    ExpectUsage(path, live_bytes - header_size - 1000, dead_bytes + header_size + 1000);
+
+    // a sealed block takes them from manifest
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    status = block->Seal();
+    EXPECT_EQ(status.code(), kOk);
+    delete block;
+    ExpectUsage(path, live_bytes - header_size - 1000, dead_bytes + header_size + 1000);
+
+    // manifest of an old version has no usage, objects are counted by the sealed table
+    std::string manifest_file = path + "0/" + kManifestFile;
+    EXPECT_EQ(truncate(manifest_file.c_str(), kManifestV1Size), 0);
+    ExpectUsage(path, live_bytes - header_size - 1000, dead_bytes + header_size + 1000);
+
+    // nothing is dead after compaction
+    status = EagleBlock::OpenBlock(path, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EagleBlock* new_block = NULL;
+    status = block->Compact(block->synced_sequence_number(), &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    EXPECT_EQ(new_block->live_bytes(), live_bytes - header_size - 1000);
+    EXPECT_EQ(new_block->dead_bytes(), 0);
+    delete block;
+    delete new_block;
+    ExpectUsage(path, live_bytes - header_size - 1000, 0);
+}
+
+TEST_F(EagleBlockTest, CompactWithRateLimiter)
+{
+    RateLimiterOptions limiter_options;
+    limiter_options.bytes_per_sec = 32 * 1024 * 1024;
+    limiter_options.target_latency_us = 1000000;
+    RateLimiter limiter(limiter_options);
+    BlockOptions options;
+    options.rate_limiter = &limiter;
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testcompactlimit/", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(block != NULL);
+
+    // half of 8MB is live
+    std::map<int64_t, std::string> objects;
+    for (int i = 0; i < 256; i++) {
+        std::string content(32 * 1024, 'a' + i % 26);
+        int64_t object_id = -1;
+        status = block->PutObject(content, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        if (i % 2 == 0) {
+            status = block->DeleteObject(object_id);
+            EXPECT_EQ(status.code(), kOk);
+        } else {
+            objects[object_id] = content;
+        }
+    }
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+
+    // 4MB is read and written at 32MB/s
+    int64_t start = NowMicros();
+    EagleBlock* new_block = NULL;
+    status = block->Compact(block->synced_sequence_number(), &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    EXPECT_GE(NowMicros() - start, 200000);
+
+    std::string result;
+    for (std::map<int64_t, std::string>::iterator it = objects.begin(); it != objects.end();
+            ++it) {
+        status = new_block->GetObject(it->first, &result);
+        EXPECT_EQ(status.code(), kOk);
+        EXPECT_TRUE(result == it->second);
+    }
+    // puts and reads of data file are reported
+    int64_t recorded = 0;
+    for (int i = 0; i < kLatencyBuckets; i++) {
+        recorded += limiter.latencies_[i];
+    }
+    EXPECT_GE(recorded, (int64_t)objects.size());
+    delete block;
+    delete new_block;
+}
+
+struct OnlineWriterArg {
+    EagleBlock* block;
+    bool compacting;
+    bool stop;
+    // objects put successfully, and whether they are deleted
+    std::map<int64_t, bool> objects;
+    int writes_while_compacting;
+};
+
+static void* OnlineWriteThread(void* arg) {
+    OnlineWriterArg* writer = (OnlineWriterArg*)arg;
+    std::vector<int64_t> live_ids;
+    for (int i = 0; !__atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE); i++) {
+        bool compacting = __atomic_load_n(&writer->compacting, __ATOMIC_ACQUIRE);
+        int64_t object_id = -1;
+        Status status = writer->block->PutObject(std::string(1024, 'a' + i % 26), &object_id);
+        if (status.code() != kOk) {
+            // rejected only when the last writes are copied
+            continue;
+        }
+        writer->objects[object_id] = false;
+        live_ids.push_back(object_id);
+        if (i % 3 == 0) {
+            int64_t deleted_id = live_ids[live_ids.size() / 2];
+            status = writer->block->DeleteObject(deleted_id);
+            if (status.code() == kOk) {
+                writer->objects[deleted_id] = true;
+                live_ids.erase(live_ids.begin() + live_ids.size() / 2);
+            }
+        }
+        if (compacting && __atomic_load_n(&writer->compacting, __ATOMIC_ACQUIRE)) {
+            writer->writes_while_compacting++;
+        }
+    }
+    return NULL;
+}
+
+TEST_F(EagleBlockTest, OnlineCompact)
+{
+    BlockOptions options;
+    options.tail_buffer_size = 64 * 1024;
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testonlinecompact/", options, &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_TRUE(block != NULL);
+
+    OnlineWriterArg arg;
+    arg.block = block;
+    arg.compacting = false;
+    arg.stop = false;
+    arg.writes_while_compacting = 0;
+    for (int i = 0; i < 20000; i++) {
+        int64_t object_id = -1;
+        status = block->PutObject(std::string(1024, 'a' + i % 26), &object_id);
+        EXPECT_EQ(status.code(), kOk);
+        arg.objects[object_id] = false;
+    }
+    for (int i = 0; i < 20000; i += 2) {
+        status = block->DeleteObject(i);
+        EXPECT_EQ(status.code(), kOk);
+        arg.objects[i] = true;
+    }
+    status = block->Sync();
+    EXPECT_EQ(status.code(), kOk);
+    int64_t end_sequence_number = block->synced_sequence_number();
+
+    // puts & deletes go on while objects are copied
+    pthread_t thread;
+    pthread_create(&thread, NULL, OnlineWriteThread, &arg);
+    while (block->max_sequence_number() < end_sequence_number + 100) {
+        usleep(100);
+    }
+    __atomic_store_n(&arg.compacting, true, __ATOMIC_RELEASE);
+    EagleBlock* new_block = NULL;
+    status = block->Compact(end_sequence_number, &new_block);
+    __atomic_store_n(&arg.compacting, false, __ATOMIC_RELEASE);
+    EXPECT_EQ(status.code(), kOk);
+    ASSERT_TRUE(new_block != NULL);
+    __atomic_store_n(&arg.stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    EXPECT_GT(arg.writes_while_compacting, 0);
+
+    // old block rejects writes once compacted
+    int64_t object_id = -1;
+    status = block->PutObject("rejected", &object_id);
+    EXPECT_NE(status.code(), kOk);
+
+    // every accepted write is in new block
+    EXPECT_EQ(new_block->max_sequence_number(), block->max_sequence_number());
+    int64_t live_num = 0;
+    std::string result;
+    for (std::map<int64_t, bool>::iterator it = arg.objects.begin(); it != arg.objects.end();
+            ++it) {
+        status = new_block->GetObject(it->first, &result);
+        if (it->second) {
+            EXPECT_EQ(status.code(), kObjectNotFound);
+        } else {
+            EXPECT_EQ(status.code(), kOk);
+            EXPECT_EQ(result.size(), 1024u);
+            live_num++;
+        }
+    }
+    delete block;
+    delete new_block;
+
+    // new block is durable
+    new_block = NULL;
+    status = EagleBlock::OpenBlock("./testonlinecompact", &new_block);
+    EXPECT_EQ(status.code(), kOk);
+    int64_t found = 0;
+    for (std::map<int64_t, bool>::iterator it = arg.objects.begin(); it != arg.objects.end();
+            ++it) {
+        if (new_block->GetObject(it->first, &result).code() == kOk) {
+            found++;
+        }
+    }
+    EXPECT_EQ(found, live_num);
+    delete new_block;
+}
+
 TEST_F(EagleBlockTest, CompactAll)
 {
     EagleBlock* block = NULL;
@@ -0,0 +1,119 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: benchmark of memory index tables, HashTable vs SwissTable
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-8-12
+*
+* Usage: hash_table_bench [num_objects] [slot_num]
+*   slot_num is the fixed slot number of HashTable, default is the one of a 16GB block,
+*   ie. 16GB / kAveObjectSize
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "eagleengine/block_index.h"
+#include "eagleengine/hash_table.h"
+#include "eagleengine/swiss_table.h"
+
+using namespace eagleengine;
+
+static int64_t NowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void Report(const char* table, const char* op, int64_t num, int64_t begin) {
+    int64_t elapsed = NowNanos() - begin;
+    printf("%-12s %-12s %10ld ops %8.1f ns/op\n", table, op, num, (double)elapsed / num);
+}
+
+template <typename Table>
+static void Bench(const char* name, Table* table, const std::vector<int64_t>& ids) {
+    int64_t num = ids.size();
+    IndexEntry entry;
+    IndexEntry old_entry;
+    int64_t found = 0;
+
+    int64_t begin = NowNanos();
+    for (int64_t i = 0; i < num; ++i) {
+        entry.sequence_number = i;
+        entry.object_id = i;
+        entry.offset = i * 4096;
+        entry.size = 4096;
+        table->Insert(entry, &old_entry);
+    }
+    Report(name, "insert", num, begin);
+
+    // lookups in random order, like GetObject from many clients
+    begin = NowNanos();
+    for (int64_t i = 0; i < num; ++i) {
+        found += table->Get(ids[i], &entry);
+    }
+    Report(name, "get", num, begin);
+
+    begin = NowNanos();
+    for (int64_t i = 0; i < num; ++i) {
+        found += table->Get(ids[i] + num, &entry);
+    }
+    Report(name, "get_miss", num, begin);
+
+    begin = NowNanos();
+    for (int64_t i = 0; i < num; i += 2) {
+        table->Delete(ids[i]);
+    }
+    Report(name, "delete", num / 2, begin);
+
+    begin = NowNanos();
+    for (int64_t i = 0; i < num; ++i) {
+        found += table->Get(ids[i], &entry);
+    }
+    Report(name, "get_deleted", num, begin);
+
+    if (found != num + num / 2) {
+        fprintf(stderr, "%s: unexpected found %ld\n", name, found);
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    int64_t num = 1000000;
+    int64_t slot_num = 16L * 1024 * 1024 * 1024 / (700 * 1024);
+    if (argc > 1) {
+        num = atol(argv[1]);
+    }
+    if (argc > 2) {
+        slot_num = atol(argv[2]);
+    }
+
+    std::vector<int64_t> ids(num);
+    for (int64_t i = 0; i < num; ++i) {
+        ids[i] = i;
+    }
+    srand(1);
+    std::random_shuffle(ids.begin(), ids.end());
+
+    printf("objects: %ld, HashTable slots: %ld\n", num, slot_num);
+    {
+        HashTable<IndexEntry> table((int)slot_num);
+        Bench("HashTable", &table, ids);
+    }
+    {
+        SwissTable<IndexEntry> table(slot_num);
+        Bench("SwissTable", &table, ids);
+    }
+    {
+        SwissTable<IndexEntry> table(num);
+        Bench("SwissTable*", &table, ids);
+    }
+    printf("SwissTable*: capacity reserved for all objects\n");
+    return 0;
+}
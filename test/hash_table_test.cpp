@@ -12,8 +12,10 @@
 #define private public
 
 #include <map>
+#include <pthread.h>
 #include "gperftools/heap-checker.h"
 #include "eagleengine/hash_table.h"
+#include "eagleengine/swiss_table.h"
 #include "gtest/gtest.h"
 
 int main(int argc, char** argv) {
@@ -140,4 +142,346 @@ TEST_F(HashTableTest, Delete)
     }
 }
 
+TEST_F(HashTableTest, BulkInsert)
+{
+    HashTable<MemIndexEntry> ht(97);
+
+    // some values exist already
+    for (int i = 1; i <= 100; i += 2)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+
+        MemIndexEntry old;
+        EXPECT_TRUE(ht.Insert(tmp, &old));
+    }
+
+    // unordered values, merged with existing ones
+    std::vector<MemIndexEntry> values;
+    for (int i = 2000; i > 0; i--)
+    {
+        if (i <= 100 && i % 2 == 1) {
+            continue;
+        }
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        tmp.size = i * 10;
+        values.push_back(tmp);
+    }
+    MemIndexEntry old;
+    EXPECT_EQ(ht.BulkInsert(&values, &old), -1);
+    EXPECT_EQ(ht.size(), 2000);
+    EXPECT_EQ(ht.free_pool_size(), 0);
+    for (int j = 1; j <= 2000; j++)
+    {
+        MemIndexEntry value;
+        EXPECT_TRUE(ht.Get(j, &value));
+        EXPECT_EQ(value.object_id, j);
+    }
+
+    // chains are still sorted, so that delete works
+    for (int j = 1; j <= 2000; j += 3)
+    {
+        ht.Delete(j);
+    }
+    EXPECT_EQ(ht.size(), 2000 - 667);
+    for (int j = 1; j <= 2000; j++)
+    {
+        MemIndexEntry value;
+        EXPECT_EQ(ht.Get(j, &value), j % 3 != 1);
+    }
+
+    // stop at duplicated key
+    values.clear();
+    for (int i = 3000; i >= 2998; i--)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        values.push_back(tmp);
+    }
+    MemIndexEntry tmp;
+    tmp.object_id = 2;
+    tmp.size = 20;
+    values.push_back(tmp);
+    EXPECT_EQ(ht.BulkInsert(&values, &old), 0);
+    EXPECT_EQ(old.object_id, 2);
+    EXPECT_EQ(old.size, 20);
+    EXPECT_FALSE(ht.Get(2998, &tmp));
+}
+
+TEST_F(HashTableTest, Resize)
+{
+    HashTable<MemIndexEntry> ht(10);
+
+    // grow while values are inserted, lookups work in the middle of resizing
+    bool checked_resizing = false;
+    for (int i = 1; i <= 5000; i++)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        tmp.size = i * 10;
+        MemIndexEntry old;
+        EXPECT_TRUE(ht.Insert(tmp, &old));
+        if (ht.resizing() && !checked_resizing && ht.slot_num() > 1000) {
+            checked_resizing = true;
+            for (int j = 1; j <= i; j++)
+            {
+                MemIndexEntry value;
+                EXPECT_TRUE(ht.Get(j, &value));
+                EXPECT_EQ(value.size, j * 10);
+            }
+            tmp.object_id = 1;
+            EXPECT_FALSE(ht.Insert(tmp, &old));
+            std::vector<MemIndexEntry> values;
+            ht.Dump(&values);
+            EXPECT_EQ((int)values.size(), i);
+        }
+    }
+    EXPECT_TRUE(checked_resizing);
+    EXPECT_EQ(ht.size(), 5000);
+    EXPECT_GE(ht.slot_num(), 5000 / kMaxLoadFactor);
+    EXPECT_EQ(ht.free_pool_size(), 120);
+    for (int j = 1; j <= 5000; j++)
+    {
+        MemIndexEntry value;
+        EXPECT_TRUE(ht.Get(j, &value));
+        EXPECT_EQ(value.size, j * 10);
+    }
+
+    // chains are still sorted, delete stops early in a sorted chain
+    for (int j = 2; j <= 5000; j += 2)
+    {
+        ht.Delete(j);
+    }
+    for (int j = 1; j <= 5000; j++)
+    {
+        MemIndexEntry value;
+        EXPECT_EQ(ht.Get(j, &value), j % 2 == 1);
+    }
+
+    // shrink back to the initial slot number
+    for (int j = 1; j <= 5000; j += 2)
+    {
+        ht.Delete(j);
+    }
+    EXPECT_EQ(ht.size(), 0);
+    for (int i = 0; i < 1000 && (ht.slot_num() > 10 || ht.resizing()); i++)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = -i;
+        MemIndexEntry old;
+        EXPECT_TRUE(ht.Insert(tmp, &old));
+        ht.Delete(-i);
+    }
+    EXPECT_EQ(ht.slot_num(), 10);
+    EXPECT_FALSE(ht.resizing());
+    EXPECT_EQ(ht.free_pool_size(), 5120);
+
+    // bulk insert grows at once
+    std::vector<MemIndexEntry> values;
+    for (int i = 10000; i > 0; i--)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        values.push_back(tmp);
+    }
+    MemIndexEntry old;
+    EXPECT_EQ(ht.BulkInsert(&values, &old), -1);
+    EXPECT_FALSE(ht.resizing());
+    EXPECT_GE(ht.slot_num(), 10000 / kMaxLoadFactor);
+    for (int j = 1; j <= 10000; j++)
+    {
+        MemIndexEntry value;
+        EXPECT_TRUE(ht.Get(j, &value));
+    }
+}
+
+struct ConcurrentReadArg {
+    HashTable<MemIndexEntry>* ht;
+    volatile bool* stop;
+    int64_t errors;
+};
+
+static void* ConcurrentRead(void* arg) {
+    ConcurrentReadArg* read_arg = (ConcurrentReadArg*)arg;
+    while (!__atomic_load_n(read_arg->stop, __ATOMIC_ACQUIRE)) {
+        // keys below 1000 are never deleted, others come and go
+        for (int j = 0; j < 2000; j++)
+        {
+            MemIndexEntry value;
+            bool found = read_arg->ht->Get(j, &value);
+            if ((j < 1000 && !found) || (found && value.size != j * 10)) {
+                read_arg->errors++;
+            }
+        }
+    }
+    return NULL;
+}
+
+TEST_F(HashTableTest, ConcurrentReaders)
+{
+    HashTable<MemIndexEntry> ht(10);
+    for (int i = 0; i < 1000; i++)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        tmp.size = i * 10;
+        MemIndexEntry old;
+        EXPECT_TRUE(ht.Insert(tmp, &old));
+    }
+
+    volatile bool stop = false;
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    ConcurrentReadArg args[thread_num];
+    for (int i = 0; i < thread_num; i++)
+    {
+        args[i].ht = &ht;
+        args[i].stop = &stop;
+        args[i].errors = 0;
+        pthread_create(&threads[i], NULL, ConcurrentRead, &args[i]);
+    }
+
+    // the writer grows & shrinks the table, and reuses deleted nodes
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 1000; i < 20000; i += (round % 2 == 0 ? 1 : 97))
+        {
+            MemIndexEntry tmp;
+            tmp.object_id = i;
+            tmp.size = i * 10;
+            MemIndexEntry old;
+            ht.Insert(tmp, &old);
+        }
+        for (int i = 1000; i < 20000; i++)
+        {
+            ht.Delete(i);
+        }
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < thread_num; i++)
+    {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(args[i].errors, 0);
+    }
+    EXPECT_EQ(ht.size(), 1000);
+}
+
+TEST_F(HashTableTest, SwissTable)
+{
+    SwissTable<MemIndexEntry> ht(10);
+    EXPECT_EQ(ht.capacity(), 16);
+
+    // grow from one group
+    int test_node_num = 2000;
+    for (int i = 1; i <= test_node_num; i++)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        tmp.size = i * 10;
+
+        MemIndexEntry old;
+        EXPECT_TRUE(ht.Insert(tmp, &old));
+    }
+    EXPECT_EQ(ht.size(), 2000);
+    EXPECT_EQ(ht.capacity(), 4096);
+    for (int j = 1; j <= test_node_num; j++)
+    {
+        MemIndexEntry value;
+        EXPECT_TRUE(ht.Get(j, &value));
+        EXPECT_EQ(value.size, j * 10);
+    }
+    MemIndexEntry non_exist;
+    EXPECT_FALSE(ht.Get(test_node_num + 10, &non_exist));
+    EXPECT_FALSE(ht.Get(-1, &non_exist));
+
+    // insert exist
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = 10;
+        MemIndexEntry value;
+        EXPECT_FALSE(ht.Insert(tmp, &value));
+        EXPECT_EQ(value.size, 100);
+    }
+
+    // delete & insert again many times, tombstones are dropped without growing
+    for (int round = 0; round < 10; round++)
+    {
+        for (int j = 1; j <= test_node_num; j += 2)
+        {
+            ht.Delete(j);
+        }
+        EXPECT_EQ(ht.size(), 1000);
+        for (int j = 1; j <= test_node_num; j++)
+        {
+            MemIndexEntry value;
+            EXPECT_EQ(ht.Get(j, &value), j % 2 == 0);
+        }
+        for (int j = 1; j <= test_node_num; j += 2)
+        {
+            MemIndexEntry tmp;
+            tmp.object_id = j + (round + 1) * test_node_num;
+            MemIndexEntry old;
+            EXPECT_TRUE(ht.Insert(tmp, &old));
+            tmp.object_id = j;
+            EXPECT_TRUE(ht.Insert(tmp, &old));
+            ht.Delete(j + (round + 1) * test_node_num);
+        }
+        EXPECT_EQ(ht.size(), 2000);
+        EXPECT_LE(ht.capacity(), 4096);
+    }
+
+    std::vector<MemIndexEntry> values;
+    ht.Dump(&values);
+    EXPECT_EQ(values.size(), 2000u);
+    std::map<int64_t, int> ids;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        ids[values[i].object_id]++;
+    }
+    EXPECT_EQ(ids.size(), 2000u);
+    EXPECT_EQ(ids.begin()->first, 1);
+    EXPECT_EQ(ids.rbegin()->first, 2000);
+}
+
+TEST_F(HashTableTest, SwissTableBulkInsert)
+{
+    SwissTable<MemIndexEntry> ht(97);
+
+    std::vector<MemIndexEntry> values;
+    for (int i = 2000; i > 0; i--)
+    {
+        MemIndexEntry tmp;
+        tmp.object_id = i;
+        values.push_back(tmp);
+    }
+    MemIndexEntry old;
+    EXPECT_EQ(ht.BulkInsert(&values, &old), -1);
+    EXPECT_EQ(ht.size(), 2000);
+
+    std::vector<int64_t> keys;
+    keys.push_back(1);
+    keys.push_back(3000);
+    keys.push_back(2000);
+    std::vector<MemIndexEntry> found_values;
+    std::vector<bool> found;
+    EXPECT_EQ(ht.GetBatch(keys, &found_values, &found), 2);
+    EXPECT_TRUE(found[0]);
+    EXPECT_FALSE(found[1]);
+    EXPECT_EQ(found_values[2].object_id, 2000);
+
+    // stop at duplicated key
+    values.clear();
+    MemIndexEntry tmp;
+    tmp.object_id = 3000;
+    values.push_back(tmp);
+    tmp.object_id = 2;
+    values.push_back(tmp);
+    tmp.object_id = 3001;
+    values.push_back(tmp);
+    EXPECT_EQ(ht.InsertBatch(values, &old), 1);
+    EXPECT_EQ(old.object_id, 2);
+    EXPECT_FALSE(ht.Get(3001, &tmp));
+}
+
 }
@@ -0,0 +1,159 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: gtest for object cache
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-9-16
+*
+*/
+
+#define private public
+
+#include <pthread.h>
+#include "gperftools/heap-checker.h"
+#include "eagleengine/object_cache.h"
+#include "gtest/gtest.h"
+
+int main(int argc, char** argv) {
+
+    testing::InitGoogleTest(&argc, argv);
+    int code = RUN_ALL_TESTS();
+
+    return code;
+}
+
+namespace eagleengine {
+
+static bool Cached(ObjectCache* cache, uint64_t block_id, int64_t object_id,
+                   std::string* value) {
+    ObjectCache::Handle* handle = cache->Lookup(block_id, object_id);
+    if (handle == NULL) {
+        return false;
+    }
+    Slice content = cache->Value(handle);
+    value->assign(content.data(), content.size());
+    cache->Release(handle);
+    return true;
+}
+
+TEST(ObjectCacheTest, InsertLookupErase)
+{
+    ObjectCache cache(16 * 1024 * 1024);
+    uint64_t block1 = cache.NewId();
+    uint64_t block2 = cache.NewId();
+    EXPECT_NE(block1, block2);
+
+    std::string value;
+    EXPECT_FALSE(Cached(&cache, block1, 1, &value));
+    cache.Insert(block1, 1, "object 1 of block 1");
+    cache.Insert(block2, 1, "object 1 of block 2");
+    cache.Insert(block1, 2, "object 2 of block 1");
+    EXPECT_TRUE(Cached(&cache, block1, 1, &value));
+    EXPECT_EQ(value, "object 1 of block 1");
+    EXPECT_TRUE(Cached(&cache, block2, 1, &value));
+    EXPECT_EQ(value, "object 1 of block 2");
+
+    // a handle keeps the object even if it is erased
+    ObjectCache::Handle* handle = cache.Lookup(block1, 2);
+    ASSERT_TRUE(handle != NULL);
+    cache.Erase(block1, 2);
+    EXPECT_FALSE(Cached(&cache, block1, 2, &value));
+    EXPECT_EQ(cache.Value(handle).ToString(), "object 2 of block 1");
+    cache.Release(handle);
+
+    cache.EraseBlock(block1);
+    EXPECT_FALSE(Cached(&cache, block1, 1, &value));
+    EXPECT_TRUE(Cached(&cache, block2, 1, &value));
+    EXPECT_EQ(cache.usage(), (int64_t)strlen("object 1 of block 2"));
+
+    // larger than a shard
+    cache.Insert(block2, 2, std::string(2 * 1024 * 1024, 'a'));
+    EXPECT_FALSE(Cached(&cache, block2, 2, &value));
+}
+
+TEST(ObjectCacheTest, ScanResistance)
+{
+    const int64_t object_size = 4096;
+    ObjectCache cache(16 * 1024 * 1024);
+    uint64_t block = cache.NewId();
+    const std::string content(object_size, 'x');
+
+    // hot objects are half of the cache, read a few times each
+    const int hot_num = 2048;
+    std::string value;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < hot_num; i++) {
+            if (!Cached(&cache, block, i, &value)) {
+                cache.Insert(block, i, content);
+            }
+        }
+    }
+
+    // a scan reads 4 times of the cache once
+    for (int i = hot_num; i < hot_num + 16384; i++) {
+        if (!Cached(&cache, block, i, &value)) {
+            cache.Insert(block, i, content);
+        }
+    }
+    EXPECT_LE(cache.usage(), cache.capacity());
+
+    int hits = 0;
+    for (int i = 0; i < hot_num; i++) {
+        if (Cached(&cache, block, i, &value)) {
+            hits++;
+        }
+    }
+    EXPECT_GE(hits, hot_num * 9 / 10);
+}
+
+struct ReaderArg {
+    ObjectCache* cache;
+    uint64_t block_id;
+    int seed;
+};
+
+static void* ReadThread(void* arg) {
+    ReaderArg* reader = (ReaderArg*)arg;
+    std::string value;
+    unsigned int seed = reader->seed;
+    for (int i = 0; i < 20000; i++) {
+        int64_t object_id = rand_r(&seed) % 1000;
+        if (!Cached(reader->cache, reader->block_id, object_id, &value)) {
+            char tmp[32];
+            snprintf(tmp, sizeof(tmp), "%ld", object_id);
+            reader->cache->Insert(reader->block_id, object_id, std::string(tmp) +
+                                  std::string(rand_r(&seed) % 8192, 'c'));
+        } else {
+            char tmp[32];
+            snprintf(tmp, sizeof(tmp), "%ld", object_id);
+            EXPECT_EQ(value.compare(0, strlen(tmp), tmp), 0);
+        }
+        if (i % 100 == 0) {
+            reader->cache->Erase(reader->block_id, object_id);
+        }
+    }
+    return NULL;
+}
+
+TEST(ObjectCacheTest, ConcurrentReaders)
+{
+    ObjectCache cache(2 * 1024 * 1024);
+    uint64_t block = cache.NewId();
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    ReaderArg args[thread_num];
+    for (int i = 0; i < thread_num; i++) {
+        args[i].cache = &cache;
+        args[i].block_id = block;
+        args[i].seed = i;
+        pthread_create(&threads[i], NULL, ReadThread, &args[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    EXPECT_LE(cache.usage(), cache.capacity());
+}
+
+}
@@ -1,2 +1,2 @@
 make clean;make
-rm -rf testpath testpath1 testpath2 testcompact testsync testcompactall;mkdir testpath testpath1 testpath2 testcompact testsync testcompactall
+rm -rf testpath testpath1 testpath2 testcompact testsync testcompactall testputobjects testconcurrent testindexhole testgetobject testmultiget testasync testasyncuring testasynctail testasyncfailure testsyncwait testsyncbytes testsynctime testsyncwaiters testdurable testcheckpoint testcorruptedtail testseal testsealtable testsealfailure testfakefooter testobjectcache testtailbuffer testadler32 testverify testonlinecompact testcompacturing testcompactsync testcompactrange testcompactcorrupted testcompactlimit testgarbage testconcurrentdelete testduptombstone;mkdir testpath testpath1 testpath2 testcompact testsync testcompactall testputobjects testconcurrent testindexhole testgetobject testmultiget testasync testasyncuring testasynctail testasyncfailure testsyncwait testsyncbytes testsynctime testsyncwaiters testdurable testcheckpoint testcorruptedtail testseal testsealtable testsealfailure testfakefooter testobjectcache testtailbuffer testadler32 testverify testonlinecompact testcompacturing testcompactsync testcompactrange testcompactcorrupted testcompactlimit testgarbage testconcurrentdelete testduptombstone
@@ -0,0 +1,161 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: gtest for rate limiter
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-10-14
+*
+*/
+
+#define private public
+
+#include <pthread.h>
+#include "gperftools/heap-checker.h"
+#include "eagleengine/rate_limiter.h"
+#include "eagleengine/util.h"
+#include "gtest/gtest.h"
+
+int main(int argc, char** argv) {
+
+    testing::InitGoogleTest(&argc, argv);
+    int code = RUN_ALL_TESTS();
+
+    return code;
+}
+
+namespace eagleengine {
+
+TEST(RateLimiterTest, Unlimited)
+{
+    RateLimiter limiter((RateLimiterOptions()));
+    int64_t start = NowMicros();
+    for (int i = 0; i < 1000; i++) {
+        limiter.Request(1024 * 1024);
+    }
+    EXPECT_LT(NowMicros() - start, 100000);
+}
+
+TEST(RateLimiterTest, BytesPerSecond)
+{
+    RateLimiterOptions options;
+    options.bytes_per_sec = 64 * 1024 * 1024;
+    RateLimiter limiter(options);
+    int64_t start = NowMicros();
+    for (int i = 0; i < 32; i++) {
+        limiter.Request(1024 * 1024);
+    }
+    int64_t elapsed = NowMicros() - start;
+    EXPECT_GE(elapsed, 450000);
+    EXPECT_LT(elapsed, 2000000);
+}
+
+TEST(RateLimiterTest, IosPerSecond)
+{
+    RateLimiterOptions options;
+    options.bytes_per_sec = 1024 * 1024 * 1024;
+    options.ios_per_sec = 1000;
+    RateLimiter limiter(options);
+    int64_t start = NowMicros();
+    for (int i = 0; i < 200; i++) {
+        limiter.Request(4096);
+    }
+    int64_t elapsed = NowMicros() - start;
+    EXPECT_GE(elapsed, 180000);
+    EXPECT_LT(elapsed, 2000000);
+}
+
+static void* RequestThread(void* arg) {
+    RateLimiter* limiter = (RateLimiter*)arg;
+    for (int i = 0; i < 8; i++) {
+        limiter->Request(1024 * 1024);
+    }
+    return NULL;
+}
+
+TEST(RateLimiterTest, SharedByThreads)
+{
+    RateLimiterOptions options;
+    options.bytes_per_sec = 64 * 1024 * 1024;
+    RateLimiter limiter(options);
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    int64_t start = NowMicros();
+    for (int i = 0; i < thread_num; i++) {
+        pthread_create(&threads[i], NULL, RequestThread, &limiter);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // the budget is shared, 32MB in total
+    int64_t elapsed = NowMicros() - start;
+    EXPECT_GE(elapsed, 450000);
+    EXPECT_LT(elapsed, 2000000);
+}
+
+TEST(RateLimiterTest, LatencyBuckets)
+{
+    unsigned int seed = 1;
+    for (int i = 0; i < 10000; i++) {
+        int64_t micros = rand_r(&seed) % (1 << (i % 30));
+        int bucket = RateLimiter::LatencyBucket(micros);
+        ASSERT_LT(bucket, kLatencyBuckets - 1);
+        EXPECT_LE(RateLimiter::BucketLatency(bucket), micros);
+        EXPECT_GT(RateLimiter::BucketLatency(bucket + 1), micros);
+    }
+}
+
+// record latencies and start a new window
+static void NextWindow(RateLimiter* limiter, int64_t micros, int num) {
+    for (int i = 0; i < num; i++) {
+        limiter->RecordLatency(micros);
+    }
+    limiter->last_adjust_us_ = NowMicros() - limiter->options_.adjust_interval_ms * 1000 - 1;
+    limiter->Request(1);
+}
+
+TEST(RateLimiterTest, Adaptive)
+{
+    RateLimiterOptions options;
+    options.bytes_per_sec = 1024 * 1024 * 1024;
+    options.target_latency_us = 1000;
+    RateLimiter limiter(options);
+    EXPECT_EQ(limiter.rate_percent(), 100);
+
+    // backs off when p99 is over target
+    NextWindow(&limiter, 5000, 100);
+    EXPECT_EQ(limiter.rate_percent(), 70);
+    NextWindow(&limiter, 5000, 100);
+    EXPECT_EQ(limiter.rate_percent(), 49);
+    for (int i = 0; i < 10; i++) {
+        NextWindow(&limiter, 5000, 100);
+    }
+    EXPECT_EQ(limiter.rate_percent(), options.min_rate_percent);
+
+    // a few slow requests are not counted in p99
+    NextWindow(&limiter, 100, 1000);
+    EXPECT_EQ(limiter.rate_percent(), 20);
+    for (int i = 0; i < 9; i++) {
+        limiter.RecordLatency(5000);
+    }
+    NextWindow(&limiter, 100, 991);
+    EXPECT_EQ(limiter.rate_percent(), 30);
+    // too few samples
+    NextWindow(&limiter, 5000, kRateLimiterMinSamples - 1);
+    EXPECT_EQ(limiter.rate_percent(), 40);
+    for (int i = 0; i < 10; i++) {
+        NextWindow(&limiter, 100, 100);
+    }
+    EXPECT_EQ(limiter.rate_percent(), 100);
+
+    // latencies recorded while the limiter is idle are dropped
+    for (int i = 0; i < 100; i++) {
+        limiter.RecordLatency(5000);
+    }
+    limiter.last_adjust_us_ = NowMicros() - options.adjust_interval_ms * 3000;
+    limiter.Request(1);
+    EXPECT_EQ(limiter.rate_percent(), 100);
+}
+
+}
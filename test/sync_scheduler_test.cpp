@@ -0,0 +1,186 @@
+/*
+* Copyright (c) 2017, LIHAIBING All rights reserved.
+*
+* Description: gtest for sync scheduler
+*
+* Version : 1.0
+* Author :  lihaibing(593255200@qq.com)
+* Date :  2017-8-5
+*
+*/
+
+#define private public
+
+#include <pthread.h>
+#include "eagleengine/eagleblock.h"
+#include "eagleengine/sync_scheduler.h"
+#include "gtest/gtest.h"
+
+int main(int argc, char** argv) {
+
+    testing::InitGoogleTest(&argc, argv);
+    int code = RUN_ALL_TESTS();
+
+    return code;
+}
+
+namespace eagleengine {
+
+class SyncSchedulerTest: public ::testing::Test {
+public:
+    virtual void SetUp() {
+    }
+    virtual void TearDown() {
+    }
+};
+
+static void PutObjects(EagleBlock* block, int num, int size) {
+    std::string content(size, 'x');
+    for (int i = 0; i < num; i++) {
+        int64_t object_id = -1;
+        Status status = block->PutObject(content, &object_id);
+        EXPECT_EQ(status.code(), kOk);
+    }
+}
+
+// wait at most 5s until all writes of block are synced
+static bool WaitSynced(EagleBlock* block) {
+    for (int i = 0; i < 500; i++) {
+        if (block->synced_sequence_number() == block->max_sequence_number()) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+TEST_F(SyncSchedulerTest, WaitForSyncWithoutScheduler)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testsyncwait/", &block);
+    EXPECT_EQ(status.code(), kOk);
+
+    PutObjects(block, 100, 100);
+    EXPECT_EQ(block->synced_sequence_number(), -1);
+    EXPECT_GT(block->unsynced_bytes(), 100 * 100);
+    status = block->WaitForSync(99);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->synced_sequence_number(), 99);
+    EXPECT_EQ(block->unsynced_bytes(), 0);
+
+    // not written yet
+    status = block->WaitForSync(100);
+    EXPECT_EQ(status.code(), kInvalidArg);
+
+    // synced writes are kept after reopen
+    delete block;
+    block = NULL;
+    status = EagleBlock::OpenBlock("./testsyncwait/", &block);
+    EXPECT_EQ(status.code(), kOk);
+    EXPECT_EQ(block->synced_sequence_number(), 99);
+    EXPECT_EQ(block->num_objects(), 100);
+    delete block;
+}
+
+TEST_F(SyncSchedulerTest, SyncByBytesAndTime)
+{
+    EagleBlock* bytes_block = NULL;
+    Status status = EagleBlock::CreateBlock("./testsyncbytes/", &bytes_block);
+    EXPECT_EQ(status.code(), kOk);
+    EagleBlock* time_block = NULL;
+    status = EagleBlock::CreateBlock("./testsynctime/", &time_block);
+    EXPECT_EQ(status.code(), kOk);
+
+    SyncOptions options;
+    options.sync_bytes = 64 * 1024;
+    options.sync_interval_ms = 200;
+    options.writeback_bytes = 16 * 1024;
+    SyncScheduler scheduler(options);
+    scheduler.AddBlock(bytes_block);
+    scheduler.AddBlock(time_block);
+    status = scheduler.Start();
+    EXPECT_EQ(status.code(), kOk);
+
+    // synced once unsynced bytes exceed sync_bytes
+    PutObjects(bytes_block, 100, 1024);
+    EXPECT_TRUE(WaitSynced(bytes_block));
+    EXPECT_LT(bytes_block->unsynced_bytes(), options.sync_bytes);
+
+    // synced after sync_interval_ms even if there are a few unsynced bytes
+    int64_t start = NowMicros();
+    PutObjects(time_block, 1, 100);
+    EXPECT_TRUE(WaitSynced(time_block));
+    EXPECT_GE(time_block->last_sync_time() - start, 100 * 1000);
+
+    // removed from scheduler when deleted
+    delete time_block;
+    EXPECT_EQ(scheduler.blocks_.size(), 1u);
+
+    // unsynced writes are synced when scheduler is stopped
+    PutObjects(bytes_block, 1, 100);
+    scheduler.Stop();
+    EXPECT_EQ(bytes_block->synced_sequence_number(), bytes_block->max_sequence_number());
+    delete bytes_block;
+}
+
+struct SyncWriterArg {
+    EagleBlock* block;
+    int num;
+    int failed;
+};
+
+static void* DurablePutThread(void* arg) {
+    SyncWriterArg* writer_arg = (SyncWriterArg*)arg;
+    for (int i = 0; i < writer_arg->num; i++) {
+        int64_t object_id = -1;
+        Status status = writer_arg->block->PutObject("durable object", &object_id);
+        if (status.code() == kOk) {
+            status = writer_arg->block->WaitForSync(object_id);
+        }
+        if (status.code() != kOk ||
+                writer_arg->block->synced_sequence_number() < object_id) {
+            writer_arg->failed++;
+        }
+    }
+    return NULL;
+}
+
+TEST_F(SyncSchedulerTest, WaitForSyncWithScheduler)
+{
+    EagleBlock* block = NULL;
+    Status status = EagleBlock::CreateBlock("./testsyncwaiters/", &block);
+    EXPECT_EQ(status.code(), kOk);
+
+    // never synced by bytes or time, only by waiters
+    SyncOptions options;
+    options.sync_bytes = 1024 * 1024 * 1024;
+    options.sync_interval_ms = 3600 * 1000;
+    options.check_interval_ms = 1000;
+    SyncScheduler scheduler(options);
+    scheduler.AddBlock(block);
+    status = scheduler.Start();
+    EXPECT_EQ(status.code(), kOk);
+
+    const int thread_num = 4;
+    pthread_t threads[thread_num];
+    SyncWriterArg args[thread_num];
+    for (int i = 0; i < thread_num; i++) {
+        args[i].block = block;
+        args[i].num = 50;
+        args[i].failed = 0;
+        pthread_create(&threads[i], NULL, DurablePutThread, &args[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(args[i].failed, 0);
+    }
+    EXPECT_EQ(block->synced_sequence_number(), thread_num * 50 - 1);
+    EXPECT_EQ(block->sync_waiters(), 0);
+
+    delete block;
+    EXPECT_TRUE(scheduler.blocks_.empty());
+}
+
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -1,3 +1,4 @@
+#include <time.h>
 #include "eagleengine/util.h"
 
 namespace eagleengine {
@@ -62,6 +63,12 @@ int StringVprintf(std::string* output, const char* format, va_list args) {
     return rc;
 }
 
+int64_t NowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
 }
 
 /* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -11,6 +12,8 @@
 namespace eagleengine {
 extern int StringPrintfImpl(std::string& output, const char* format, va_list args);
 extern int StringVprintf(std::string* output, const char* format, va_list args);
+// microseconds of monotonic clock
+extern int64_t NowMicros();
 }
 
 #endif  //_EAGLEFS_UTIL_H_